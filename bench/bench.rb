@@ -0,0 +1,217 @@
+# Benchmarks the database through its REPL on synthetic viewing records.
+#
+# For each table size it times sequential and random inserts, point
+# lookups on key, lookups of missing keys, key range scans,
+# whole-table filter and top-N queries, and point lookups with a
+# full-table report run before each one, and prints one JSON object per workload with ops/s and p50/p99
+# latency in microseconds.
+#
+#   ruby bench/bench.rb [--db bin/build/db] [--sizes 500,2000,4000]
+#                       [--seed 42] [--skew 1.0] [--page-size 65536]
+#                       [--lookups 1000] [--scans 200] [--cache-pages N]
+#                       [--memtable ROWS] [--bloom-filter BITS]
+#
+# The data is generated from --seed alone, so two runs with the same
+# options do the same work. --skew is the Zipf exponent used to pick
+# stb, title, provider and date values (0 is uniform).
+#
+# Statements go through a pseudo terminal so the REPL flushes each
+# result as it is done; every latency is the time from sending a
+# statement to reading its "Executed." line.
+
+require "io/console"
+require "json"
+require "optparse"
+require "pty"
+
+options = {
+  db: "bin/build/db",
+  sizes: [500, 2000, 4000],
+  seed: 42,
+  skew: 1.0,
+  page_size: 65536,
+  lookups: 1000,
+  scans: 200,
+  cache_pages: nil,
+  memtable: nil,
+  bloom_filter: nil,
+}
+OptionParser.new do |parser|
+  parser.on("--db PATH") { |value| options[:db] = value }
+  parser.on("--sizes LIST") { |value| options[:sizes] = value.split(",").map(&:to_i) }
+  parser.on("--seed N", Integer) { |value| options[:seed] = value }
+  parser.on("--skew S", Float) { |value| options[:skew] = value }
+  parser.on("--page-size BYTES", Integer) { |value| options[:page_size] = value }
+  parser.on("--lookups N", Integer) { |value| options[:lookups] = value }
+  parser.on("--scans N", Integer) { |value| options[:scans] = value }
+  parser.on("--cache-pages N", Integer) { |value| options[:cache_pages] = value }
+  parser.on("--memtable ROWS", Integer) { |value| options[:memtable] = value }
+  parser.on("--bloom-filter BITS", Integer) { |value| options[:bloom_filter] = value }
+end.parse!
+
+# Picks 0...n with probability proportional to 1 / (rank + 1) ** skew
+class Zipf
+  def initialize(n, skew, random)
+    @random = random
+    total = 0.0
+    @cumulative = (0...n).map { |rank| total += 1.0 / (rank + 1) ** skew }
+  end
+
+  def pick
+    target = @random.rand * @cumulative.last
+    @cumulative.bsearch_index { |weight| weight >= target } || @cumulative.length - 1
+  end
+end
+
+Row = Struct.new(:stb, :title, :provider, :date, :rev, :time) do
+  def key
+    "#{stb}_#{title}_#{date}"
+  end
+
+  def insert
+    "insert #{stb} #{title} #{provider} #{date} #{rev} #{time}"
+  end
+end
+
+# Rows with distinct keys, sorted by key
+def generate_rows(count, skew, random)
+  stbs = Zipf.new([count / 4, 1].max, skew, random)
+  titles = Zipf.new([count / 2, 1].max, skew, random)
+  providers = Zipf.new(20, skew, random)
+  dates = Zipf.new(365, skew, random)
+  rows = {}
+  while rows.length < count
+    day = Time.utc(2014, 1, 1) + dates.pick * 86400
+    row = Row.new(
+      format("stb%05d", stbs.pick),
+      format("title%05d", titles.pick),
+      format("provider%02d", providers.pick),
+      day.strftime("%Y-%m-%d"),
+      format("%.2f", random.rand(1.0..20.0)),
+      format("%d:%02d", random.rand(0..3), random.rand(0..59)),
+    )
+    rows[row.key] ||= row
+  end
+  rows.values.sort_by(&:key)
+end
+
+class Session
+  def initialize(db, filename, options)
+    @master, slave = PTY.open
+    slave.raw!
+    arguments = ["--page-size", options[:page_size].to_s]
+    arguments += ["--cache-pages", options[:cache_pages].to_s] if options[:cache_pages]
+    arguments += ["--memtable", options[:memtable].to_s] if options[:memtable]
+    arguments += ["--bloom-filter", options[:bloom_filter].to_s] if options[:bloom_filter]
+    @pid = spawn(db, filename, *arguments, in: slave, out: slave, err: slave)
+    slave.close
+    @buffer = +""
+  end
+
+  # Send a statement and return how long it took in seconds
+  def run(statement)
+    start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    @master.write(statement + "\n")
+    loop do
+      line = read_line
+      raise "#{statement}: #{line}" if line.include?("Error") || line.include?("error")
+      break if line.end_with?("Executed.")
+    end
+    Process.clock_gettime(Process::CLOCK_MONOTONIC) - start
+  end
+
+  def close
+    @master.write(".exit\n")
+    Process.wait(@pid)
+    @master.close
+  end
+
+  private
+
+  def read_line
+    until (index = @buffer.index("\n"))
+      @buffer << @master.readpartial(65536)
+    end
+    @buffer.slice!(0..index).chomp
+  end
+end
+
+def percentile(sorted, fraction)
+  sorted[[(sorted.length * fraction).ceil - 1, 0].max]
+end
+
+def report(workload, rows, latencies)
+  sorted = latencies.sort
+  seconds = latencies.sum
+  puts JSON.generate(
+    workload: workload,
+    rows: rows,
+    ops: latencies.length,
+    seconds: seconds.round(6),
+    ops_per_sec: (latencies.length / seconds).round(1),
+    p50_us: (percentile(sorted, 0.50) * 1e6).round(1),
+    p99_us: (percentile(sorted, 0.99) * 1e6).round(1),
+  )
+  $stdout.flush
+end
+
+def with_session(options, filename)
+  File.delete(filename) if File.exist?(filename)
+  session = Session.new(options[:db], filename, options)
+  yield session
+ensure
+  session&.close
+end
+
+filename = "bench.db"
+options[:sizes].each do |size|
+  random = Random.new(options[:seed])
+  rows = generate_rows(size, options[:skew], random)
+
+  with_session(options, filename) do |session|
+    report("insert_sequential", size, rows.map { |row| session.run(row.insert) })
+  end
+
+  with_session(options, filename) do |session|
+    shuffled = rows.shuffle(random: random)
+    report("insert_random", size, shuffled.map { |row| session.run(row.insert) })
+
+    lookups = Array.new(options[:lookups]) { rows[random.rand(size)] }
+    report("point_lookup", size,
+           lookups.map { |row| session.run("select where key = #{row.key}") })
+
+    # Generated titles have no trailing "x", so none of these keys exist
+    missing = lookups.map { |row| "#{row.stb}_#{row.title}x_#{row.date}" }
+    report("point_lookup_missing", size,
+           missing.map { |key| session.run("select where key = #{key}") })
+
+    stbs = Array.new(options[:scans]) { rows[random.rand(size)].stb }
+    report("range_scan_stb", size,
+           stbs.map { |stb| session.run("select where stb = #{stb}") })
+
+    ranges = Array.new(options[:scans]) do
+      first = random.rand(size)
+      [rows[first].key, rows[[first + 100, size - 1].min].key]
+    end
+    report("range_scan_100", size, ranges.map do |first, last|
+      session.run("select where key >= #{first} and key <= #{last}")
+    end)
+
+    providers = Array.new(options[:scans]) { rows[random.rand(size)].provider }
+    report("filter_scan", size, providers.map do |provider|
+      session.run("select where provider = #{provider} and rev > 19.9")
+    end)
+    report("top_n", size, providers.map do |provider|
+      session.run("select where provider = #{provider} order by rev desc limit 10")
+    end)
+
+    # Interactive lookups of a few hot keys while a batch report keeps
+    # scanning the whole table; only the lookups are timed
+    hot = Array.new(10) { rows[random.rand(size)] }
+    report("point_lookup_mixed", size, Array.new(options[:scans]) do |i|
+      session.run("select where rev > 100")
+      session.run("select where key = #{hot[i % hot.length].key}")
+    end)
+  end
+end
+File.delete(filename) if File.exist?(filename)
@@ -0,0 +1,290 @@
+/*
+ * Throughput of many queries against a cold page cache, run one after
+ * another and then as tasks on one thread with several in flight, so the
+ * page reads of different queries overlap:
+ *
+ *   point_lookup  select where key = <value>, one key from each leaf
+ *   range_scan    select where key >= <a> and key <= <b> over about 50
+ *                 rows, so the cursor moves onto the next leaf
+ *
+ * Each workload is run at concurrency 1 (the sequential baseline), 2, 4,
+ * 8 and 16, reopening the database before each run so every page comes
+ * from the file again. --read-delay makes every page read wait first, to
+ * stand in for a device slower than the operating system's page cache.
+ * Each run is printed as one JSON line with the queries per second. The
+ * rows every run hands back are checked against what execute_select
+ * prints for the same statements.
+ *
+ *   bin/build/concurrent [--rows 500] [--read-delay 200] [--seed 42]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "btree.h"
+
+const uint32_t CONCURRENCY_LEVELS[] = {1, 2, 4, 8, 16};
+const uint32_t NUM_CONCURRENCY_LEVELS =
+    sizeof(CONCURRENCY_LEVELS) / sizeof(uint32_t);
+
+const uint32_t RANGE_ROWS = 50;
+
+uint64_t random_state;
+
+uint32_t next_random() {
+  // xorshift64
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return (uint32_t)(random_state >> 32);
+}
+
+void prepare(const char* text, Statement* statement) {
+  char buffer[256];
+  InputBuffer input_buffer = {buffer, sizeof(buffer), strlen(text)};
+  strcpy(buffer, text);
+  if (prepare_query(&input_buffer, statement) != PREPARE_SUCCESS) {
+    printf("Unable to prepare '%s'.\n", text);
+    exit(EXIT_FAILURE);
+  }
+}
+
+int compare_keys(const void* a, const void* b) {
+  return strcmp(a, b);
+}
+
+/*
+Insert num_rows rows in random order and return their keys, sorted
+*/
+char* load_table(const char* filename, uint32_t num_rows) {
+  Table* table = db_open(filename, false, DEFAULT_PAGE_SIZE);
+  char* keys = malloc((size_t)num_rows * LEAF_NODE_KEY_SIZE);
+  for (uint32_t i = 0; i < num_rows; i++) {
+    char text[256];
+    sprintf(text,
+            "insert stb%05d title%04d provider%02d 2014-%02d-%02d %d.%02d 1:%02d",
+            next_random() % 100000, i, next_random() % 20,
+            next_random() % 12 + 1, next_random() % 28 + 1,
+            next_random() % 20, next_random() % 100, next_random() % 60);
+    Statement statement;
+    prepare(text, &statement);
+    row_key(&(statement.row_to_insert), keys + i * LEAF_NODE_KEY_SIZE);
+    ExecuteResult result = execute_statement(&statement, table);
+    if (result != EXECUTE_SUCCESS) {
+      printf("Unable to insert row %d (error %d).\n", i, result);
+      exit(EXIT_FAILURE);
+    }
+    db_end_statement(table);
+  }
+  db_close(table);
+  qsort(keys, num_rows, LEAF_NODE_KEY_SIZE, compare_keys);
+  return keys;
+}
+
+/*
+What execute_select prints for a statement. It prints to stdout, so
+stdout points at a temp file while it runs.
+*/
+char* select_output(Table* table, Statement* statement) {
+  FILE* capture = tmpfile();
+  if (capture == NULL) {
+    printf("Unable to create capture file.\n");
+    exit(EXIT_FAILURE);
+  }
+  fflush(stdout);
+  int saved_stdout = dup(STDOUT_FILENO);
+  dup2(fileno(capture), STDOUT_FILENO);
+  execute_statement(statement, table);
+  fflush(stdout);
+  dup2(saved_stdout, STDOUT_FILENO);
+  close(saved_stdout);
+
+  long length = ftell(capture);
+  char* output = malloc(length + 1);
+  rewind(capture);
+  if (fread(output, 1, length, capture) != (size_t)length) {
+    printf("Unable to read capture file.\n");
+    exit(EXIT_FAILURE);
+  }
+  output[length] = '\0';
+  fclose(capture);
+  return output;
+}
+
+/*
+ * The rows a run got for each statement, printed the way execute_select
+ * prints them
+ */
+struct Results_t {
+  FILE** streams;
+  char** texts;
+  size_t* lengths;
+  uint64_t num_rows;
+};
+typedef struct Results_t Results;
+
+void collect_row(void* context, uint32_t statement_num, Row* row) {
+  Results* results = context;
+  fprintf(results->streams[statement_num], "(%s, %s, %s, %s, %f, %s)\n",
+          row->stb, row->title, row->provider, row->date, row->rev, row->time);
+  results->num_rows++;
+}
+
+void shuffle(Statement* statements, uint32_t num_statements) {
+  for (uint32_t i = num_statements - 1; i > 0; i--) {
+    uint32_t j = next_random() % (i + 1);
+    Statement swap = statements[i];
+    statements[i] = statements[j];
+    statements[j] = swap;
+  }
+}
+
+void run(const char* workload, const char* filename, Statement* statements,
+         uint32_t num_statements) {
+  // The expected rows are read without the delay, it is not timed
+  uint32_t read_delay = read_delay_microseconds;
+  read_delay_microseconds = 0;
+  Table* table = db_open(filename, false, DEFAULT_PAGE_SIZE);
+  char** expected = malloc(num_statements * sizeof(char*));
+  for (uint32_t i = 0; i < num_statements; i++) {
+    expected[i] = select_output(table, &(statements[i]));
+  }
+  db_close(table);
+  read_delay_microseconds = read_delay;
+
+  Results results;
+  results.streams = malloc(num_statements * sizeof(FILE*));
+  results.texts = malloc(num_statements * sizeof(char*));
+  results.lengths = malloc(num_statements * sizeof(size_t));
+  for (uint32_t i = 0; i < NUM_CONCURRENCY_LEVELS; i++) {
+    uint32_t concurrency = CONCURRENCY_LEVELS[i];
+    for (uint32_t j = 0; j < num_statements; j++) {
+      results.streams[j] =
+          open_memstream(&(results.texts[j]), &(results.lengths[j]));
+    }
+    results.num_rows = 0;
+
+    table = db_open(filename, false, DEFAULT_PAGE_SIZE);
+    uint64_t start = now_nanoseconds();
+    ExecuteResult result =
+        execute_concurrently(table, statements, num_statements, concurrency,
+                             collect_row, &results);
+    double seconds = (now_nanoseconds() - start) / 1e9;
+    db_close(table);
+    if (result != EXECUTE_SUCCESS) {
+      printf("Unable to run %s (error %d).\n", workload, result);
+      exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t j = 0; j < num_statements; j++) {
+      fclose(results.streams[j]);
+      if (strcmp(results.texts[j], expected[j]) != 0) {
+        printf("Query %d of %s got other rows than execute_select at "
+               "concurrency %d.\n",
+               j, workload, concurrency);
+        exit(EXIT_FAILURE);
+      }
+      free(results.texts[j]);
+    }
+    printf("{\"workload\":\"%s\",\"concurrency\":%d,\"queries\":%d,"
+           "\"rows\":%lu,\"seconds\":%.6f,\"queries_per_sec\":%.1f}\n",
+           workload, concurrency, num_statements, results.num_rows, seconds,
+           num_statements / seconds);
+    fflush(stdout);
+  }
+  for (uint32_t i = 0; i < num_statements; i++) {
+    free(expected[i]);
+  }
+  free(expected);
+  free(results.lengths);
+  free(results.texts);
+  free(results.streams);
+}
+
+/*
+A statement a task cannot run must be turned away before anything runs
+*/
+void check_unsupported(const char* filename, const char* text) {
+  Statement statement;
+  prepare(text, &statement);
+  Table* table = db_open(filename, false, DEFAULT_PAGE_SIZE);
+  ExecuteResult result =
+      execute_concurrently(table, &statement, 1, 1, collect_row, NULL);
+  db_close(table);
+  if (result != EXECUTE_UNSUPPORTED) {
+    printf("'%s' was not refused.\n", text);
+    exit(EXIT_FAILURE);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  uint32_t num_rows = 500;
+  uint64_t seed = 42;
+  read_delay_microseconds = 200;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--rows") == 0 && i + 1 < argc) {
+      num_rows = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--read-delay") == 0 && i + 1 < argc) {
+      read_delay_microseconds = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      seed = atoi(argv[++i]);
+    } else {
+      printf("Unrecognized option '%s'.\n", argv[i]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (num_rows < RANGE_ROWS) {
+    printf("Rows must be at least %d.\n", RANGE_ROWS);
+    exit(EXIT_FAILURE);
+  }
+
+  char filename[] = "concurrent-XXXXXX";
+  int file_descriptor = mkstemp(filename);
+  if (file_descriptor == -1) {
+    printf("Unable to create %s.\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  close(file_descriptor);
+  crc32c_init();
+  key_heads_init();
+  random_state = seed * 2654435761u + 1;
+
+  // Loading is not timed, so it reads nothing slowly
+  uint32_t read_delay = read_delay_microseconds;
+  read_delay_microseconds = 0;
+  char* keys = load_table(filename, num_rows);
+  read_delay_microseconds = read_delay;
+
+  // One query per leaf's worth of rows, so nearly every query misses
+  uint32_t num_queries = num_rows / (LEAF_NODE_MAX_CELLS / 2);
+  Statement* statements = malloc(num_queries * sizeof(Statement));
+  for (uint32_t i = 0; i < num_queries; i++) {
+    char text[256];
+    uint32_t row = (uint64_t)i * num_rows / num_queries;
+    sprintf(text, "select where key = %s", keys + row * LEAF_NODE_KEY_SIZE);
+    prepare(text, &(statements[i]));
+  }
+  shuffle(statements, num_queries);
+  run("point_lookup", filename, statements, num_queries);
+
+  for (uint32_t i = 0; i < num_queries; i++) {
+    char text[256];
+    uint32_t row = (uint64_t)i * (num_rows - RANGE_ROWS) / num_queries;
+    sprintf(text, "select where key >= %s and key <= %s",
+            keys + row * LEAF_NODE_KEY_SIZE,
+            keys + (row + RANGE_ROWS - 1) * LEAF_NODE_KEY_SIZE);
+    prepare(text, &(statements[i]));
+  }
+  shuffle(statements, num_queries);
+  run("range_scan", filename, statements, num_queries);
+
+  read_delay_microseconds = 0;
+  check_unsupported(filename, "select where rev > 1 order by rev");
+  check_unsupported(filename, "delete where rev > 1");
+
+  free(statements);
+  free(keys);
+  unlink(filename);
+  return 0;
+}
@@ -0,0 +1,300 @@
+/*
+ * Microbenchmarks for the node-level primitives, run against the engine
+ * library without the REPL:
+ *
+ *   leaf_node_find      binary search of one leaf
+ *   leaf_node_insert    shifting cells to insert into one leaf
+ *   serialize_row       packing a row into a cell
+ *   deserialize_row     unpacking it again
+ *   row_key             building the stb_title_date key of an insert
+ *
+ * The leaf primitives are timed with the leaf filled to 25%, 50%, 75%
+ * and 100% of its cells, for three key distributions:
+ *
+ *   sequential  keys numbered in order, differing early
+ *   random      random stb, title and date values
+ *   prefix      one stb and one long title, so keys only differ in the
+ *               date, far into the key
+ *
+ * Each result is printed as one JSON line with the nanoseconds per call.
+ *
+ *   bin/build/micro [--ops 200000] [--seed 42] [--page-size 65536]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "btree.h"
+
+enum Distribution_t { SEQUENTIAL, RANDOM, PREFIX, NUM_DISTRIBUTIONS };
+typedef enum Distribution_t Distribution;
+
+const char* DISTRIBUTION_NAMES[] = {"sequential", "random", "prefix"};
+
+const double FILL_FACTORS[] = {0.25, 0.5, 0.75, 1.0};
+const uint32_t NUM_FILL_FACTORS = sizeof(FILL_FACTORS) / sizeof(double);
+
+uint64_t random_state;
+
+uint32_t next_random() {
+  // xorshift64
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return (uint32_t)(random_state >> 32);
+}
+
+/* Keeps results alive so the calls being timed cannot be dropped */
+volatile uint64_t sink;
+
+void report(const char* primitive, Distribution distribution, double fill,
+            uint32_t cells, uint32_t ops, uint64_t nanoseconds) {
+  printf("{\"primitive\":\"%s\",\"distribution\":\"%s\",", primitive,
+         DISTRIBUTION_NAMES[distribution]);
+  if (fill > 0) {
+    printf("\"fill\":%.2f,\"cells\":%d,", fill, cells);
+  }
+  printf("\"ops\":%d,\"ns_per_op\":%.1f}\n", ops, (double)nanoseconds / ops);
+  fflush(stdout);
+}
+
+void generate_row(Distribution distribution, uint32_t index, Row* row) {
+  memset(row, 0, sizeof(Row));
+  switch (distribution) {
+    case (SEQUENTIAL):
+      sprintf(row->stb, "stb%08d", index);
+      sprintf(row->title, "title%05d", index % 1000);
+      sprintf(row->date, "2014-%02d-%02d", index % 12 + 1, index % 28 + 1);
+      break;
+    case (RANDOM):
+      sprintf(row->stb, "stb%08d", next_random() % 100000000);
+      sprintf(row->title, "title%05d", next_random() % 100000);
+      sprintf(row->date, "2014-%02d-%02d", next_random() % 12 + 1,
+              next_random() % 28 + 1);
+      break;
+    case (PREFIX):
+      strcpy(row->stb, "stb00000001");
+      memset(row->title, 'x', COLUMN_TITLE_SIZE - 8);
+      sprintf(row->title + COLUMN_TITLE_SIZE - 8, "%08d", index / 336);
+      sprintf(row->date, "%04d-%02d-%02d", 2014 + index / 336 % 10,
+              index / 28 % 12 + 1, index % 28 + 1);
+      break;
+    default:
+      break;
+  }
+  sprintf(row->provider, "provider%02d", next_random() % 20);
+  sprintf(row->time, "%d:%02d", next_random() % 4, next_random() % 60);
+  row->rev = (next_random() % 2000) / 100.0;
+  row->title_code = next_random() % 100000;
+  row->provider_code = next_random() % 20;
+}
+
+int compare_keys(const void* a, const void* b) {
+  return strncmp(a, b, LEAF_NODE_KEY_SIZE);
+}
+
+/*
+Fill keys with num_keys distinct keys of the distribution, in order
+*/
+void generate_keys(Distribution distribution, char* keys, uint32_t num_keys) {
+  uint32_t count = 0;
+  uint32_t index = 0;
+  while (count < num_keys) {
+    Row row;
+    while (count < num_keys) {
+      generate_row(distribution, index++, &row);
+      row_key(&row, keys + count * LEAF_NODE_KEY_SIZE);
+      count++;
+    }
+    qsort(keys, count, LEAF_NODE_KEY_SIZE, compare_keys);
+    uint32_t unique = 0;
+    for (uint32_t i = 0; i < count; i++) {
+      char* key = keys + i * LEAF_NODE_KEY_SIZE;
+      if (unique > 0 &&
+          compare_keys(key, keys + (unique - 1) * LEAF_NODE_KEY_SIZE) == 0) {
+        continue;
+      }
+      memmove(keys + unique * LEAF_NODE_KEY_SIZE, key, LEAF_NODE_KEY_SIZE);
+      unique++;
+    }
+    count = unique;
+  }
+}
+
+/*
+Put every other key (0, 2, 4, ...) of keys in the leaf, so the keys in
+between are misses that insert between two cells
+*/
+void fill_leaf(void* node, char* keys, uint32_t num_cells) {
+  initialize_leaf_node(node, LEAF_NODE_KEY_SIZE, ROW_SIZE);
+  for (uint32_t i = 0; i < num_cells; i++) {
+    strcpy(leaf_node_key(node, i), keys + 2 * i * LEAF_NODE_KEY_SIZE);
+  }
+  *leaf_node_num_cells(node) = num_cells;
+  leaf_node_update_heads(node);
+}
+
+void bench_leaf_find(Table* table, Distribution distribution, double fill,
+                     char* keys, uint32_t num_cells, uint32_t ops) {
+  void* node = get_page(table->pager, table->root_page_num);
+  fill_leaf(node, keys, num_cells);
+
+  uint32_t* lookups = malloc(ops * sizeof(uint32_t));
+  for (uint32_t i = 0; i < ops; i++) {
+    lookups[i] = 2 * (next_random() % num_cells);
+  }
+
+  Cursor cursor;
+  uint64_t start = now_nanoseconds();
+  for (uint32_t i = 0; i < ops; i++) {
+    leaf_node_find(table, table->root_page_num,
+                   keys + lookups[i] * LEAF_NODE_KEY_SIZE, &cursor);
+    sink += cursor.cell_num;
+  }
+  report("leaf_node_find", distribution, fill, num_cells, ops,
+         now_nanoseconds() - start);
+  free(lookups);
+}
+
+/*
+Each insert goes into the same leaf of num_cells cells, which is copied
+back from a snapshot before the next one. The copying is timed on its
+own and taken off.
+*/
+void bench_leaf_insert(Table* table, Distribution distribution, double fill,
+                       char* keys, uint32_t num_cells, uint32_t ops) {
+  void* node = get_page(table->pager, table->root_page_num);
+  fill_leaf(node, keys, num_cells);
+  size_t used = (char*)leaf_node_cell(node, num_cells + 1) - (char*)node;
+  void* snapshot = malloc(used);
+  memcpy(snapshot, node, used);
+
+  uint32_t* positions = malloc(ops * sizeof(uint32_t));
+  for (uint32_t i = 0; i < ops; i++) {
+    positions[i] = next_random() % num_cells;
+  }
+  uint8_t value[ROW_SIZE];
+  memset(value, 0, ROW_SIZE);
+
+  uint64_t start = now_nanoseconds();
+  for (uint32_t i = 0; i < ops; i++) {
+    memcpy(node, snapshot, used);
+    sink += *leaf_node_num_cells(node);
+  }
+  uint64_t copying = now_nanoseconds() - start;
+
+  Cursor cursor = {table, table->root_page_num, 0, false};
+  start = now_nanoseconds();
+  for (uint32_t i = 0; i < ops; i++) {
+    memcpy(node, snapshot, used);
+    cursor.cell_num = positions[i] + 1;
+    leaf_node_insert(&cursor,
+                     keys + (2 * positions[i] + 1) * LEAF_NODE_KEY_SIZE,
+                     value);
+    sink += *leaf_node_num_cells(node);
+  }
+  uint64_t elapsed = now_nanoseconds() - start;
+  report("leaf_node_insert", distribution, fill, num_cells, ops,
+         elapsed > copying ? elapsed - copying : 0);
+  free(positions);
+  free(snapshot);
+}
+
+void bench_rows(Distribution distribution, uint32_t ops) {
+  const uint32_t num_rows = 1024;
+  Row* rows = malloc(num_rows * sizeof(Row));
+  for (uint32_t i = 0; i < num_rows; i++) {
+    generate_row(distribution, i, &(rows[i]));
+  }
+  uint8_t* cells = malloc(num_rows * ROW_SIZE);
+  char key[LEAF_NODE_KEY_SIZE];
+  Row row;
+
+  uint64_t start = now_nanoseconds();
+  for (uint32_t i = 0; i < ops; i++) {
+    serialize_row(&(rows[i % num_rows]), cells + (i % num_rows) * ROW_SIZE);
+  }
+  report("serialize_row", distribution, 0, 0, ops, now_nanoseconds() - start);
+
+  start = now_nanoseconds();
+  for (uint32_t i = 0; i < ops; i++) {
+    deserialize_row(cells + (i % num_rows) * ROW_SIZE, &row);
+    sink += row.title_code;
+  }
+  report("deserialize_row", distribution, 0, 0, ops,
+         now_nanoseconds() - start);
+
+  start = now_nanoseconds();
+  for (uint32_t i = 0; i < ops; i++) {
+    row_key(&(rows[i % num_rows]), key);
+    sink += key[0];
+  }
+  report("row_key", distribution, 0, 0, ops, now_nanoseconds() - start);
+
+  free(cells);
+  free(rows);
+}
+
+int main(int argc, char* argv[]) {
+  uint32_t ops = 200000;
+  uint64_t seed = 42;
+  uint32_t page_size = 65536;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc) {
+      ops = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      seed = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--page-size") == 0 && i + 1 < argc) {
+      page_size = atoi(argv[++i]);
+    } else {
+      printf("Unrecognized option '%s'.\n", argv[i]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (!is_valid_page_size(page_size)) {
+    printf("Page size must be a power of two from %d to %d.\n",
+           MIN_PAGE_SIZE, MAX_PAGE_SIZE);
+    exit(EXIT_FAILURE);
+  }
+  if (ops == 0) {
+    printf("Ops must be at least 1.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // The leaves are only built in memory; the file is never written
+  char filename[] = "micro-XXXXXX";
+  int file_descriptor = mkstemp(filename);
+  if (file_descriptor == -1) {
+    printf("Unable to create %s.\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  close(file_descriptor);
+  crc32c_init();
+  key_heads_init();
+  Table* table = db_open(filename, false, page_size);
+  unlink(filename);
+
+  uint32_t max_cells = LEAF_NODE_MAX_CELLS;
+  char* keys = malloc((size_t)2 * max_cells * LEAF_NODE_KEY_SIZE);
+  for (Distribution distribution = 0; distribution < NUM_DISTRIBUTIONS;
+       distribution++) {
+    random_state = seed * 2654435761u + distribution + 1;
+    generate_keys(distribution, keys, 2 * max_cells);
+    for (uint32_t i = 0; i < NUM_FILL_FACTORS; i++) {
+      uint32_t num_cells = FILL_FACTORS[i] * max_cells;
+      if (num_cells == 0) {
+        num_cells = 1;
+      }
+      bench_leaf_find(table, distribution, FILL_FACTORS[i], keys, num_cells,
+                      ops);
+      // A full leaf would split, so insert into one with a cell to spare
+      bench_leaf_insert(table, distribution, FILL_FACTORS[i], keys,
+                        num_cells < max_cells ? num_cells : max_cells - 1,
+                        ops);
+    }
+    bench_rows(distribution, ops);
+  }
+  free(keys);
+  return 0;
+}
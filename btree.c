@@ -1,142 +1,403 @@
+#define _GNU_SOURCE  // O_DIRECT on Linux
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
-struct InputBuffer_t {
-  char* buffer;
-  size_t buffer_length;
-  ssize_t input_length;
-};
-typedef struct InputBuffer_t InputBuffer;
-
-enum ExecuteResult_t {
-  EXECUTE_SUCCESS,
-  EXECUTE_DUPLICATE_KEY,
-  EXECUTE_TABLE_FULL
-};
-typedef enum ExecuteResult_t ExecuteResult;
-
-enum MetaCommandResult_t {
-  META_COMMAND_SUCCESS,
-  META_COMMAND_UNRECOGNIZED_COMMAND
-};
-typedef enum MetaCommandResult_t MetaCommandResult;
-
-enum PrepareResult_t {
-  PREPARE_SUCCESS,
-  PREPARE_NEGATIVE_REV,
-  PREPARE_STRING_TO_LONG,
-  PREPARE_SYNTAX_ERROR,
-  PREPARE_UNRECOGNIZED_STATEMENT
-};
-typedef enum PrepareResult_t PrepareResult;
-
-enum StatementType_t { STATEMENT_INSERT, STATEMENT_SELECT };
-typedef enum StatementType_t StatementType;
-
-const uint32_t COLUMN_STB_SIZE = 32;
-const uint32_t COLUMN_TITLE_SIZE = 255;
-const uint32_t COLUMN_PROVIDER_SIZE = 255;
-const uint32_t COLUMN_DATE_SIZE = 10;
-const uint32_t COLUMN_TIME_SIZE = 4;
-struct Row_t {
-  char stb[COLUMN_STB_SIZE + 1];
-  char title[COLUMN_TITLE_SIZE + 1];
-  char provider[COLUMN_PROVIDER_SIZE + 1];
-  char date[COLUMN_DATE_SIZE + 1];
-  float rev;
-  char time[COLUMN_TIME_SIZE + 1];
-};
-typedef struct Row_t Row;
+#include "btree.h"
 
-struct Statement_t {
-  StatementType type;
-  Row row_to_insert;  // only used by insert statement
-};
-typedef struct Statement_t Statement;
+/* Room for any value as text, up to the largest double printed with %f */
+const uint32_t VALUE_TEXT_SIZE = 320;
 
 const uint32_t STB_SIZE = sizeof(((Row*)0)->stb);
 const uint32_t TITLE_SIZE = sizeof(((Row*)0)->title);
-const uint32_t PROVIDER_SIZE = sizeof(((Row*)0)->provider);
 const uint32_t DATE_SIZE = sizeof(((Row*)0)->date);
 const uint32_t REV_SIZE = sizeof(((Row*)0)->rev);
 const uint32_t TIME_SIZE = sizeof(((Row*)0)->time);
+const uint32_t TITLE_CODE_SIZE = sizeof(((Row*)0)->title_code);
+const uint32_t PROVIDER_CODE_SIZE = sizeof(((Row*)0)->provider_code);
 const uint32_t STB_OFFSET = 0;
-const uint32_t TITLE_OFFSET = STB_OFFSET + STB_SIZE;
-const uint32_t PROVIDER_OFFSET = TITLE_OFFSET + TITLE_SIZE;
-const uint32_t DATE_OFFSET = PROVIDER_OFFSET + PROVIDER_SIZE;
+const uint32_t TITLE_CODE_OFFSET = STB_OFFSET + STB_SIZE;
+const uint32_t PROVIDER_CODE_OFFSET = TITLE_CODE_OFFSET + TITLE_CODE_SIZE;
+const uint32_t DATE_OFFSET = PROVIDER_CODE_OFFSET + PROVIDER_CODE_SIZE;
 const uint32_t REV_OFFSET = DATE_OFFSET + DATE_SIZE;
 const uint32_t TIME_OFFSET = REV_OFFSET + REV_SIZE;
-const uint32_t ROW_SIZE = STB_SIZE + TITLE_SIZE + PROVIDER_SIZE + DATE_SIZE + REV_SIZE + TIME_SIZE;
+const uint32_t ROW_SIZE = STB_SIZE + TITLE_CODE_SIZE + PROVIDER_CODE_SIZE +
+                          DATE_SIZE + REV_SIZE + TIME_SIZE;
 
-const uint32_t PAGE_SIZE = 4096;
-const uint32_t TABLE_MAX_PAGES = 100;
+/*
+ * The page size is chosen when a database is created and recorded in its
+ * file header. It and the layout values derived from it are set by
+ * set_page_size when the file is opened.
+ */
+const uint32_t MIN_PAGE_SIZE = 4096;
+const uint32_t MAX_PAGE_SIZE = 65536;
+const uint32_t DEFAULT_PAGE_SIZE = 4096;
+uint32_t PAGE_SIZE;
+/* Every page ends with a CRC32C of the bytes before it */
+const uint32_t PAGE_CHECKSUM_SIZE = sizeof(uint32_t);
+uint32_t PAGE_USABLE_SIZE;
+const uint32_t CACHE_LINE_SIZE = 64;
 
-struct Pager_t {
-  int file_descriptor;
-  uint32_t file_length;
-  uint32_t num_pages;
-  void* pages[TABLE_MAX_PAGES];
-};
-typedef struct Pager_t Pager;
+const uint32_t PREFETCH_WINDOW = 4;
 
-struct Table_t {
-  Pager* pager;
-  uint32_t root_page_num;
-};
-typedef struct Table_t Table;
+const uint32_t DICTIONARY_NO_CODE = UINT32_MAX;
 
-struct Cursor_t {
-  Table* table;
-  uint32_t page_num;
-  uint32_t cell_num;
-  bool end_of_table;  // Indicates a position one past the last element
+QueryPlan* profile = NULL;
+
+/*
+Heap allocations go through these so .allocations can show
+that statements on the hot path do not allocate at all
+*/
+uint64_t num_allocations = 0;
+
+void* db_malloc(size_t size) {
+  num_allocations++;
+  return malloc(size);
+}
+
+void* db_calloc(size_t count, size_t size) {
+  num_allocations++;
+  return calloc(count, size);
+}
+
+void* db_realloc(void* pointer, size_t size) {
+  num_allocations++;
+  return realloc(pointer, size);
+}
+
+/*
+ * Runtime metrics. Each thread counts into its own slot, claimed the
+ * first time it records anything, so counting never takes a lock or
+ * shares a cache line; a slot is only written by its thread (with
+ * relaxed atomic stores so readers never see a torn value) and readers
+ * add the slots up. A thread that exits gives its slot (and the counts in
+ * it) to the next thread to start, so the prefetch workers each open
+ * starts do not use slots up. If more threads than that run at once, the
+ * rest share the last slot and add to it atomically.
+ */
+enum Metric_t {
+  METRIC_STATEMENTS,
+  METRIC_ROWS_SCANNED,
+  METRIC_PAGES_READ,
+  METRIC_PAGES_WRITTEN,
+  METRIC_CACHE_HITS,
+  METRIC_CACHE_MISSES,
+  METRIC_SPLITS,
+  METRIC_FSYNCS,
+  METRIC_BYTES_READ,
+  METRIC_BYTES_WRITTEN,
+  METRIC_HASH_INDEX_HITS,
+  METRIC_HASH_INDEX_MISSES,
+  METRIC_CACHE_EVICTIONS,
+  METRIC_MEMTABLE_FLUSHES,
+  METRIC_MERGED_ROWS,
+  METRIC_BLOOM_SKIPS,
+  METRIC_RUN_PAGE_READS,
+  METRIC_BLOOM_FILTER_NEGATIVES,
+  METRIC_BLOOM_FILTER_FALSE_POSITIVES,
+  METRIC_CACHE_RELOADS,
+  NUM_METRICS
 };
-typedef struct Cursor_t Cursor;
+typedef enum Metric_t Metric;
+
+const char* METRIC_NAMES[] = {
+    "statements_total",    "rows_scanned_total", "pages_read_total",
+    "pages_written_total", "cache_hits_total",   "cache_misses_total",
+    "splits_total",        "fsyncs_total",       "read_bytes_total",
+    "written_bytes_total", "hash_index_hits_total",
+    "hash_index_misses_total", "cache_evictions_total",
+    "memtable_flushes_total", "merged_rows_total", "bloom_skips_total",
+    "run_page_reads_total", "bloom_filter_negatives_total",
+    "bloom_filter_false_positives_total", "cache_reloads_total"};
+
+const char* METRIC_HELP[] = {
+    "Statements executed.",
+    "Rows examined by scans.",
+    "Pages read from the database file.",
+    "Pages written to the database file.",
+    "Page lookups served from the page cache.",
+    "Page lookups that had to load the page.",
+    "B+ tree node splits.",
+    "fsync calls on the database file.",
+    "Bytes read from the database file.",
+    "Bytes written to the database file.",
+    "Point lookups answered by the hash index.",
+    "Point lookups the hash index could not answer.",
+    "Pages dropped from the page cache.",
+    "Memtables written out as sorted runs.",
+    "Buffered rows moved into the tree.",
+    "Run lookups a bloom filter ruled out.",
+    "Run pages read by lookups.",
+    "Key checks the table's bloom filter answered without the tree.",
+    "New keys the table's bloom filter could not rule out.",
+    "Page caches dropped for changes made by another process."};
+
+/* Statement latency buckets: up to 1 us, 2 us, 4 us, ... 2^20 us, more */
+enum { METRICS_LATENCY_BUCKETS = 22, METRICS_MAX_THREADS = 16 };
+
+struct Metrics_t {
+  uint64_t counters[NUM_METRICS];
+  uint64_t latency_buckets[METRICS_LATENCY_BUCKETS];
+  uint64_t latency_nanoseconds;
+} __attribute__((aligned(64)));
+typedef struct Metrics_t Metrics;
+
+Metrics metrics_slots[METRICS_MAX_THREADS];
+bool metrics_slot_used[METRICS_MAX_THREADS];
+__thread Metrics* thread_metrics = NULL;
+__thread uint32_t thread_metrics_slot;
+
+const uint32_t METRICS_SHARED_SLOT = METRICS_MAX_THREADS - 1;
+
+Metrics* metrics_local() {
+  if (thread_metrics == NULL) {
+    uint32_t slot = 0;
+    while (slot < METRICS_SHARED_SLOT &&
+           __atomic_test_and_set(&(metrics_slot_used[slot]),
+                                 __ATOMIC_ACQUIRE)) {
+      slot++;
+    }
+    thread_metrics_slot = slot;
+    thread_metrics = &(metrics_slots[slot]);
+  }
+  return thread_metrics;
+}
+
+/*
+Give the thread's slot back before it exits
+*/
+void metrics_release() {
+  if (thread_metrics != NULL && thread_metrics_slot != METRICS_SHARED_SLOT) {
+    __atomic_clear(&(metrics_slot_used[thread_metrics_slot]),
+                   __ATOMIC_RELEASE);
+  }
+  thread_metrics = NULL;
+}
+
+void metrics_increment(uint64_t* counter, uint64_t amount) {
+  if (thread_metrics_slot == METRICS_SHARED_SLOT) {
+    __atomic_fetch_add(counter, amount, __ATOMIC_RELAXED);
+  } else {
+    __atomic_store_n(counter, *counter + amount, __ATOMIC_RELAXED);
+  }
+}
+
+void metrics_add(Metric metric, uint64_t amount) {
+  metrics_increment(&(metrics_local()->counters[metric]), amount);
+}
+
+void metrics_record_statement(uint64_t nanoseconds) {
+  Metrics* metrics = metrics_local();
+  uint32_t bucket = 0;
+  uint64_t bound = 1000;
+  while (bucket < METRICS_LATENCY_BUCKETS - 1 && nanoseconds > bound) {
+    bucket++;
+    bound *= 2;
+  }
+  metrics_increment(&(metrics->latency_buckets[bucket]), 1);
+  metrics_increment(&(metrics->latency_nanoseconds), nanoseconds);
+  metrics_increment(&(metrics->counters[METRIC_STATEMENTS]), 1);
+}
+
+/*
+Add up every thread's slot
+*/
+void metrics_read(Metrics* total) {
+  memset(total, 0, sizeof(Metrics));
+  for (uint32_t slot = 0; slot < METRICS_MAX_THREADS; slot++) {
+    Metrics* metrics = &(metrics_slots[slot]);
+    for (uint32_t i = 0; i < NUM_METRICS; i++) {
+      total->counters[i] +=
+          __atomic_load_n(&(metrics->counters[i]), __ATOMIC_RELAXED);
+    }
+    for (uint32_t i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+      total->latency_buckets[i] +=
+          __atomic_load_n(&(metrics->latency_buckets[i]), __ATOMIC_RELAXED);
+    }
+    total->latency_nanoseconds +=
+        __atomic_load_n(&(metrics->latency_nanoseconds), __ATOMIC_RELAXED);
+  }
+}
+
+/*
+Write the metrics in the Prometheus text exposition format
+*/
+void metrics_write(FILE* file) {
+  Metrics total;
+  metrics_read(&total);
+  for (uint32_t i = 0; i < NUM_METRICS; i++) {
+    fprintf(file, "# HELP simpledb_%s %s\n", METRIC_NAMES[i], METRIC_HELP[i]);
+    fprintf(file, "# TYPE simpledb_%s counter\n", METRIC_NAMES[i]);
+    fprintf(file, "simpledb_%s %llu\n", METRIC_NAMES[i],
+            (unsigned long long)total.counters[i]);
+  }
+
+  fprintf(file, "# HELP simpledb_statement_seconds Statement latency.\n");
+  fprintf(file, "# TYPE simpledb_statement_seconds histogram\n");
+  uint64_t count = 0;
+  uint64_t bound = 1;  // microseconds
+  for (uint32_t i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+    count += total.latency_buckets[i];
+    if (i < METRICS_LATENCY_BUCKETS - 1) {
+      fprintf(file, "simpledb_statement_seconds_bucket{le=\"%.6f\"} %llu\n",
+              bound / 1e6, (unsigned long long)count);
+    } else {
+      fprintf(file, "simpledb_statement_seconds_bucket{le=\"+Inf\"} %llu\n",
+              (unsigned long long)count);
+    }
+    bound *= 2;
+  }
+  fprintf(file, "simpledb_statement_seconds_sum %.9f\n",
+          total.latency_nanoseconds / 1e9);
+  fprintf(file, "simpledb_statement_seconds_count %llu\n",
+          (unsigned long long)count);
+}
+
+/*
+Count a result row. Under explain analyze the query runs without
+printing its rows.
+*/
+bool emit_row() {
+  if (profile == NULL) {
+    return true;
+  }
+  profile->rows_returned++;
+  return false;
+}
+
+uint64_t now_nanoseconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
 
 void print_row(Row* row) {
+    if (!emit_row()) {
+      return;
+    }
     printf("(%s, %s, %s, %s, %f, %s)\n", row->stb, row->title, row->provider, row->date, row->rev, row->time);
 }
 
-enum NodeType_t { NODE_INTERNAL, NODE_LEAF };
+enum NodeType_t {
+  NODE_FILE_HEADER,
+  NODE_INTERNAL,
+  NODE_LEAF,
+  NODE_DICTIONARY,
+  NODE_FREELIST,
+  NODE_PARTITION_DIRECTORY,
+  NODE_CATALOG,
+  NODE_STATISTICS,
+  NODE_BLOOM_FILTER
+};
 typedef enum NodeType_t NodeType;
 
 /*
  * Common Node Header Layout
+ *
+ * The parent pointer is padded to a 4 byte boundary so every
+ * uint32_t field in a page is naturally aligned.
  */
 const uint32_t NODE_TYPE_SIZE = sizeof(uint8_t);
 const uint32_t NODE_TYPE_OFFSET = 0;
 const uint32_t IS_ROOT_SIZE = sizeof(uint8_t);
 const uint32_t IS_ROOT_OFFSET = NODE_TYPE_SIZE;
 const uint32_t PARENT_POINTER_SIZE = sizeof(uint32_t);
-const uint32_t PARENT_POINTER_OFFSET = IS_ROOT_OFFSET + IS_ROOT_SIZE;
-const uint8_t COMMON_NODE_HEADER_SIZE =
-    NODE_TYPE_SIZE + IS_ROOT_SIZE + PARENT_POINTER_SIZE;
+const uint32_t PARENT_POINTER_OFFSET = sizeof(uint32_t);
+const uint32_t COMMON_NODE_HEADER_SIZE =
+    PARENT_POINTER_OFFSET + PARENT_POINTER_SIZE;
 
 /*
  * Leaf Node Header Layout
  */
 const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_HEADER_SIZE =
-    COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE;
+const uint32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET =
+    LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
+/* Every tree has its own cell layout, recorded in each of its leaves */
+const uint32_t LEAF_NODE_KEY_SIZE_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_KEY_SIZE_OFFSET =
+    LEAF_NODE_NEXT_LEAF_OFFSET + LEAF_NODE_NEXT_LEAF_SIZE;
+const uint32_t LEAF_NODE_VALUE_SIZE_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_VALUE_SIZE_OFFSET =
+    LEAF_NODE_KEY_SIZE_OFFSET + LEAF_NODE_KEY_SIZE_SIZE;
+/* How many leading bytes all keys in the leaf share */
+const uint32_t LEAF_NODE_HEAD_SKIP_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_HEAD_SKIP_OFFSET =
+    LEAF_NODE_VALUE_SIZE_OFFSET + LEAF_NODE_VALUE_SIZE_SIZE;
+const uint32_t LEAF_NODE_CELLS_OFFSET_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_CELLS_OFFSET_OFFSET =
+    LEAF_NODE_HEAD_SKIP_OFFSET + LEAF_NODE_HEAD_SKIP_SIZE;
+/* Key heads start on their own cache line */
+const uint32_t LEAF_NODE_HEADER_SIZE = CACHE_LINE_SIZE;
 
 /*
  * Leaf Node Body Layout
+ *
+ * A cell is a NUL-terminated key padded to the tree's key size followed
+ * by the row. These are the sizes of the main table's cells; the largest
+ * key any tree may use is LEAF_NODE_KEY_SIZE.
+ *
+ * Before the cells, packed together, is the head of every cell's key:
+ * the 8 bytes after the prefix all the leaf's keys share, read as a
+ * big-endian number (zero past the terminator) so heads compare like
+ * the keys. A search compares heads several at a time with SIMD
+ * instructions and only reads keys whose head ties with its own. Cells
+ * start on the first cache line after room for a full leaf's heads.
  */
 const uint32_t LEAF_NODE_KEY_SIZE = STB_SIZE + TITLE_SIZE + DATE_SIZE + 3;
-const uint32_t LEAF_NODE_KEY_OFFSET = 0;
 const uint32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
-const uint32_t LEAF_NODE_VALUE_OFFSET =
-    LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
 const uint32_t LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
-const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_MAX_CELLS =
-    LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE;
+const uint32_t LEAF_NODE_HEAD_SIZE = sizeof(uint64_t);
+uint32_t LEAF_NODE_SPACE_FOR_CELLS;
+uint32_t LEAF_NODE_MAX_CELLS;
+
+/*
+ * Internal Node Header Layout
+ */
+const uint32_t INTERNAL_NODE_NUM_KEYS_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
+const uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET =
+    INTERNAL_NODE_NUM_KEYS_OFFSET + INTERNAL_NODE_NUM_KEYS_SIZE;
+const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE +
+                                           INTERNAL_NODE_NUM_KEYS_SIZE +
+                                           INTERNAL_NODE_RIGHT_CHILD_SIZE;
+
+/*
+ * Internal Node Body Layout
+ *
+ * Each key is the largest key in the subtree of the child to its left.
+ * Child pointers follow the header and the keys are kept apart in their
+ * own array, starting on a cache line with each key in a slot of whole
+ * cache lines, so a binary search only touches the lines of the keys it
+ * compares.
+ */
+const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_CHILDREN_OFFSET = INTERNAL_NODE_HEADER_SIZE;
+const uint32_t INTERNAL_NODE_KEY_SIZE = LEAF_NODE_KEY_SIZE;
+const uint32_t INTERNAL_NODE_KEY_SLOT_SIZE =
+    (INTERNAL_NODE_KEY_SIZE + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE *
+    CACHE_LINE_SIZE;
+uint32_t INTERNAL_NODE_MAX_KEYS;
+uint32_t INTERNAL_NODE_MIN_KEYS;
+uint32_t INTERNAL_NODE_KEYS_OFFSET;
 
 NodeType get_node_type(void* node) {
   uint8_t value = *((uint8_t*)(node + NODE_TYPE_OFFSET));
@@ -148,518 +409,7102 @@ void set_node_type(void* node, NodeType type) {
   *((uint8_t*)(node + NODE_TYPE_OFFSET)) = value;
 }
 
-uint32_t* leaf_node_num_cells(void* node) {
-  return node + LEAF_NODE_NUM_CELLS_OFFSET;
+bool is_node_root(void* node) {
+  uint8_t value = *((uint8_t*)(node + IS_ROOT_OFFSET));
+  return (bool)value;
 }
 
-void* leaf_node_cell(void* node, uint32_t cell_num) {
-  return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_CELL_SIZE;
+void set_node_root(void* node, bool is_root) {
+  uint8_t value = is_root;
+  *((uint8_t*)(node + IS_ROOT_OFFSET)) = value;
 }
 
-char* leaf_node_key(void* node, uint32_t cell_num) {
-  return leaf_node_cell(node, cell_num);
-}
+uint32_t* node_parent(void* node) { return node + PARENT_POINTER_OFFSET; }
 
-void* leaf_node_value(void* node, uint32_t cell_num) {
-  return leaf_node_cell(node, cell_num) + LEAF_NODE_KEY_SIZE;
+uint32_t* internal_node_num_keys(void* node) {
+  return node + INTERNAL_NODE_NUM_KEYS_OFFSET;
 }
 
-void print_constants() {
-  printf("ROW_SIZE: %d\n", ROW_SIZE);
-  printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
-  printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
-  printf("LEAF_NODE_CELL_SIZE: %d\n", LEAF_NODE_CELL_SIZE);
-  printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
-  printf("LEAF_NODE_MAX_CELLS: %d\n", LEAF_NODE_MAX_CELLS);
+uint32_t* internal_node_right_child(void* node) {
+  return node + INTERNAL_NODE_RIGHT_CHILD_OFFSET;
 }
 
-void print_leaf_node(void* node) {
-  uint32_t num_cells = *leaf_node_num_cells(node);
-  printf("leaf (size %d)\n", num_cells);
-  for (uint32_t i = 0; i < num_cells; i++) {
-    char* key = leaf_node_key(node, i);
-    printf("  - %d : %s\n", i, key);
+
+uint32_t* internal_node_child(void* node, uint32_t child_num) {
+  uint32_t num_keys = *internal_node_num_keys(node);
+  if (child_num > num_keys) {
+    printf("Tried to access child_num %d > num_keys %d\n", child_num, num_keys);
+    exit(EXIT_FAILURE);
+  } else if (child_num == num_keys) {
+    return internal_node_right_child(node);
+  } else {
+    return node + INTERNAL_NODE_CHILDREN_OFFSET +
+           child_num * INTERNAL_NODE_CHILD_SIZE;
   }
 }
 
-void serialize_row(Row* source, void* destination) {
-  memcpy(destination + STB_OFFSET, &(source->stb), STB_SIZE);
-  memcpy(destination + TITLE_OFFSET, &(source->title), TITLE_SIZE);
-  memcpy(destination + PROVIDER_OFFSET, &(source->provider), PROVIDER_SIZE);
-  memcpy(destination + DATE_OFFSET, &(source->date), DATE_SIZE);
-  memcpy(destination + REV_OFFSET, &(source->rev), REV_SIZE);
-  memcpy(destination + TIME_OFFSET, &(source->time), TIME_SIZE);
+char* internal_node_key(void* node, uint32_t key_num) {
+  return node + INTERNAL_NODE_KEYS_OFFSET +
+         key_num * INTERNAL_NODE_KEY_SLOT_SIZE;
 }
 
-void deserialize_row(void* source, Row* destination) {
-  memcpy(&(destination->stb), source + STB_OFFSET, STB_SIZE);
-  memcpy(&(destination->title), source + TITLE_OFFSET, TITLE_SIZE);
-  memcpy(&(destination->provider), source + PROVIDER_OFFSET, PROVIDER_SIZE);
-  memcpy(&(destination->date), source + DATE_OFFSET, DATE_SIZE);
-  memcpy(&(destination->rev), source + REV_OFFSET, REV_SIZE);
-  memcpy(&(destination->time), source + TIME_OFFSET, TIME_SIZE);
+/*
+Leaf keys can be shorter than an internal key slot,
+so key copies stop at the terminator
+*/
+void copy_key(char* destination, char* source) {
+  size_t length = strnlen(source, INTERNAL_NODE_KEY_SIZE - 1);
+  memcpy(destination, source, length);
+  destination[length] = '\0';
 }
 
-void initialize_leaf_node(void* node) {
-  set_node_type(node, NODE_LEAF);
-  *leaf_node_num_cells(node) = 0;
+/*
+Copy the child pointer and key at index from to index to
+*/
+void internal_node_copy_cell(void* node, uint32_t to, uint32_t from) {
+  *internal_node_child(node, to) = *internal_node_child(node, from);
+  copy_key(internal_node_key(node, to), internal_node_key(node, from));
 }
 
-void* get_page(Pager* pager, uint32_t page_num) {
-  if (page_num > TABLE_MAX_PAGES) {
-    printf("Tried to fetch page number out of bounds. %d > %d\n", page_num,
-           TABLE_MAX_PAGES);
-    exit(EXIT_FAILURE);
-  }
-
-  if (pager->pages[page_num] == NULL) {
-    // Cache miss. Allocate memory and load from file.
-    void* page = malloc(PAGE_SIZE);
-    uint32_t num_pages = pager->file_length / PAGE_SIZE;
+uint32_t* leaf_node_num_cells(void* node) {
+  return node + LEAF_NODE_NUM_CELLS_OFFSET;
+}
 
-    // We might save a partial page at the end of the file
-    if (pager->file_length % PAGE_SIZE) {
-      num_pages += 1;
-    }
+uint32_t* leaf_node_next_leaf(void* node) {
+  return node + LEAF_NODE_NEXT_LEAF_OFFSET;
+}
 
-    if (page_num <= num_pages) {
-      lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-      ssize_t bytes_read = read(pager->file_descriptor, page, PAGE_SIZE);
-      if (bytes_read == -1) {
-        printf("Error reading file: %d\n", errno);
-        exit(EXIT_FAILURE);
-      }
-    }
+uint32_t* leaf_node_key_size(void* node) {
+  return node + LEAF_NODE_KEY_SIZE_OFFSET;
+}
 
-    pager->pages[page_num] = page;
+uint32_t* leaf_node_value_size(void* node) {
+  return node + LEAF_NODE_VALUE_SIZE_OFFSET;
+}
 
-    if (page_num >= pager->num_pages) {
-      pager->num_pages = page_num + 1;
-    }
-  }
+uint32_t* leaf_node_head_skip(void* node) {
+  return node + LEAF_NODE_HEAD_SKIP_OFFSET;
+}
 
-  return pager->pages[page_num];
+uint32_t* leaf_node_cells_offset(void* node) {
+  return node + LEAF_NODE_CELLS_OFFSET_OFFSET;
 }
 
-Cursor* table_start(Table* table) {
-  Cursor* cursor = malloc(sizeof(Cursor));
-  cursor->table = table;
-  cursor->page_num = table->root_page_num;
-  cursor->cell_num = 0;
+uint64_t* leaf_node_heads(void* node) { return node + LEAF_NODE_HEADER_SIZE; }
 
-  void* root_node = get_page(table->pager, table->root_page_num);
-  uint32_t num_cells = *leaf_node_num_cells(root_node);
-  cursor->end_of_table = (num_cells == 0);
+uint32_t leaf_node_cell_size(void* node) {
+  return *leaf_node_key_size(node) + *leaf_node_value_size(node);
+}
 
-  return cursor;
+/*
+How many cells of cell_size fit in a leaf along with their heads,
+leaving room to round the heads up to a cache line
+*/
+uint32_t leaf_node_capacity(uint32_t cell_size) {
+  return (LEAF_NODE_SPACE_FOR_CELLS - CACHE_LINE_SIZE) /
+         (cell_size + LEAF_NODE_HEAD_SIZE);
 }
 
-Cursor* leaf_node_find(Table* table, uint32_t page_num, char* key) {
-  void* node = get_page(table->pager, page_num);
-  uint32_t num_cells = *leaf_node_num_cells(node);
+uint32_t leaf_node_max_cells(void* node) {
+  return leaf_node_capacity(leaf_node_cell_size(node));
+}
 
-  Cursor* cursor = malloc(sizeof(Cursor));
-  cursor->table = table;
-  cursor->page_num = page_num;
+/* Non-root leaves with fewer cells are merged or refilled after a delete */
+uint32_t leaf_node_min_cells(void* node) {
+  return leaf_node_max_cells(node) / 2;
+}
 
-  // Binary search
-  uint32_t min_index = 0;
-  uint32_t one_past_max_index = num_cells;
-  while (one_past_max_index != min_index) {
-    uint32_t index = (min_index + one_past_max_index) / 2;
-    char* key_at_index = leaf_node_key(node, index);
-    uint8_t cmp = strncmp(key, key_at_index, LEAF_NODE_KEY_SIZE);
-    if (cmp == 0) {
-      cursor->cell_num = index;
-      return cursor;
-    }
-    if (cmp < 0) {
-      one_past_max_index = index;
-    } else {
-      min_index = index + 1;
-    }
-  }
+void* leaf_node_cell(void* node, uint32_t cell_num) {
+  return node + *leaf_node_cells_offset(node) +
+         cell_num * leaf_node_cell_size(node);
+}
 
-  cursor->cell_num = min_index;
-  return cursor;
+char* leaf_node_key(void* node, uint32_t cell_num) {
+  return leaf_node_cell(node, cell_num);
+}
+
+void* leaf_node_value(void* node, uint32_t cell_num) {
+  return leaf_node_cell(node, cell_num) + *leaf_node_key_size(node);
 }
 
 /*
-Return the position of the given key.
-If the key is not present, return the position
-where it should be inserted
-*/
-Cursor* table_find(Table* table, char* key) {
-  uint32_t root_page_num = table->root_page_num;
-  void* root_node = get_page(table->pager, root_page_num);
+ * Dictionary Page Layout
+ *
+ * Entries are packed as a one byte length followed by the string bytes.
+ * Pages are chained through next_page; 0 ends the chain since page 0 is
+ * always the file header.
+ */
+const uint32_t DICTIONARY_PAGE_NUM = 2;
+const uint32_t DICTIONARY_NEXT_PAGE_SIZE = sizeof(uint32_t);
+const uint32_t DICTIONARY_NEXT_PAGE_OFFSET = COMMON_NODE_HEADER_SIZE;
+const uint32_t DICTIONARY_NUM_ENTRIES_SIZE = sizeof(uint32_t);
+const uint32_t DICTIONARY_NUM_ENTRIES_OFFSET =
+    DICTIONARY_NEXT_PAGE_OFFSET + DICTIONARY_NEXT_PAGE_SIZE;
+const uint32_t DICTIONARY_USED_BYTES_SIZE = sizeof(uint32_t);
+const uint32_t DICTIONARY_USED_BYTES_OFFSET =
+    DICTIONARY_NUM_ENTRIES_OFFSET + DICTIONARY_NUM_ENTRIES_SIZE;
+const uint32_t DICTIONARY_HEADER_SIZE =
+    DICTIONARY_USED_BYTES_OFFSET + DICTIONARY_USED_BYTES_SIZE;
+uint32_t DICTIONARY_SPACE_FOR_ENTRIES;
+const uint32_t DICTIONARY_ENTRY_LENGTH_SIZE = sizeof(uint8_t);
 
-  if (get_node_type(root_node) == NODE_LEAF) {
-    return leaf_node_find(table, root_page_num, key);
-  } else {
-    printf("Need to implement searching an internal node\n");
-    exit(EXIT_FAILURE);
-  }
+uint32_t* dictionary_next_page(void* page) {
+  return page + DICTIONARY_NEXT_PAGE_OFFSET;
 }
 
-void* cursor_value(Cursor* cursor) {
-  uint32_t page_num = cursor->page_num;
-  void* page = get_page(cursor->table->pager, page_num);
-  return leaf_node_value(page, cursor->cell_num);
+uint32_t* dictionary_num_entries(void* page) {
+  return page + DICTIONARY_NUM_ENTRIES_OFFSET;
 }
 
-void cursor_advance(Cursor* cursor) {
-  uint32_t page_num = cursor->page_num;
-  void* node = get_page(cursor->table->pager, page_num);
-
-  cursor->cell_num += 1;
-  if (cursor->cell_num >= (*leaf_node_num_cells(node))) {
-    cursor->end_of_table = true;
-  }
+uint32_t* dictionary_used_bytes(void* page) {
+  return page + DICTIONARY_USED_BYTES_OFFSET;
 }
 
-Pager* pager_open(const char* filename) {
-  int fd = open(filename,
-                O_RDWR |      // Read/Write mode
-                    O_CREAT,  // Create file if it does not exist
-                S_IWUSR |     // User write permission
-                    S_IRUSR   // User read permission
-                );
+uint8_t* dictionary_entries(void* page) {
+  return page + DICTIONARY_HEADER_SIZE;
+}
 
-  if (fd == -1) {
-    printf("Unable to open file\n");
-    exit(EXIT_FAILURE);
-  }
+void initialize_dictionary_page(void* page) {
+  set_node_type(page, NODE_DICTIONARY);
+  *dictionary_next_page(page) = 0;
+  *dictionary_num_entries(page) = 0;
+  *dictionary_used_bytes(page) = 0;
+}
 
-  off_t file_length = lseek(fd, 0, SEEK_END);
+/*
+ * Free List Page Layout
+ *
+ * Page 3 is the head of the free list. It holds the numbers of free pages
+ * and, once it fills up, a link to an overflow trunk page with the same
+ * layout. Trunk pages are themselves free and are handed out last.
+ */
+const uint32_t FREELIST_PAGE_NUM = 3;
+const uint32_t FREELIST_NEXT_TRUNK_SIZE = sizeof(uint32_t);
+const uint32_t FREELIST_NEXT_TRUNK_OFFSET = COMMON_NODE_HEADER_SIZE;
+const uint32_t FREELIST_NUM_PAGES_SIZE = sizeof(uint32_t);
+const uint32_t FREELIST_NUM_PAGES_OFFSET =
+    FREELIST_NEXT_TRUNK_OFFSET + FREELIST_NEXT_TRUNK_SIZE;
+const uint32_t FREELIST_HEADER_SIZE =
+    FREELIST_NUM_PAGES_OFFSET + FREELIST_NUM_PAGES_SIZE;
+const uint32_t FREELIST_PAGE_NUM_SIZE = sizeof(uint32_t);
+uint32_t FREELIST_MAX_PAGES;
 
-  Pager* pager = malloc(sizeof(Pager));
-  pager->file_descriptor = fd;
-  pager->file_length = file_length;
-  pager->num_pages = (file_length / PAGE_SIZE);
+uint32_t* freelist_next_trunk(void* page) {
+  return page + FREELIST_NEXT_TRUNK_OFFSET;
+}
 
-  if (file_length % PAGE_SIZE != 0) {
-    printf("Db file is not a whole number of pages. Corrupt file.\n");
-    exit(EXIT_FAILURE);
-  }
+uint32_t* freelist_num_pages(void* page) {
+  return page + FREELIST_NUM_PAGES_OFFSET;
+}
 
-  for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-    pager->pages[i] = NULL;
-  }
+uint32_t* freelist_page(void* page, uint32_t index) {
+  return page + FREELIST_HEADER_SIZE + index * FREELIST_PAGE_NUM_SIZE;
+}
 
-  return pager;
+void initialize_freelist_page(void* page) {
+  set_node_type(page, NODE_FREELIST);
+  *freelist_next_trunk(page) = 0;
+  *freelist_num_pages(page) = 0;
 }
 
-Table* db_open(const char* filename) {
-  Pager* pager = pager_open(filename);
+/*
+ * Partition Directory Page Layout
+ *
+ * Page 4 says whether the table is partitioned by month. Each partition is
+ * its own B+ tree; entries map the month to the tree's root and are kept
+ * sorted by month. Dropped partitions are only unlinked here and their
+ * roots queued, the pages are released once the free list runs dry.
+ */
+const uint32_t PARTITION_DIRECTORY_PAGE_NUM = 4;
+const uint32_t PARTITION_IS_PARTITIONED_SIZE = sizeof(uint32_t);
+const uint32_t PARTITION_IS_PARTITIONED_OFFSET = COMMON_NODE_HEADER_SIZE;
+const uint32_t PARTITION_NUM_PARTITIONS_SIZE = sizeof(uint32_t);
+const uint32_t PARTITION_NUM_PARTITIONS_OFFSET =
+    PARTITION_IS_PARTITIONED_OFFSET + PARTITION_IS_PARTITIONED_SIZE;
+const uint32_t PARTITION_NUM_DROPPED_SIZE = sizeof(uint32_t);
+const uint32_t PARTITION_NUM_DROPPED_OFFSET =
+    PARTITION_NUM_PARTITIONS_OFFSET + PARTITION_NUM_PARTITIONS_SIZE;
+const uint32_t PARTITION_HEADER_SIZE =
+    PARTITION_NUM_DROPPED_OFFSET + PARTITION_NUM_DROPPED_SIZE;
+const uint32_t PARTITION_DROPPED_ROOT_SIZE = sizeof(uint32_t);
+const uint32_t PARTITION_MAX_DROPPED = 16;
+const uint32_t PARTITION_ENTRIES_OFFSET =
+    PARTITION_HEADER_SIZE + PARTITION_MAX_DROPPED * PARTITION_DROPPED_ROOT_SIZE;
 
-  Table* table = malloc(sizeof(Table));
-  table->pager = pager;
+/*
+ * Partition Directory Entry Layout
+ */
+const uint32_t PARTITION_NAME_SIZE = PARTITION_MONTH_SIZE + 1;
+const uint32_t PARTITION_ROOT_OFFSET = PARTITION_NAME_SIZE;
+const uint32_t PARTITION_ROOT_SIZE = sizeof(uint32_t);
+const uint32_t PARTITION_NUM_ROWS_OFFSET =
+    PARTITION_ROOT_OFFSET + PARTITION_ROOT_SIZE;
+const uint32_t PARTITION_NUM_ROWS_SIZE = sizeof(uint32_t);
+const uint32_t PARTITION_ENTRY_SIZE =
+    PARTITION_NAME_SIZE + PARTITION_ROOT_SIZE + PARTITION_NUM_ROWS_SIZE;
+uint32_t PARTITION_MAX_PARTITIONS;
 
-  if (pager->num_pages == 0) {
-    // New database file. Initialize page 0 as leaf node.
-    void* root_node = get_page(pager, 0);
-    initialize_leaf_node(root_node);
-  }
+uint32_t* partition_is_partitioned(void* page) {
+  return page + PARTITION_IS_PARTITIONED_OFFSET;
+}
 
-  return table;
+uint32_t* partition_num_partitions(void* page) {
+  return page + PARTITION_NUM_PARTITIONS_OFFSET;
 }
 
-InputBuffer* new_input_buffer() {
-  InputBuffer* input_buffer = malloc(sizeof(InputBuffer));
-  input_buffer->buffer = NULL;
-  input_buffer->buffer_length = 0;
-  input_buffer->input_length = 0;
+uint32_t* partition_num_dropped(void* page) {
+  return page + PARTITION_NUM_DROPPED_OFFSET;
+}
 
-  return input_buffer;
+uint32_t* partition_dropped_root(void* page, uint32_t index) {
+  return page + PARTITION_HEADER_SIZE + index * PARTITION_DROPPED_ROOT_SIZE;
 }
 
-void print_prompt() { printf("db > "); }
+void* partition_entry(void* page, uint32_t index) {
+  return page + PARTITION_ENTRIES_OFFSET + index * PARTITION_ENTRY_SIZE;
+}
 
-void read_input(InputBuffer* input_buffer) {
-  ssize_t bytes_read =
-      getline(&(input_buffer->buffer), &(input_buffer->buffer_length), stdin);
+char* partition_name(void* page, uint32_t index) {
+  return partition_entry(page, index);
+}
 
-  if (bytes_read <= 0) {
-    printf("Error reading input\n");
-    exit(EXIT_FAILURE);
-  }
+uint32_t* partition_root(void* page, uint32_t index) {
+  return partition_entry(page, index) + PARTITION_ROOT_OFFSET;
+}
 
-  // Ignore trailing newline
-  input_buffer->input_length = bytes_read - 1;
-  input_buffer->buffer[bytes_read - 1] = 0;
+uint32_t* partition_num_rows(void* page, uint32_t index) {
+  return partition_entry(page, index) + PARTITION_NUM_ROWS_OFFSET;
 }
 
-void pager_flush(Pager* pager, uint32_t page_num) {
-  if (pager->pages[page_num] == NULL) {
-    printf("Tried to flush null page\n");
-    exit(EXIT_FAILURE);
-  }
+/*
+ * Catalog Page Layout
+ *
+ * Page 5 lists the tables made with create table: the name, the root of
+ * the table's tree, its row count and its columns.
+ */
+const uint32_t CATALOG_PAGE_NUM = 5;
+const uint32_t CATALOG_NUM_TABLES_SIZE = sizeof(uint32_t);
+const uint32_t CATALOG_NUM_TABLES_OFFSET = COMMON_NODE_HEADER_SIZE;
+const uint32_t CATALOG_HEADER_SIZE =
+    CATALOG_NUM_TABLES_OFFSET + CATALOG_NUM_TABLES_SIZE;
 
-  off_t offset = lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
+/*
+ * Catalog Column Layout
+ */
+const uint32_t CATALOG_COLUMN_NAME_OFFSET = 0;
+const uint32_t CATALOG_COLUMN_TYPE_SIZE = sizeof(uint32_t);
+const uint32_t CATALOG_COLUMN_TYPE_OFFSET =
+    CATALOG_COLUMN_NAME_OFFSET + CATALOG_NAME_SIZE;
+const uint32_t CATALOG_COLUMN_LENGTH_SIZE = sizeof(uint32_t);
+const uint32_t CATALOG_COLUMN_LENGTH_OFFSET =
+    CATALOG_COLUMN_TYPE_OFFSET + CATALOG_COLUMN_TYPE_SIZE;
+const uint32_t CATALOG_COLUMN_SIZE =
+    CATALOG_COLUMN_LENGTH_OFFSET + CATALOG_COLUMN_LENGTH_SIZE;
+
+/*
+ * Catalog Entry Layout
+ */
+const uint32_t CATALOG_TABLE_NAME_OFFSET = 0;
+const uint32_t CATALOG_TABLE_ROOT_SIZE = sizeof(uint32_t);
+const uint32_t CATALOG_TABLE_ROOT_OFFSET =
+    CATALOG_TABLE_NAME_OFFSET + CATALOG_NAME_SIZE;
+const uint32_t CATALOG_TABLE_NUM_ROWS_SIZE = sizeof(uint32_t);
+const uint32_t CATALOG_TABLE_NUM_ROWS_OFFSET =
+    CATALOG_TABLE_ROOT_OFFSET + CATALOG_TABLE_ROOT_SIZE;
+const uint32_t CATALOG_TABLE_NUM_COLUMNS_SIZE = sizeof(uint32_t);
+const uint32_t CATALOG_TABLE_NUM_COLUMNS_OFFSET =
+    CATALOG_TABLE_NUM_ROWS_OFFSET + CATALOG_TABLE_NUM_ROWS_SIZE;
+const uint32_t CATALOG_TABLE_COLUMNS_OFFSET =
+    CATALOG_TABLE_NUM_COLUMNS_OFFSET + CATALOG_TABLE_NUM_COLUMNS_SIZE;
+const uint32_t CATALOG_TABLE_SIZE =
+    CATALOG_TABLE_COLUMNS_OFFSET + CATALOG_MAX_COLUMNS * CATALOG_COLUMN_SIZE;
+uint32_t CATALOG_MAX_TABLES;
+
+uint32_t* catalog_num_tables(void* page) {
+  return page + CATALOG_NUM_TABLES_OFFSET;
+}
+
+void* catalog_table(void* page, uint32_t index) {
+  return page + CATALOG_HEADER_SIZE + index * CATALOG_TABLE_SIZE;
+}
+
+char* catalog_table_name(void* page, uint32_t index) {
+  return catalog_table(page, index) + CATALOG_TABLE_NAME_OFFSET;
+}
+
+uint32_t* catalog_table_root(void* page, uint32_t index) {
+  return catalog_table(page, index) + CATALOG_TABLE_ROOT_OFFSET;
+}
+
+uint32_t* catalog_table_num_rows(void* page, uint32_t index) {
+  return catalog_table(page, index) + CATALOG_TABLE_NUM_ROWS_OFFSET;
+}
+
+uint32_t* catalog_table_num_columns(void* page, uint32_t index) {
+  return catalog_table(page, index) + CATALOG_TABLE_NUM_COLUMNS_OFFSET;
+}
+
+void* catalog_column(void* page, uint32_t index, uint32_t column) {
+  return catalog_table(page, index) + CATALOG_TABLE_COLUMNS_OFFSET +
+         column * CATALOG_COLUMN_SIZE;
+}
+
+char* catalog_column_name(void* page, uint32_t index, uint32_t column) {
+  return catalog_column(page, index, column) + CATALOG_COLUMN_NAME_OFFSET;
+}
+
+uint32_t* catalog_column_type(void* page, uint32_t index, uint32_t column) {
+  return catalog_column(page, index, column) + CATALOG_COLUMN_TYPE_OFFSET;
+}
+
+uint32_t* catalog_column_length(void* page, uint32_t index, uint32_t column) {
+  return catalog_column(page, index, column) + CATALOG_COLUMN_LENGTH_OFFSET;
+}
+
+void initialize_catalog_page(void* page) {
+  set_node_type(page, NODE_CATALOG);
+  *catalog_num_tables(page) = 0;
+}
+
+/*
+Return the index of the table called name,
+or the number of tables if there is none
+*/
+uint32_t catalog_find(void* page, const char* name) {
+  uint32_t num_tables = *catalog_num_tables(page);
+  for (uint32_t i = 0; i < num_tables; i++) {
+    if (strncmp(catalog_table_name(page, i), name, CATALOG_NAME_SIZE) == 0) {
+      return i;
+    }
+  }
+  return num_tables;
+}
+
+/*
+Return the index of the table's column with the given name,
+or its number of columns if there is none
+*/
+uint32_t catalog_find_column(void* page, uint32_t index, const char* name) {
+  uint32_t num_columns = *catalog_table_num_columns(page, index);
+  for (uint32_t i = 0; i < num_columns; i++) {
+    if (strncmp(catalog_column_name(page, index, i), name,
+                CATALOG_NAME_SIZE) == 0) {
+      return i;
+    }
+  }
+  return num_columns;
+}
+
+/*
+ * Statistics Page Layout
+ *
+ * What analyze learned about the viewing table from a sample of its
+ * leaves. For each column: the number of distinct values, the smallest
+ * and largest, and an equi-depth histogram, the upper bounds of buckets
+ * that each hold the same share of the sampled rows. Values are kept as
+ * text cut to STATISTICS_VALUE_SIZE - 1 characters, rev as the order
+ * preserving hex created table keys use, so every bound compares with
+ * strcmp. Cutting keeps the order (a value is never below a smaller
+ * one's prefix), and predicate values are cut the same way before they
+ * are compared, so long titles and providers that only differ after the
+ * cut count as one value: the estimates lose resolution there but stay
+ * consistent. The page is made by the first analyze and the file header
+ * points to it.
+ */
+const uint32_t STATISTICS_NUM_COLUMNS = COLUMN_TIME + 1;
+const uint32_t STATISTICS_VALUE_SIZE = 24;
+const uint32_t STATISTICS_NUM_BUCKETS = 16;
+const uint32_t STATISTICS_SAMPLE_LEAVES = 64;
+const uint32_t STATISTICS_ANALYZED_ROWS_SIZE = sizeof(uint32_t);
+const uint32_t STATISTICS_ANALYZED_ROWS_OFFSET = COMMON_NODE_HEADER_SIZE;
+const uint32_t STATISTICS_NUM_SAMPLED_SIZE = sizeof(uint32_t);
+const uint32_t STATISTICS_NUM_SAMPLED_OFFSET =
+    STATISTICS_ANALYZED_ROWS_OFFSET + STATISTICS_ANALYZED_ROWS_SIZE;
+const uint32_t STATISTICS_NUM_MODIFIED_SIZE = sizeof(uint32_t);
+const uint32_t STATISTICS_NUM_MODIFIED_OFFSET =
+    STATISTICS_NUM_SAMPLED_OFFSET + STATISTICS_NUM_SAMPLED_SIZE;
+const uint32_t STATISTICS_HEADER_SIZE =
+    STATISTICS_NUM_MODIFIED_OFFSET + STATISTICS_NUM_MODIFIED_SIZE;
+
+/*
+ * Statistics Column Layout
+ */
+const uint32_t STATISTICS_NUM_DISTINCT_SIZE = sizeof(uint32_t);
+const uint32_t STATISTICS_NUM_DISTINCT_OFFSET = 0;
+const uint32_t STATISTICS_NUM_BUCKETS_SIZE = sizeof(uint32_t);
+const uint32_t STATISTICS_NUM_BUCKETS_OFFSET =
+    STATISTICS_NUM_DISTINCT_OFFSET + STATISTICS_NUM_DISTINCT_SIZE;
+const uint32_t STATISTICS_MIN_OFFSET =
+    STATISTICS_NUM_BUCKETS_OFFSET + STATISTICS_NUM_BUCKETS_SIZE;
+const uint32_t STATISTICS_MAX_OFFSET =
+    STATISTICS_MIN_OFFSET + STATISTICS_VALUE_SIZE;
+const uint32_t STATISTICS_BOUNDS_OFFSET =
+    STATISTICS_MAX_OFFSET + STATISTICS_VALUE_SIZE;
+const uint32_t STATISTICS_COLUMN_SIZE =
+    STATISTICS_BOUNDS_OFFSET + STATISTICS_NUM_BUCKETS * STATISTICS_VALUE_SIZE;
+
+uint32_t* statistics_analyzed_rows(void* page) {
+  return page + STATISTICS_ANALYZED_ROWS_OFFSET;
+}
+
+uint32_t* statistics_num_sampled(void* page) {
+  return page + STATISTICS_NUM_SAMPLED_OFFSET;
+}
+
+uint32_t* statistics_num_modified(void* page) {
+  return page + STATISTICS_NUM_MODIFIED_OFFSET;
+}
+
+void* statistics_column(void* page, Column column) {
+  return page + STATISTICS_HEADER_SIZE + column * STATISTICS_COLUMN_SIZE;
+}
+
+uint32_t* statistics_num_distinct(void* page, Column column) {
+  return statistics_column(page, column) + STATISTICS_NUM_DISTINCT_OFFSET;
+}
+
+uint32_t* statistics_num_buckets(void* page, Column column) {
+  return statistics_column(page, column) + STATISTICS_NUM_BUCKETS_OFFSET;
+}
+
+char* statistics_min(void* page, Column column) {
+  return statistics_column(page, column) + STATISTICS_MIN_OFFSET;
+}
+
+char* statistics_max(void* page, Column column) {
+  return statistics_column(page, column) + STATISTICS_MAX_OFFSET;
+}
+
+char* statistics_bound(void* page, Column column, uint32_t bucket) {
+  return statistics_column(page, column) + STATISTICS_BOUNDS_OFFSET +
+         bucket * STATISTICS_VALUE_SIZE;
+}
+
+/*
+ * Bloom Filter Page Layout
+ *
+ * A bloom filter over the keys of the viewing table, so inserts of new
+ * keys and lookups of missing ones can be answered without descending
+ * the tree. It is sized for twice the rows the table had when it was
+ * built, at bits_per_key bits each, and built again at double the size
+ * once that many keys have been added, until it fills the page. Deleted
+ * keys stay set until the next rebuild. num_rows is the file header's
+ * row count as of the filter's last change; a file changed without the
+ * filter being kept up to date no longer matches it and gets a new one.
+ * The file header points to the page, 0 when there is no filter.
+ */
+const uint32_t BLOOM_FILTER_MIN_KEYS = 256;
+const uint32_t BLOOM_FILTER_BITS_PER_KEY_SIZE = sizeof(uint32_t);
+const uint32_t BLOOM_FILTER_BITS_PER_KEY_OFFSET = COMMON_NODE_HEADER_SIZE;
+const uint32_t BLOOM_FILTER_NUM_HASHES_SIZE = sizeof(uint32_t);
+const uint32_t BLOOM_FILTER_NUM_HASHES_OFFSET =
+    BLOOM_FILTER_BITS_PER_KEY_OFFSET + BLOOM_FILTER_BITS_PER_KEY_SIZE;
+const uint32_t BLOOM_FILTER_NUM_BITS_SIZE = sizeof(uint32_t);
+const uint32_t BLOOM_FILTER_NUM_BITS_OFFSET =
+    BLOOM_FILTER_NUM_HASHES_OFFSET + BLOOM_FILTER_NUM_HASHES_SIZE;
+const uint32_t BLOOM_FILTER_NUM_KEYS_SIZE = sizeof(uint32_t);
+const uint32_t BLOOM_FILTER_NUM_KEYS_OFFSET =
+    BLOOM_FILTER_NUM_BITS_OFFSET + BLOOM_FILTER_NUM_BITS_SIZE;
+const uint32_t BLOOM_FILTER_NUM_ROWS_SIZE = sizeof(uint32_t);
+const uint32_t BLOOM_FILTER_NUM_ROWS_OFFSET =
+    BLOOM_FILTER_NUM_KEYS_OFFSET + BLOOM_FILTER_NUM_KEYS_SIZE;
+const uint32_t BLOOM_FILTER_BITS_OFFSET =
+    BLOOM_FILTER_NUM_ROWS_OFFSET + BLOOM_FILTER_NUM_ROWS_SIZE;
+
+uint32_t* bloom_filter_bits_per_key(void* page) {
+  return page + BLOOM_FILTER_BITS_PER_KEY_OFFSET;
+}
+
+uint32_t* bloom_filter_num_hashes(void* page) {
+  return page + BLOOM_FILTER_NUM_HASHES_OFFSET;
+}
+
+uint32_t* bloom_filter_num_bits(void* page) {
+  return page + BLOOM_FILTER_NUM_BITS_OFFSET;
+}
+
+/* Keys added since the filter was built */
+uint32_t* bloom_filter_num_keys(void* page) {
+  return page + BLOOM_FILTER_NUM_KEYS_OFFSET;
+}
+
+uint32_t* bloom_filter_num_rows(void* page) {
+  return page + BLOOM_FILTER_NUM_ROWS_OFFSET;
+}
+
+uint8_t* bloom_filter_bits(void* page) {
+  return page + BLOOM_FILTER_BITS_OFFSET;
+}
+
+uint32_t bloom_filter_max_bits() {
+  return (PAGE_USABLE_SIZE - BLOOM_FILTER_BITS_OFFSET) * 8;
+}
+
+void initialize_partition_directory_page(void* page) {
+  set_node_type(page, NODE_PARTITION_DIRECTORY);
+  *partition_is_partitioned(page) = 0;
+  *partition_num_partitions(page) = 0;
+  *partition_num_dropped(page) = 0;
+}
+
+/*
+ * File Header Page Layout
+ *
+ * Page 0 describes the file: what it is, the format version, the page
+ * size, where the table root and the other fixed pages live and how many
+ * rows the table holds. It is read before the pager knows the page size,
+ * so its fields sit within the smallest page size.
+ */
+const uint32_t FILE_HEADER_PAGE_NUM = 0;
+const char FILE_HEADER_MAGIC[] = "SIMPLEDB";
+const uint32_t FILE_HEADER_MAGIC_SIZE = sizeof(FILE_HEADER_MAGIC) - 1;
+const uint32_t FILE_HEADER_MAGIC_OFFSET = COMMON_NODE_HEADER_SIZE;
+const uint32_t FILE_FORMAT_VERSION = 3;
+const uint32_t FILE_HEADER_VERSION_SIZE = sizeof(uint32_t);
+const uint32_t FILE_HEADER_VERSION_OFFSET =
+    FILE_HEADER_MAGIC_OFFSET + FILE_HEADER_MAGIC_SIZE;
+const uint32_t FILE_HEADER_PAGE_SIZE_SIZE = sizeof(uint32_t);
+const uint32_t FILE_HEADER_PAGE_SIZE_OFFSET =
+    FILE_HEADER_VERSION_OFFSET + FILE_HEADER_VERSION_SIZE;
+const uint32_t FILE_HEADER_ROOT_PAGE_SIZE = sizeof(uint32_t);
+const uint32_t FILE_HEADER_ROOT_PAGE_OFFSET =
+    FILE_HEADER_PAGE_SIZE_OFFSET + FILE_HEADER_PAGE_SIZE_SIZE;
+const uint32_t FILE_HEADER_DICTIONARY_PAGE_SIZE = sizeof(uint32_t);
+const uint32_t FILE_HEADER_DICTIONARY_PAGE_OFFSET =
+    FILE_HEADER_ROOT_PAGE_OFFSET + FILE_HEADER_ROOT_PAGE_SIZE;
+const uint32_t FILE_HEADER_FREELIST_PAGE_SIZE = sizeof(uint32_t);
+const uint32_t FILE_HEADER_FREELIST_PAGE_OFFSET =
+    FILE_HEADER_DICTIONARY_PAGE_OFFSET + FILE_HEADER_DICTIONARY_PAGE_SIZE;
+const uint32_t FILE_HEADER_DIRECTORY_PAGE_SIZE = sizeof(uint32_t);
+const uint32_t FILE_HEADER_DIRECTORY_PAGE_OFFSET =
+    FILE_HEADER_FREELIST_PAGE_OFFSET + FILE_HEADER_FREELIST_PAGE_SIZE;
+const uint32_t FILE_HEADER_NUM_ROWS_SIZE = sizeof(uint32_t);
+const uint32_t FILE_HEADER_NUM_ROWS_OFFSET =
+    FILE_HEADER_DIRECTORY_PAGE_OFFSET + FILE_HEADER_DIRECTORY_PAGE_SIZE;
+const uint32_t FILE_HEADER_CATALOG_PAGE_SIZE = sizeof(uint32_t);
+const uint32_t FILE_HEADER_CATALOG_PAGE_OFFSET =
+    FILE_HEADER_NUM_ROWS_OFFSET + FILE_HEADER_NUM_ROWS_SIZE;
+const uint32_t FILE_HEADER_STATISTICS_PAGE_SIZE = sizeof(uint32_t);
+const uint32_t FILE_HEADER_STATISTICS_PAGE_OFFSET =
+    FILE_HEADER_CATALOG_PAGE_OFFSET + FILE_HEADER_CATALOG_PAGE_SIZE;
+const uint32_t FILE_HEADER_BLOOM_FILTER_PAGE_SIZE = sizeof(uint32_t);
+const uint32_t FILE_HEADER_BLOOM_FILTER_PAGE_OFFSET =
+    FILE_HEADER_STATISTICS_PAGE_OFFSET + FILE_HEADER_STATISTICS_PAGE_SIZE;
+const uint32_t FILE_HEADER_CHANGE_COUNTER_SIZE = sizeof(uint32_t);
+const uint32_t FILE_HEADER_CHANGE_COUNTER_OFFSET =
+    FILE_HEADER_BLOOM_FILTER_PAGE_OFFSET + FILE_HEADER_BLOOM_FILTER_PAGE_SIZE;
+
+/* Where a new file puts the table's root; the header records it */
+const uint32_t TABLE_ROOT_PAGE_NUM = 1;
+
+char* file_header_magic(void* page) {
+  return page + FILE_HEADER_MAGIC_OFFSET;
+}
+
+uint32_t* file_header_version(void* page) {
+  return page + FILE_HEADER_VERSION_OFFSET;
+}
+
+uint32_t* file_header_page_size(void* page) {
+  return page + FILE_HEADER_PAGE_SIZE_OFFSET;
+}
+
+uint32_t* file_header_root_page(void* page) {
+  return page + FILE_HEADER_ROOT_PAGE_OFFSET;
+}
+
+uint32_t* file_header_dictionary_page(void* page) {
+  return page + FILE_HEADER_DICTIONARY_PAGE_OFFSET;
+}
+
+uint32_t* file_header_freelist_page(void* page) {
+  return page + FILE_HEADER_FREELIST_PAGE_OFFSET;
+}
+
+uint32_t* file_header_directory_page(void* page) {
+  return page + FILE_HEADER_DIRECTORY_PAGE_OFFSET;
+}
+
+uint32_t* file_header_num_rows(void* page) {
+  return page + FILE_HEADER_NUM_ROWS_OFFSET;
+}
+
+uint32_t* file_header_catalog_page(void* page) {
+  return page + FILE_HEADER_CATALOG_PAGE_OFFSET;
+}
+
+/* 0 until the table is first analyzed */
+uint32_t* file_header_statistics_page(void* page) {
+  return page + FILE_HEADER_STATISTICS_PAGE_OFFSET;
+}
+
+/* 0 unless the viewing table has a bloom filter */
+uint32_t* file_header_bloom_filter_page(void* page) {
+  return page + FILE_HEADER_BLOOM_FILTER_PAGE_OFFSET;
+}
+
+/* Bumped by every --shared statement that changes the file */
+uint32_t* file_header_change_counter(void* page) {
+  return page + FILE_HEADER_CHANGE_COUNTER_OFFSET;
+}
+
+uint32_t* page_checksum(void* page) { return page + PAGE_USABLE_SIZE; }
+
+bool is_valid_page_size(uint32_t page_size) {
+  // A power of two from MIN_PAGE_SIZE to MAX_PAGE_SIZE
+  return page_size >= MIN_PAGE_SIZE && page_size <= MAX_PAGE_SIZE &&
+         (page_size & (page_size - 1)) == 0;
+}
+
+/*
+Set the page size and everything in the layout that depends on it
+*/
+void set_page_size(uint32_t page_size) {
+  PAGE_SIZE = page_size;
+  PAGE_USABLE_SIZE = PAGE_SIZE - PAGE_CHECKSUM_SIZE;
+
+  LEAF_NODE_SPACE_FOR_CELLS = PAGE_USABLE_SIZE - LEAF_NODE_HEADER_SIZE;
+  LEAF_NODE_MAX_CELLS = leaf_node_capacity(LEAF_NODE_CELL_SIZE);
+
+  // The most keys whose child pointers, padded to a cache line,
+  // and key slots fit in the page
+  uint32_t max_keys = (PAGE_USABLE_SIZE - INTERNAL_NODE_CHILDREN_OFFSET) /
+                      (INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SLOT_SIZE);
+  uint32_t keys_offset;
+  while (true) {
+    uint32_t children_end =
+        INTERNAL_NODE_CHILDREN_OFFSET + max_keys * INTERNAL_NODE_CHILD_SIZE;
+    keys_offset = (children_end + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE *
+                  CACHE_LINE_SIZE;
+    if (keys_offset + max_keys * INTERNAL_NODE_KEY_SLOT_SIZE <=
+        PAGE_USABLE_SIZE) {
+      break;
+    }
+    max_keys--;
+  }
+  INTERNAL_NODE_MAX_KEYS = max_keys;
+  INTERNAL_NODE_MIN_KEYS = INTERNAL_NODE_MAX_KEYS / 2;
+  INTERNAL_NODE_KEYS_OFFSET = keys_offset;
+
+  DICTIONARY_SPACE_FOR_ENTRIES = PAGE_USABLE_SIZE - DICTIONARY_HEADER_SIZE;
+  FREELIST_MAX_PAGES =
+      (PAGE_USABLE_SIZE - FREELIST_HEADER_SIZE) / FREELIST_PAGE_NUM_SIZE;
+  PARTITION_MAX_PARTITIONS =
+      (PAGE_USABLE_SIZE - PARTITION_ENTRIES_OFFSET) / PARTITION_ENTRY_SIZE;
+  CATALOG_MAX_TABLES =
+      (PAGE_USABLE_SIZE - CATALOG_HEADER_SIZE) / CATALOG_TABLE_SIZE;
+}
+
+void print_constants() {
+  printf("PAGE_SIZE: %d\n", PAGE_SIZE);
+  printf("ROW_SIZE: %d\n", ROW_SIZE);
+  printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
+  printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
+  printf("LEAF_NODE_CELL_SIZE: %d\n", LEAF_NODE_CELL_SIZE);
+  printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
+  printf("LEAF_NODE_MAX_CELLS: %d\n", LEAF_NODE_MAX_CELLS);
+  printf("INTERNAL_NODE_KEYS_OFFSET: %d\n", INTERNAL_NODE_KEYS_OFFSET);
+  printf("INTERNAL_NODE_MAX_KEYS: %d\n", INTERNAL_NODE_MAX_KEYS);
+  printf("DICTIONARY_SPACE_FOR_ENTRIES: %d\n", DICTIONARY_SPACE_FOR_ENTRIES);
+}
+
+void indent(uint32_t level) {
+  for (uint32_t i = 0; i < level; i++) {
+    printf("  ");
+  }
+}
+
+/*
+ * Title and provider are stored as dictionary codes. The caller must have
+ * encoded them into title_code and provider_code before serializing, and
+ * must decode them after deserializing if the strings are needed.
+ */
+void serialize_row(Row* source, void* destination) {
+  memcpy(destination + STB_OFFSET, &(source->stb), STB_SIZE);
+  memcpy(destination + TITLE_CODE_OFFSET, &(source->title_code),
+         TITLE_CODE_SIZE);
+  memcpy(destination + PROVIDER_CODE_OFFSET, &(source->provider_code),
+         PROVIDER_CODE_SIZE);
+  memcpy(destination + DATE_OFFSET, &(source->date), DATE_SIZE);
+  memcpy(destination + REV_OFFSET, &(source->rev), REV_SIZE);
+  memcpy(destination + TIME_OFFSET, &(source->time), TIME_SIZE);
+}
+
+void deserialize_row(void* source, Row* destination) {
+  memcpy(&(destination->stb), source + STB_OFFSET, STB_SIZE);
+  memcpy(&(destination->title_code), source + TITLE_CODE_OFFSET,
+         TITLE_CODE_SIZE);
+  memcpy(&(destination->provider_code), source + PROVIDER_CODE_OFFSET,
+         PROVIDER_CODE_SIZE);
+  memcpy(&(destination->date), source + DATE_OFFSET, DATE_SIZE);
+  memcpy(&(destination->rev), source + REV_OFFSET, REV_SIZE);
+  memcpy(&(destination->time), source + TIME_OFFSET, TIME_SIZE);
+}
+
+/*
+The key rows are ordered by, stb_title_date. key must have room
+for LEAF_NODE_KEY_SIZE bytes.
+*/
+void row_key(Row* row, char* key) {
+  snprintf(key, LEAF_NODE_KEY_SIZE, "%s_%s_%s", row->stb, row->title,
+           row->date);
+}
+
+/*
+Bytes a column takes in a row. The key column is stored as a string
+of hex digits (numbers) or the text itself, plus its terminator.
+*/
+uint32_t column_stored_size(ColumnType type, uint32_t length, bool is_key) {
+  switch (type) {
+    case (TYPE_INT):
+    case (TYPE_FLOAT):
+      return is_key ? 2 * sizeof(uint32_t) + 1 : sizeof(uint32_t);
+    case (TYPE_BIGINT):
+    case (TYPE_DOUBLE):
+      return is_key ? 2 * sizeof(uint64_t) + 1 : sizeof(uint64_t);
+    case (TYPE_CHAR):
+      return is_key ? length + 1 : length;
+    case (TYPE_VARCHAR):
+      // A terminator in a key, a length byte in a value
+      return length + 1;
+    case (TYPE_DATE):
+      // A key keeps the YYYY-MM-DD text, a value packs YYYYMMDD
+      return is_key ? COLUMN_DATE_SIZE + 1 : sizeof(uint32_t);
+  }
+  return 0;
+}
+
+void row_codec_build(void* catalog_page, uint32_t index, RowCodec* codec) {
+  codec->num_fields = *catalog_table_num_columns(catalog_page, index);
+  codec->value_size = 0;
+  for (uint32_t i = 0; i < codec->num_fields; i++) {
+    Field* field = &(codec->fields[i]);
+    field->type = *catalog_column_type(catalog_page, index, i);
+    field->length = *catalog_column_length(catalog_page, index, i);
+    field->size = column_stored_size(field->type, field->length, i == 0);
+    if (i == 0) {
+      field->offset = 0;
+      codec->key_size = field->size;
+    } else {
+      field->offset = codec->value_size;
+      codec->value_size += field->size;
+    }
+  }
+}
+
+/*
+Flip the sign bit of integers and order floats by their bits,
+so the hex digits of the key sort like the numbers
+*/
+uint32_t order_float_bits(uint32_t bits) {
+  return (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+}
+
+uint64_t order_double_bits(uint64_t bits) {
+  return (bits & 0x8000000000000000ull) ? ~bits
+                                        : bits | 0x8000000000000000ull;
+}
+
+void row_codec_encode_key(RowCodec* codec, Value* row, char* key) {
+  Field* field = &(codec->fields[0]);
+  uint32_t bits32;
+  uint64_t bits64;
+  switch (field->type) {
+    case (TYPE_INT):
+      sprintf(key, "%08x", (uint32_t)row[0].int_value ^ 0x80000000u);
+      break;
+    case (TYPE_BIGINT):
+      sprintf(key, "%016llx",
+              (unsigned long long)((uint64_t)row[0].bigint_value ^
+                                   0x8000000000000000ull));
+      break;
+    case (TYPE_FLOAT):
+      memcpy(&bits32, &(row[0].float_value), sizeof(bits32));
+      sprintf(key, "%08x", order_float_bits(bits32));
+      break;
+    case (TYPE_DOUBLE):
+      memcpy(&bits64, &(row[0].double_value), sizeof(bits64));
+      sprintf(key, "%016llx", (unsigned long long)order_double_bits(bits64));
+      break;
+    default:
+      strcpy(key, row[0].text);
+      break;
+  }
+}
+
+void row_codec_decode_key(RowCodec* codec, char* key, Value* row) {
+  Field* field = &(codec->fields[0]);
+  uint32_t bits32;
+  uint64_t bits64;
+  switch (field->type) {
+    case (TYPE_INT):
+      row[0].int_value = (int32_t)(strtoul(key, NULL, 16) ^ 0x80000000u);
+      break;
+    case (TYPE_BIGINT):
+      row[0].bigint_value =
+          (int64_t)(strtoull(key, NULL, 16) ^ 0x8000000000000000ull);
+      break;
+    case (TYPE_FLOAT):
+      bits32 = strtoul(key, NULL, 16);
+      bits32 = (bits32 & 0x80000000u) ? bits32 & ~0x80000000u : ~bits32;
+      memcpy(&(row[0].float_value), &bits32, sizeof(bits32));
+      break;
+    case (TYPE_DOUBLE):
+      bits64 = strtoull(key, NULL, 16);
+      bits64 = (bits64 & 0x8000000000000000ull)
+                   ? bits64 & ~0x8000000000000000ull
+                   : ~bits64;
+      memcpy(&(row[0].double_value), &bits64, sizeof(bits64));
+      break;
+    default:
+      strcpy(row[0].text, key);
+      break;
+  }
+}
+
+void row_codec_encode(RowCodec* codec, Value* row, char* key, void* value) {
+  row_codec_encode_key(codec, row, key);
+  for (uint32_t i = 1; i < codec->num_fields; i++) {
+    Field* field = &(codec->fields[i]);
+    void* destination = value + field->offset;
+    uint32_t year, month, day, date;
+    uint8_t length;
+    switch (field->type) {
+      case (TYPE_CHAR):
+        strncpy(destination, row[i].text, field->length);
+        break;
+      case (TYPE_VARCHAR):
+        length = strlen(row[i].text);
+        memcpy(destination, &length, sizeof(length));
+        memcpy(destination + sizeof(length), row[i].text, length);
+        break;
+      case (TYPE_DATE):
+        sscanf(row[i].text, "%4u-%2u-%2u", &year, &month, &day);
+        date = year * 10000 + month * 100 + day;
+        memcpy(destination, &date, sizeof(date));
+        break;
+      default:
+        // Numbers are copied as they are, at their stored size
+        memcpy(destination, &(row[i]), field->size);
+        break;
+    }
+  }
+}
+
+void row_codec_decode(RowCodec* codec, char* key, void* value, Value* row) {
+  row_codec_decode_key(codec, key, row);
+  for (uint32_t i = 1; i < codec->num_fields; i++) {
+    Field* field = &(codec->fields[i]);
+    void* source = value + field->offset;
+    uint32_t date;
+    uint8_t length;
+    switch (field->type) {
+      case (TYPE_CHAR):
+        memcpy(row[i].text, source, field->length);
+        row[i].text[field->length] = '\0';
+        break;
+      case (TYPE_VARCHAR):
+        memcpy(&length, source, sizeof(length));
+        memcpy(row[i].text, source + sizeof(length), length);
+        row[i].text[length] = '\0';
+        break;
+      case (TYPE_DATE):
+        memcpy(&date, source, sizeof(date));
+        sprintf(row[i].text, "%04u-%02u-%02u", date / 10000, date / 100 % 100,
+                date % 100);
+        break;
+      default:
+        memcpy(&(row[i]), source, field->size);
+        break;
+    }
+  }
+}
+
+/*
+Convert the text of a value to the column's type.
+Returns false if it is not a value of that type.
+*/
+bool parse_value(Field* field, const char* text, Value* value) {
+  char* end;
+  uint32_t year, month, day;
+  char rest;
+  errno = 0;
+  switch (field->type) {
+    case (TYPE_INT): {
+      long number = strtol(text, &end, 10);
+      value->int_value = number;
+      return *end == '\0' && errno == 0 && number >= INT32_MIN &&
+             number <= INT32_MAX;
+    }
+    case (TYPE_BIGINT):
+      value->bigint_value = strtoll(text, &end, 10);
+      return *end == '\0' && errno == 0;
+    case (TYPE_FLOAT):
+      value->float_value = strtof(text, &end);
+      return *end == '\0' && errno == 0;
+    case (TYPE_DOUBLE):
+      value->double_value = strtod(text, &end);
+      return *end == '\0' && errno == 0;
+    case (TYPE_CHAR):
+    case (TYPE_VARCHAR):
+      if (strlen(text) > field->length) {
+        return false;
+      }
+      strcpy(value->text, text);
+      return true;
+    case (TYPE_DATE):
+      if (strlen(text) != COLUMN_DATE_SIZE ||
+          sscanf(text, "%4u-%2u-%2u%c", &year, &month, &day, &rest) != 3 ||
+          month < 1 || month > 12 || day < 1 || day > 31) {
+        return false;
+      }
+      strcpy(value->text, text);
+      return true;
+  }
+  return false;
+}
+
+/*
+Write a value as select prints it. text must hold VALUE_TEXT_SIZE bytes.
+*/
+void format_value(Field* field, Value* value, char* text) {
+  switch (field->type) {
+    case (TYPE_INT):
+      snprintf(text, VALUE_TEXT_SIZE, "%d", value->int_value);
+      break;
+    case (TYPE_BIGINT):
+      snprintf(text, VALUE_TEXT_SIZE, "%lld", (long long)value->bigint_value);
+      break;
+    case (TYPE_FLOAT):
+      snprintf(text, VALUE_TEXT_SIZE, "%f", value->float_value);
+      break;
+    case (TYPE_DOUBLE):
+      snprintf(text, VALUE_TEXT_SIZE, "%f", value->double_value);
+      break;
+    default:
+      strcpy(text, value->text);
+      break;
+  }
+}
+
+void print_values(RowCodec* codec, Value* row) {
+  if (!emit_row()) {
+    return;
+  }
+  char text[VALUE_TEXT_SIZE];
+  printf("(");
+  for (uint32_t i = 0; i < codec->num_fields; i++) {
+    format_value(&(codec->fields[i]), &(row[i]), text);
+    printf(i > 0 ? ", %s" : "%s", text);
+  }
+  printf(")\n");
+}
+
+void initialize_leaf_node(void* node, uint32_t key_size, uint32_t value_size) {
+  set_node_type(node, NODE_LEAF);
+  set_node_root(node, false);
+  *leaf_node_num_cells(node) = 0;
+  *leaf_node_next_leaf(node) = 0;  // 0 represents no sibling
+  *leaf_node_key_size(node) = key_size;
+  *leaf_node_value_size(node) = value_size;
+  *leaf_node_head_skip(node) = 0;
+  uint32_t heads_size =
+      leaf_node_capacity(key_size + value_size) * LEAF_NODE_HEAD_SIZE;
+  *leaf_node_cells_offset(node) =
+      LEAF_NODE_HEADER_SIZE + (heads_size + CACHE_LINE_SIZE - 1) /
+                                  CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+}
+
+void initialize_internal_node(void* node) {
+  set_node_type(node, NODE_INTERNAL);
+  set_node_root(node, false);
+  *internal_node_num_keys(node) = 0;
+}
+
+/*
+CRC32C (Castagnoli). Uses the SSE4.2 instruction when the CPU has it,
+the ARMv8 CRC instructions when built for them and a table otherwise.
+*/
+uint32_t crc32c_table[256];
+
+void crc32c_init_table() {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (uint32_t bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+    }
+    crc32c_table[i] = crc;
+  }
+}
+
+uint32_t crc32c_software(const uint8_t* bytes, size_t length) {
+  uint32_t crc = 0xFFFFFFFF;
+  while (length--) {
+    crc = crc32c_table[(crc ^ *bytes++) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+uint32_t crc32c_hardware(const uint8_t* bytes, size_t length) {
+  uint64_t crc = 0xFFFFFFFF;
+  for (; length >= sizeof(uint64_t); length -= sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    crc = _mm_crc32_u64(crc, word);
+    bytes += sizeof(uint64_t);
+  }
+  uint32_t crc32 = crc;
+  while (length--) {
+    crc32 = _mm_crc32_u8(crc32, *bytes++);
+  }
+  return ~crc32;
+}
+#elif defined(__ARM_FEATURE_CRC32)
+uint32_t crc32c_hardware(const uint8_t* bytes, size_t length) {
+  uint32_t crc = 0xFFFFFFFF;
+  for (; length >= sizeof(uint64_t); length -= sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    crc = __crc32cd(crc, word);
+    bytes += sizeof(uint64_t);
+  }
+  while (length--) {
+    crc = __crc32cb(crc, *bytes++);
+  }
+  return ~crc;
+}
+#endif
+
+uint32_t (*crc32c)(const uint8_t* bytes, size_t length) = NULL;
+
+void crc32c_init() {
+  crc32c_init_table();
+  crc32c = crc32c_software;
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("sse4.2")) {
+    crc32c = crc32c_hardware;
+  }
+#elif defined(__ARM_FEATURE_CRC32)
+  crc32c = crc32c_hardware;
+#endif
+}
+
+/*
+Reserve the frame arena. It is mapped rather than malloced so frames
+are PAGE_SIZE aligned for direct I/O and the kernel may back it with
+huge pages.
+*/
+void frame_arena_init(Pager* pager) {
+  size_t arena_size = (size_t)TABLE_MAX_PAGES * PAGE_SIZE;
+  pager->frame_arena = mmap(NULL, arena_size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (pager->frame_arena == MAP_FAILED) {
+    printf("Unable to reserve page frames: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+#ifdef MADV_HUGEPAGE
+  madvise(pager->frame_arena, arena_size, MADV_HUGEPAGE);
+#endif
+
+  pager->num_free_frames = TABLE_MAX_PAGES;
+  for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
+    // Hand frames out from the start of the arena first
+    pager->free_frames[TABLE_MAX_PAGES - 1 - i] =
+        pager->frame_arena + i * PAGE_SIZE;
+  }
+}
+
+/*
+Take a frame off the free stack. The caller holds the prefetcher lock.
+*/
+void* pager_alloc_frame(Pager* pager) {
+  if (pager->num_free_frames == 0) {
+    printf("Out of page frames\n");
+    exit(EXIT_FAILURE);
+  }
+  pager->num_free_frames -= 1;
+  return pager->free_frames[pager->num_free_frames];
+}
+
+void pager_release_frame(Pager* pager, void* frame) {
+  pthread_mutex_lock(&(pager->prefetcher.lock));
+  pager->free_frames[pager->num_free_frames++] = frame;
+  pthread_mutex_unlock(&(pager->prefetcher.lock));
+}
+
+/*
+Microseconds every page read from the file waits before it is issued, to
+stand in for a slow device when benchmarking. 0 outside the benchmarks.
+*/
+uint32_t read_delay_microseconds = 0;
+
+void* prefetch_worker(void* argument) {
+  Pager* pager = argument;
+  Prefetcher* prefetcher = &(pager->prefetcher);
+
+  pthread_mutex_lock(&(prefetcher->lock));
+  while (true) {
+    while (!prefetcher->stop && prefetcher->queue_length == 0) {
+      pthread_cond_wait(&(prefetcher->changed), &(prefetcher->lock));
+    }
+    if (prefetcher->stop) {
+      break;
+    }
+    uint32_t page_num = prefetcher->queue[prefetcher->queue_head];
+    prefetcher->queue_head = (prefetcher->queue_head + 1) % PREFETCH_QUEUE_SIZE;
+    prefetcher->queue_length -= 1;
+    prefetcher->states[page_num] = PREFETCH_READING;
+    void* frame = pager_alloc_frame(pager);
+    pthread_mutex_unlock(&(prefetcher->lock));
+
+    if (read_delay_microseconds > 0) {
+      usleep(read_delay_microseconds);
+    }
+    // pread leaves the file offset alone, so get_page can seek concurrently
+    ssize_t bytes_read = pread(pager->file_descriptor, frame, PAGE_SIZE,
+                               (off_t)page_num * PAGE_SIZE);
+    if (bytes_read > 0) {
+      metrics_add(METRIC_PAGES_READ, 1);
+      metrics_add(METRIC_BYTES_READ, bytes_read);
+    }
+
+    pthread_mutex_lock(&(prefetcher->lock));
+    if (bytes_read == PAGE_SIZE) {
+      prefetcher->frames[page_num] = frame;
+      prefetcher->states[page_num] = PREFETCH_READY;
+    } else {
+      // get_page will read it (and report the error) itself
+      pager->free_frames[pager->num_free_frames++] = frame;
+      prefetcher->states[page_num] = PREFETCH_NONE;
+    }
+    pthread_cond_broadcast(&(prefetcher->changed));
+  }
+  pthread_mutex_unlock(&(prefetcher->lock));
+  metrics_release();
+  return NULL;
+}
+
+void prefetcher_start(Pager* pager) {
+  Prefetcher* prefetcher = &(pager->prefetcher);
+  pthread_mutex_init(&(prefetcher->lock), NULL);
+  pthread_cond_init(&(prefetcher->changed), NULL);
+  prefetcher->stop = false;
+  prefetcher->queue_head = 0;
+  prefetcher->queue_length = 0;
+  for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
+    prefetcher->states[i] = PREFETCH_NONE;
+    prefetcher->frames[i] = NULL;
+  }
+
+  for (uint32_t i = 0; i < PREFETCH_WORKERS; i++) {
+    if (pthread_create(&(prefetcher->threads[i]), NULL, prefetch_worker,
+                       pager) != 0) {
+      printf("Unable to start prefetch thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+void prefetcher_stop(Pager* pager) {
+  Prefetcher* prefetcher = &(pager->prefetcher);
+  pthread_mutex_lock(&(prefetcher->lock));
+  prefetcher->stop = true;
+  pthread_cond_broadcast(&(prefetcher->changed));
+  pthread_mutex_unlock(&(prefetcher->lock));
+  for (uint32_t i = 0; i < PREFETCH_WORKERS; i++) {
+    pthread_join(prefetcher->threads[i], NULL);
+  }
+
+  pthread_cond_destroy(&(prefetcher->changed));
+  pthread_mutex_destroy(&(prefetcher->lock));
+}
+
+/*
+Queue an asynchronous read of a page that is on disk but not cached
+*/
+void pager_prefetch(Pager* pager, uint32_t page_num) {
+  if (page_num >= pager->file_length / PAGE_SIZE ||
+      pager->pages[page_num] != NULL) {
+    return;
+  }
+
+  Prefetcher* prefetcher = &(pager->prefetcher);
+  pthread_mutex_lock(&(prefetcher->lock));
+  if (prefetcher->states[page_num] == PREFETCH_NONE &&
+      prefetcher->queue_length < PREFETCH_QUEUE_SIZE) {
+    uint32_t tail = (prefetcher->queue_head + prefetcher->queue_length) %
+                    PREFETCH_QUEUE_SIZE;
+    prefetcher->queue[tail] = page_num;
+    prefetcher->queue_length += 1;
+    prefetcher->states[page_num] = PREFETCH_QUEUED;
+    pthread_cond_signal(&(prefetcher->changed));
+  }
+  pthread_mutex_unlock(&(prefetcher->lock));
+}
+
+/*
+Get a frame for a page that is not cached: the prefetched copy, waiting
+for the read if it is still queued or in flight, or else a free frame
+the caller has to fill.
+*/
+void* pager_take_frame(Pager* pager, uint32_t page_num, bool* prefetched) {
+  Prefetcher* prefetcher = &(pager->prefetcher);
+  pthread_mutex_lock(&(prefetcher->lock));
+  while (prefetcher->states[page_num] == PREFETCH_QUEUED ||
+         prefetcher->states[page_num] == PREFETCH_READING) {
+    pthread_cond_wait(&(prefetcher->changed), &(prefetcher->lock));
+  }
+  void* frame = prefetcher->frames[page_num];
+  *prefetched = frame != NULL;
+  if (frame == NULL) {
+    frame = pager_alloc_frame(pager);
+  }
+  prefetcher->frames[page_num] = NULL;
+  prefetcher->states[page_num] = PREFETCH_NONE;
+  pthread_mutex_unlock(&(prefetcher->lock));
+  return frame;
+}
+
+/*
+True if get_page can return the page without waiting for a read.
+Otherwise a read of it is queued, unless one already is.
+*/
+bool pager_page_ready(Pager* pager, uint32_t page_num) {
+  if (pager->pages[page_num] != NULL ||
+      page_num >= pager->file_length / PAGE_SIZE) {
+    return true;
+  }
+  Prefetcher* prefetcher = &(pager->prefetcher);
+  pthread_mutex_lock(&(prefetcher->lock));
+  PrefetchState state = prefetcher->states[page_num];
+  pthread_mutex_unlock(&(prefetcher->lock));
+  if (state == PREFETCH_NONE) {
+    // A full queue drops the request; the caller asks again later
+    pager_prefetch(pager, page_num);
+  }
+  return state == PREFETCH_READY;
+}
+
+/*
+Block until a queued or in flight read finishes, if there is one
+*/
+void pager_wait_for_prefetch(Pager* pager) {
+  Prefetcher* prefetcher = &(pager->prefetcher);
+  pthread_mutex_lock(&(prefetcher->lock));
+  bool pending = prefetcher->queue_length > 0;
+  for (uint32_t i = 0; i < TABLE_MAX_PAGES && !pending; i++) {
+    pending = prefetcher->states[i] == PREFETCH_READING;
+  }
+  if (pending) {
+    pthread_cond_wait(&(prefetcher->changed), &(prefetcher->lock));
+  }
+  pthread_mutex_unlock(&(prefetcher->lock));
+}
+
+/*
+Check a page read from disk against the checksum written with it
+*/
+void pager_verify_page(void* page, uint32_t page_num) {
+  if (crc32c(page, PAGE_USABLE_SIZE) != *page_checksum(page)) {
+    printf("Checksum mismatch on page %d. Corrupt file.\n", page_num);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/*
+ * Online backup. .backup <path> copies the database to path a few pages
+ * after each statement, so inserts and selects go on meanwhile. The copy
+ * is the database as it was when the backup started: get_page copies a
+ * page that is still to be copied before handing it to a statement that
+ * might change it, and pages added since the start are left out.
+ *
+ * When path already holds a backup, a page whose checksum matches the
+ * one there is not written again, so backing up to the same path again
+ * only writes the pages changed since.
+ */
+struct Backup_t {
+  Pager* pager;  // NULL when no backup is running
+  char* path;
+  int file_descriptor;
+  uint32_t num_pages;  // pages in the database when the backup started
+  uint32_t next_page;  // where copying after statements carries on
+  uint32_t num_copied;
+  uint32_t num_written;
+  uint32_t num_unchanged;
+  bool copied[TABLE_MAX_PAGES];
+  void* buffer;  // one page, aligned for direct I/O
+};
+typedef struct Backup_t Backup;
+
+enum { BACKUP_PAGES_PER_STATEMENT = 8 };
+
+Backup backup;
+
+/*
+Copy one page of the snapshot. A cached page is copied from its frame,
+with the checksum in the copy brought up to date; any other page is read
+from the database file.
+*/
+void backup_copy_page(uint32_t page_num) {
+  Pager* pager = backup.pager;
+  void* page = backup.buffer;
+  if (pager->pages[page_num] != NULL) {
+    memcpy(page, pager->pages[page_num], PAGE_SIZE);
+    *page_checksum(page) = crc32c(page, PAGE_USABLE_SIZE);
+  } else {
+    ssize_t bytes_read = pread(pager->file_descriptor, page, PAGE_SIZE,
+                               (off_t)page_num * PAGE_SIZE);
+    if (bytes_read != PAGE_SIZE) {
+      printf("Error reading page %d for backup: %d\n", page_num, errno);
+      exit(EXIT_FAILURE);
+    }
+    metrics_add(METRIC_PAGES_READ, 1);
+    metrics_add(METRIC_BYTES_READ, bytes_read);
+    pager_verify_page(page, page_num);
+  }
+  backup.copied[page_num] = true;
+  backup.num_copied++;
+
+  off_t offset = (off_t)page_num * PAGE_SIZE;
+  uint32_t old_checksum;
+  if (pread(backup.file_descriptor, &old_checksum, sizeof(old_checksum),
+            offset + PAGE_USABLE_SIZE) == sizeof(old_checksum) &&
+      old_checksum == *page_checksum(page)) {
+    backup.num_unchanged++;
+    return;
+  }
+  if (pwrite(backup.file_descriptor, page, PAGE_SIZE, offset) != PAGE_SIZE) {
+    printf("Error writing backup: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  backup.num_written++;
+}
+
+/*
+Copy up to max_pages more pages of a running backup of pager's database,
+and finish it once every page has been copied
+*/
+void backup_run(Pager* pager, uint32_t max_pages) {
+  if (backup.pager != pager) {
+    return;
+  }
+  uint32_t num_copied = 0;
+  while (backup.next_page < backup.num_pages && num_copied < max_pages) {
+    if (!backup.copied[backup.next_page]) {
+      backup_copy_page(backup.next_page);
+      num_copied++;
+    }
+    backup.next_page++;
+  }
+  if (backup.next_page < backup.num_pages) {
+    return;
+  }
+
+  // An earlier backup at the path may have had more pages
+  if (ftruncate(backup.file_descriptor,
+                (off_t)backup.num_pages * PAGE_SIZE) == -1 ||
+      fsync(backup.file_descriptor) == -1) {
+    printf("Error syncing backup: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  metrics_add(METRIC_FSYNCS, 1);
+  close(backup.file_descriptor);
+  free(backup.buffer);
+  backup.pager = NULL;
+}
+
+/*
+A page of the snapshot is copied before a statement can change it
+*/
+void backup_page_used(Pager* pager, uint32_t page_num) {
+  if (backup.pager == pager && page_num < backup.num_pages &&
+      !backup.copied[page_num]) {
+    backup_copy_page(page_num);
+  }
+}
+
+void* get_page(Pager* pager, uint32_t page_num) {
+  if (page_num >= TABLE_MAX_PAGES) {
+    printf("Tried to fetch page number out of bounds. %d > %d\n", page_num,
+           TABLE_MAX_PAGES);
+    exit(EXIT_FAILURE);
+  }
+
+  // All uses within one statement count as one, and uses of a leaf a
+  // scan cursor entered this statement do not count at all
+  uint64_t clock = pager->statement_clock;
+  if (pager->last_access[page_num] != clock &&
+      pager->scanned[page_num] != clock) {
+    pager->previous_access[page_num] = pager->last_access[page_num];
+    pager->last_access[page_num] = clock;
+  }
+
+  if (pager->pages[page_num] != NULL) {
+    metrics_add(METRIC_CACHE_HITS, 1);
+  } else {
+    metrics_add(METRIC_CACHE_MISSES, 1);
+    bool prefetched;
+    void* page = pager_take_frame(pager, page_num, &prefetched);
+    if (prefetched) {
+      pager_verify_page(page, page_num);
+      pager->pages[page_num] = page;
+      backup_page_used(pager, page_num);
+      return page;
+    }
+
+    // Cache miss. Load the page from file into the new frame.
+    uint32_t num_pages = pager->file_length / PAGE_SIZE;
+
+    // We might save a partial page at the end of the file
+    if (pager->file_length % PAGE_SIZE) {
+      num_pages += 1;
+    }
+
+    if (page_num <= num_pages) {
+      if (read_delay_microseconds > 0) {
+        usleep(read_delay_microseconds);
+      }
+      ssize_t bytes_read = pread(pager->file_descriptor, page, PAGE_SIZE,
+                                 (off_t)page_num * PAGE_SIZE);
+      if (bytes_read == -1) {
+        printf("Error reading file: %d\n", errno);
+        exit(EXIT_FAILURE);
+      }
+      if (bytes_read > 0) {
+        metrics_add(METRIC_PAGES_READ, 1);
+        metrics_add(METRIC_BYTES_READ, bytes_read);
+      }
+      if (bytes_read == PAGE_SIZE) {
+        pager_verify_page(page, page_num);
+      }
+    }
+
+    pager->pages[page_num] = page;
+
+    if (page_num >= pager->num_pages) {
+      pager->num_pages = page_num + 1;
+    }
+  }
+
+  backup_page_used(pager, page_num);
+  return pager->pages[page_num];
+}
+
+/*
+Leaves a scan cursor moves through are wanted once, by this statement, so
+they should not push out pages that keep being used. Marking one keeps
+the statement's uses of it from counting.
+*/
+void pager_mark_scanned(Pager* pager, uint32_t page_num) {
+  pager->scanned[page_num] = pager->statement_clock;
+}
+
+void* file_header(Pager* pager) {
+  return get_page(pager, FILE_HEADER_PAGE_NUM);
+}
+
+void* partition_directory(Pager* pager) {
+  return get_page(pager, *file_header_directory_page(file_header(pager)));
+}
+
+void* freelist_head(Pager* pager) {
+  return get_page(pager, *file_header_freelist_page(file_header(pager)));
+}
+
+void* catalog(Pager* pager) {
+  return get_page(pager, *file_header_catalog_page(file_header(pager)));
+}
+
+char* get_node_max_key(Pager* pager, void* node) {
+  if (get_node_type(node) == NODE_LEAF) {
+    return leaf_node_key(node, *leaf_node_num_cells(node) - 1);
+  }
+  void* right_child = get_page(pager, *internal_node_right_child(node));
+  return get_node_max_key(pager, right_child);
+}
+
+/*
+Number of levels from the root down to the leaves
+*/
+uint32_t tree_depth(Pager* pager, uint32_t root_page_num) {
+  uint32_t depth = 1;
+  void* node = get_page(pager, root_page_num);
+  while (get_node_type(node) == NODE_INTERNAL) {
+    node = get_page(pager, *internal_node_right_child(node));
+    depth += 1;
+  }
+  return depth;
+}
+
+void print_tree(Pager* pager, uint32_t page_num, uint32_t indentation_level) {
+  void* node = get_page(pager, page_num);
+  uint32_t num_keys, child;
+
+  switch (get_node_type(node)) {
+    case (NODE_LEAF):
+      num_keys = *leaf_node_num_cells(node);
+      indent(indentation_level);
+      printf("leaf (size %d)\n", num_keys);
+      for (uint32_t i = 0; i < num_keys; i++) {
+        indent(indentation_level + 1);
+        printf("- %d : %s\n", i, leaf_node_key(node, i));
+      }
+      break;
+    case (NODE_INTERNAL):
+      num_keys = *internal_node_num_keys(node);
+      indent(indentation_level);
+      printf("internal (size %d)\n", num_keys);
+      for (uint32_t i = 0; i < num_keys; i++) {
+        child = *internal_node_child(node, i);
+        print_tree(pager, child, indentation_level + 1);
+
+        indent(indentation_level + 1);
+        printf("- key %s\n", internal_node_key(node, i));
+      }
+      child = *internal_node_right_child(node);
+      print_tree(pager, child, indentation_level + 1);
+      break;
+    default:
+      break;
+  }
+}
+
+/*
+The head of key: the LEAF_NODE_HEAD_SIZE bytes after skip as a
+big-endian number, zero past the terminator
+*/
+uint64_t key_head(const char* key, uint32_t skip) {
+  const uint8_t* bytes = (const uint8_t*)key + skip;
+  uint64_t head = 0;
+  bool ended = false;
+  for (uint32_t i = 0; i < LEAF_NODE_HEAD_SIZE; i++) {
+    ended = ended || bytes[i] == 0;
+    head = head << 8 | (ended ? 0 : bytes[i]);
+  }
+  return head;
+}
+
+uint32_t key_common_prefix(const char* a, const char* b) {
+  uint32_t length = 0;
+  while (a[length] != 0 && a[length] == b[length]) {
+    length++;
+  }
+  return length;
+}
+
+/*
+Recompute the prefix the leaf's keys share and every head, after
+cells were moved in bulk. Keys are sorted, so the prefix the first
+and last keys share is shared by all.
+*/
+void leaf_node_update_heads(void* node) {
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  uint32_t skip = 0;
+  if (num_cells > 0) {
+    skip = key_common_prefix(leaf_node_key(node, 0),
+                             leaf_node_key(node, num_cells - 1));
+  }
+  *leaf_node_head_skip(node) = skip;
+  uint64_t* heads = leaf_node_heads(node);
+  for (uint32_t i = 0; i < num_cells; i++) {
+    heads[i] = key_head(leaf_node_key(node, i), skip);
+  }
+}
+
+/* Count the heads below head */
+uint32_t key_heads_count_below_scalar(const uint64_t* heads,
+                                      uint32_t num_heads, uint64_t head) {
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < num_heads; i++) {
+    count += heads[i] < head;
+  }
+  return count;
+}
+
+#if defined(__x86_64__)
+/*
+There is no unsigned 64 bit compare, so both sides are offset by 2^63
+and compared signed
+*/
+__attribute__((target("avx2")))
+uint32_t key_heads_count_below_avx2(const uint64_t* heads, uint32_t num_heads,
+                                    uint64_t head) {
+  const __m256i bias = _mm256_set1_epi64x(INT64_MIN);
+  __m256i target = _mm256_xor_si256(_mm256_set1_epi64x(head), bias);
+  uint32_t count = 0;
+  uint32_t i = 0;
+  for (; i + 4 <= num_heads; i += 4) {
+    __m256i values = _mm256_xor_si256(
+        _mm256_loadu_si256((const __m256i*)(heads + i)), bias);
+    __m256i below = _mm256_cmpgt_epi64(target, values);
+    count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(below)));
+  }
+  return count + key_heads_count_below_scalar(heads + i, num_heads - i, head);
+}
+#elif defined(__aarch64__)
+uint32_t key_heads_count_below_neon(const uint64_t* heads, uint32_t num_heads,
+                                    uint64_t head) {
+  uint64x2_t target = vdupq_n_u64(head);
+  uint64x2_t counts = vdupq_n_u64(0);
+  uint32_t i = 0;
+  for (; i + 2 <= num_heads; i += 2) {
+    // Lanes below head compare to all ones, which is -1
+    counts = vsubq_u64(counts, vcltq_u64(vld1q_u64(heads + i), target));
+  }
+  uint32_t count = vgetq_lane_u64(counts, 0) + vgetq_lane_u64(counts, 1);
+  return count + key_heads_count_below_scalar(heads + i, num_heads - i, head);
+}
+#endif
+
+uint32_t (*key_heads_count_below)(const uint64_t* heads, uint32_t num_heads,
+                                  uint64_t head) = key_heads_count_below_scalar;
+
+void key_heads_init() {
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("avx2")) {
+    key_heads_count_below = key_heads_count_below_avx2;
+  }
+#elif defined(__aarch64__)
+  key_heads_count_below = key_heads_count_below_neon;
+#endif
+}
+
+/* Heads a search narrows down to before comparing them all at once */
+const uint32_t KEY_HEADS_BLOCK = 16;
+
+/*
+Index of the first head not below head. A branchless binary search
+narrows the sorted heads down to one block, which is counted with
+SIMD compares.
+*/
+uint32_t key_heads_lower_bound(const uint64_t* heads, uint32_t num_heads,
+                               uint64_t head) {
+  const uint64_t* base = heads;
+  while (num_heads > KEY_HEADS_BLOCK) {
+    uint32_t half = num_heads / 2;
+    base = base[half - 1] < head ? base + half : base;
+    num_heads -= half;
+  }
+  return (base - heads) + key_heads_count_below(base, num_heads, head);
+}
+
+/*
+Cursors live on the caller's stack; the find functions only fill them in
+*/
+void leaf_node_find(Table* table, uint32_t page_num, char* key,
+                    Cursor* cursor) {
+  void* node = get_page(table->pager, page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+
+  cursor->table = table;
+  cursor->page_num = page_num;
+  cursor->end_of_table = false;
+
+  // A key without the leaf's shared prefix sorts before or after it all
+  uint32_t skip = *leaf_node_head_skip(node);
+  if (num_cells > 0 && skip > 0) {
+    int cmp = strncmp(key, leaf_node_key(node, 0), skip);
+    if (cmp != 0) {
+      cursor->cell_num = cmp < 0 ? 0 : num_cells;
+      return;
+    }
+  }
+
+  // Only keys with the same head need comparing
+  uint64_t* heads = leaf_node_heads(node);
+  uint64_t head = key_head(key, skip);
+  uint32_t min_index = key_heads_lower_bound(heads, num_cells, head);
+  uint32_t one_past_max_index = num_cells;
+  if (head != UINT64_MAX) {
+    one_past_max_index =
+        min_index + key_heads_lower_bound(heads + min_index,
+                                          num_cells - min_index, head + 1);
+  }
+
+  // Binary search, past the prefix the keys are known to share
+  while (one_past_max_index != min_index) {
+    uint32_t index = (min_index + one_past_max_index) / 2;
+    char* key_at_index = leaf_node_key(node, index);
+    int cmp = strncmp(key + skip, key_at_index + skip,
+                      LEAF_NODE_KEY_SIZE - skip);
+    if (cmp == 0) {
+      cursor->cell_num = index;
+      return;
+    }
+    if (cmp < 0) {
+      one_past_max_index = index;
+    } else {
+      min_index = index + 1;
+    }
+  }
+
+  cursor->cell_num = min_index;
+}
+
+/*
+Return the index of the child which should contain
+the given key.
+*/
+uint32_t internal_node_find_child(void* node, char* key) {
+  uint32_t num_keys = *internal_node_num_keys(node);
+
+  // Binary search
+  uint32_t min_index = 0;
+  uint32_t max_index = num_keys; /* there is one more child than key */
+
+  while (min_index != max_index) {
+    uint32_t index = (min_index + max_index) / 2;
+    char* key_to_right = internal_node_key(node, index);
+    if (strncmp(key_to_right, key, INTERNAL_NODE_KEY_SIZE) >= 0) {
+      max_index = index;
+    } else {
+      min_index = index + 1;
+    }
+  }
+
+  return min_index;
+}
+
+void internal_node_find(Table* table, uint32_t page_num, char* key,
+                        Cursor* cursor) {
+  void* node = get_page(table->pager, page_num);
+
+  uint32_t child_index = internal_node_find_child(node, key);
+  uint32_t child_num = *internal_node_child(node, child_index);
+  void* child = get_page(table->pager, child_num);
+  switch (get_node_type(child)) {
+    case NODE_LEAF:
+      leaf_node_find(table, child_num, key, cursor);
+      break;
+    case NODE_INTERNAL:
+      internal_node_find(table, child_num, key, cursor);
+      break;
+    default:
+      printf("Unexpected page type in tree: page %d\n", child_num);
+      exit(EXIT_FAILURE);
+  }
+}
+
+/*
+Return the position of the given key.
+If the key is not present, return the position
+where it should be inserted
+*/
+void table_find(Table* table, uint32_t root_page_num, char* key,
+                Cursor* cursor) {
+  void* root_node = get_page(table->pager, root_page_num);
+
+  if (get_node_type(root_node) == NODE_LEAF) {
+    leaf_node_find(table, root_page_num, key, cursor);
+  } else {
+    internal_node_find(table, root_page_num, key, cursor);
+  }
+}
+
+/*
+The first page table_find would have to wait for on its way from the
+root to key, or 0 if every page on the way is cached or prefetched
+*/
+uint32_t table_find_missing_page(Table* table, uint32_t root_page_num,
+                                 char* key) {
+  uint32_t page_num = root_page_num;
+  while (true) {
+    if (!pager_page_ready(table->pager, page_num)) {
+      return page_num;
+    }
+    void* node = get_page(table->pager, page_num);
+    if (get_node_type(node) != NODE_INTERNAL) {
+      return 0;
+    }
+    page_num = *internal_node_child(node, internal_node_find_child(node, key));
+  }
+}
+
+void table_start(Table* table, uint32_t root_page_num, Cursor* cursor) {
+  table_find(table, root_page_num, "", cursor);
+
+  void* node = get_page(table->pager, cursor->page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  cursor->end_of_table = (num_cells == 0);
+}
+
+/*
+An unpartitioned table is the single tree at root_page_num,
+a partitioned one has a tree per month in the directory
+*/
+uint32_t table_num_trees(Table* table) {
+  void* directory = partition_directory(table->pager);
+  if (!*partition_is_partitioned(directory)) {
+    return 1;
+  }
+  return *partition_num_partitions(directory);
+}
+
+uint32_t table_tree_root(Table* table, uint32_t tree_num) {
+  void* directory = partition_directory(table->pager);
+  if (!*partition_is_partitioned(directory)) {
+    return table->root_page_num;
+  }
+  return *partition_root(directory, tree_num);
+}
+
+/*
+Return the index of the partition for month,
+or the index where it should be inserted
+*/
+uint32_t partition_find(void* directory, const char* month) {
+  uint32_t min_index = 0;
+  uint32_t one_past_max_index = *partition_num_partitions(directory);
+  while (one_past_max_index != min_index) {
+    uint32_t index = (min_index + one_past_max_index) / 2;
+    int cmp = strncmp(month, partition_name(directory, index),
+                      PARTITION_NAME_SIZE);
+    if (cmp == 0) {
+      return index;
+    }
+    if (cmp < 0) {
+      one_past_max_index = index;
+    } else {
+      min_index = index + 1;
+    }
+  }
+  return min_index;
+}
+
+void* cursor_value(Cursor* cursor) {
+  uint32_t page_num = cursor->page_num;
+  void* page = get_page(cursor->table->pager, page_num);
+  return leaf_node_value(page, cursor->cell_num);
+}
+
+/*
+A scan moving off a leaf will soon need the leaves after it,
+so queue reads of the next few siblings under the same parent
+*/
+void leaf_node_prefetch_siblings(Pager* pager, void* node, uint32_t page_num) {
+  if (is_node_root(node)) {
+    return;
+  }
+  void* parent = get_page(pager, *node_parent(node));
+  uint32_t num_keys = *internal_node_num_keys(parent);
+  uint32_t child_index = 0;
+  while (child_index <= num_keys &&
+         *internal_node_child(parent, child_index) != page_num) {
+    child_index++;
+  }
+  for (uint32_t i = child_index + 2;
+       i <= num_keys && i < child_index + 2 + PREFETCH_WINDOW; i++) {
+    pager_prefetch(pager, *internal_node_child(parent, i));
+  }
+}
+
+void cursor_advance(Cursor* cursor) {
+  uint32_t page_num = cursor->page_num;
+  void* node = get_page(cursor->table->pager, page_num);
+
+  cursor->cell_num += 1;
+  if (cursor->cell_num >= (*leaf_node_num_cells(node))) {
+    /* Advance to next leaf node */
+    uint32_t next_page_num = *leaf_node_next_leaf(node);
+    if (next_page_num == 0) {
+      /* This was rightmost leaf */
+      cursor->end_of_table = true;
+    } else {
+      leaf_node_prefetch_siblings(cursor->table->pager, node, page_num);
+      pager_mark_scanned(cursor->table->pager, next_page_num);
+      cursor->page_num = next_page_num;
+      cursor->cell_num = 0;
+    }
+  }
+}
+
+uint32_t hash_string(const char* value) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (const char* c = value; *c; c++) {
+    hash ^= (uint8_t)*c;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/*
+ * Point lookup hash index. With --hash-index <entries> the key of each
+ * row found by a key = <value> lookup or just inserted is hashed to a
+ * slot holding the leaf page and cell it was found at, so looking it up
+ * again skips the descent from the root. A slot only ever remembers the
+ * last key hashed to it.
+ *
+ * Slots are not updated when inserts, splits or deletes move cells.
+ * Instead a hit is checked against the key now in that cell, and is a
+ * miss if the row has moved. A page stays in its tree until it is
+ * freed, so a matching key is the row. Freeing a page or vacuuming
+ * forgets every slot at once by moving to the next epoch.
+ */
+struct HashIndexEntry_t {
+  uint32_t hash;
+  uint32_t epoch;
+  uint32_t root_page_num;  // the tree the row is in, one per partition
+  uint32_t page_num;       // 0 for an unused slot
+  uint32_t cell_num;
+};
+typedef struct HashIndexEntry_t HashIndexEntry;
+
+uint32_t hash_index_capacity = 0;  // a power of two, 0 when disabled
+HashIndexEntry* hash_index = NULL;
+uint32_t hash_index_epoch = 0;
+
+void hash_index_forget() { hash_index_epoch++; }
+
+HashIndexEntry* hash_index_slot(uint32_t hash) {
+  return &(hash_index[hash & (hash_index_capacity - 1)]);
+}
+
+/*
+Position cursor at the row with key in the tree at root_page_num if the
+index knows where it is
+*/
+bool hash_index_find(Table* table, uint32_t root_page_num, char* key,
+                     Cursor* cursor) {
+  uint32_t hash = hash_string(key);
+  HashIndexEntry* entry = hash_index_slot(hash);
+  if (entry->page_num == 0 || entry->hash != hash ||
+      entry->epoch != hash_index_epoch ||
+      entry->root_page_num != root_page_num ||
+      entry->page_num >= table->pager->num_pages) {
+    metrics_add(METRIC_HASH_INDEX_MISSES, 1);
+    return false;
+  }
+  void* node = get_page(table->pager, entry->page_num);
+  if (get_node_type(node) != NODE_LEAF ||
+      entry->cell_num >= *leaf_node_num_cells(node) ||
+      strncmp(leaf_node_key(node, entry->cell_num), key,
+              LEAF_NODE_KEY_SIZE) != 0) {
+    metrics_add(METRIC_HASH_INDEX_MISSES, 1);
+    return false;
+  }
+  cursor->table = table;
+  cursor->page_num = entry->page_num;
+  cursor->cell_num = entry->cell_num;
+  cursor->end_of_table = false;
+  metrics_add(METRIC_HASH_INDEX_HITS, 1);
+  return true;
+}
+
+/*
+Remember where cursor is if it points at the row with key
+*/
+void hash_index_store(Table* table, uint32_t root_page_num, char* key,
+                      Cursor* cursor) {
+  void* node = get_page(table->pager, cursor->page_num);
+  if (cursor->cell_num >= *leaf_node_num_cells(node) ||
+      strncmp(leaf_node_key(node, cursor->cell_num), key,
+              LEAF_NODE_KEY_SIZE) != 0) {
+    return;
+  }
+  uint32_t hash = hash_string(key);
+  HashIndexEntry* entry = hash_index_slot(hash);
+  entry->hash = hash;
+  entry->epoch = hash_index_epoch;
+  entry->root_page_num = root_page_num;
+  entry->page_num = cursor->page_num;
+  entry->cell_num = cursor->cell_num;
+}
+
+/*
+Return a page to the free list so the next
+allocation can reuse it instead of growing the file
+*/
+void pager_free_page(Pager* pager, uint32_t page_num) {
+  hash_index_forget();
+  // Mark the page so stale references to it can be recognized
+  set_node_type(get_page(pager, page_num), NODE_FREELIST);
+
+  void* head = freelist_head(pager);
+  uint32_t num_pages = *freelist_num_pages(head);
+  if (num_pages < FREELIST_MAX_PAGES) {
+    *freelist_page(head, num_pages) = page_num;
+    *freelist_num_pages(head) = num_pages + 1;
+    return;
+  }
+
+  // Head is full: move its list into the freed page and chain to it
+  memcpy(get_page(pager, page_num), head, PAGE_SIZE);
+  initialize_freelist_page(head);
+  *freelist_next_trunk(head) = page_num;
+}
+
+/*
+Free every page of a tree. Children are released before
+their parent, whose page may be reused as a free list trunk.
+*/
+void pager_free_tree(Pager* pager, uint32_t page_num) {
+  void* node = get_page(pager, page_num);
+  if (get_node_type(node) == NODE_INTERNAL) {
+    uint32_t num_keys = *internal_node_num_keys(node);
+    for (uint32_t i = 0; i <= num_keys; i++) {
+      pager_free_tree(pager, *internal_node_child(node, i));
+    }
+  }
+  pager_free_page(pager, page_num);
+}
+
+uint32_t pager_num_tree_pages(Pager* pager, uint32_t page_num) {
+  void* node = get_page(pager, page_num);
+  uint32_t count = 1;
+  if (get_node_type(node) == NODE_INTERNAL) {
+    uint32_t num_keys = *internal_node_num_keys(node);
+    for (uint32_t i = 0; i <= num_keys; i++) {
+      count += pager_num_tree_pages(pager, *internal_node_child(node, i));
+    }
+  }
+  return count;
+}
+
+/*
+Reuse a page from the free list if there is one, then the pages
+of a dropped partition, otherwise extend the database file by one page.
+The caller must initialize the returned page.
+*/
+uint32_t get_unused_page_num(Pager* pager) {
+  void* head = freelist_head(pager);
+  uint32_t num_pages = *freelist_num_pages(head);
+  if (num_pages > 0) {
+    *freelist_num_pages(head) = num_pages - 1;
+    return *freelist_page(head, num_pages - 1);
+  }
+
+  uint32_t trunk_page_num = *freelist_next_trunk(head);
+  if (trunk_page_num != 0) {
+    // Head is empty: take over the next trunk's list and reuse the trunk
+    memcpy(head, get_page(pager, trunk_page_num), PAGE_SIZE);
+    return trunk_page_num;
+  }
+
+  void* directory = partition_directory(pager);
+  uint32_t num_dropped = *partition_num_dropped(directory);
+  if (num_dropped > 0) {
+    *partition_num_dropped(directory) = num_dropped - 1;
+    pager_free_tree(pager, *partition_dropped_root(directory, num_dropped - 1));
+    return get_unused_page_num(pager);
+  }
+
+  return pager->num_pages;
+}
+
+uint32_t pager_num_free_pages(Pager* pager) {
+  uint32_t count = 0;
+  uint32_t page_num = *file_header_freelist_page(file_header(pager));
+  while (page_num != 0) {
+    void* trunk = get_page(pager, page_num);
+    count += *freelist_num_pages(trunk);
+    page_num = *freelist_next_trunk(trunk);
+    if (page_num != 0) {
+      count += 1;  // the trunk page itself
+    }
+  }
+  return count;
+}
+
+/*
+Number of pages that can still be allocated,
+either from the free list or by growing the file
+*/
+uint32_t pager_num_available_pages(Pager* pager) {
+  uint32_t count = pager_num_free_pages(pager);
+  void* directory = partition_directory(pager);
+  for (uint32_t i = 0; i < *partition_num_dropped(directory); i++) {
+    count += pager_num_tree_pages(pager, *partition_dropped_root(directory, i));
+  }
+  return count + (TABLE_MAX_PAGES - pager->num_pages);
+}
+
+/*
+Return the bucket holding value, or the empty bucket
+where it should be inserted
+*/
+uint32_t dictionary_find_bucket(Dictionary* dictionary, const char* value) {
+  uint32_t mask = dictionary->num_buckets - 1;
+  uint32_t bucket = hash_string(value) & mask;
+  while (dictionary->buckets[bucket] != 0) {
+    uint32_t code = dictionary->buckets[bucket] - 1;
+    if (strcmp(dictionary->entries[code], value) == 0) {
+      return bucket;
+    }
+    bucket = (bucket + 1) & mask;
+  }
+  return bucket;
+}
+
+void dictionary_rehash(Dictionary* dictionary, uint32_t num_buckets) {
+  free(dictionary->buckets);
+  dictionary->num_buckets = num_buckets;
+  dictionary->buckets = db_calloc(num_buckets, sizeof(uint32_t));
+  for (uint32_t code = 0; code < dictionary->num_entries; code++) {
+    uint32_t bucket =
+        dictionary_find_bucket(dictionary, dictionary->entries[code]);
+    dictionary->buckets[bucket] = code + 1;
+  }
+}
+
+uint32_t dictionary_append(Dictionary* dictionary, const char* value,
+                           uint32_t length) {
+  if (dictionary->num_entries == dictionary->capacity) {
+    dictionary->capacity *= 2;
+    dictionary->entries =
+        db_realloc(dictionary->entries, dictionary->capacity * sizeof(char*));
+  }
+  // Keep the load factor at or below one half
+  if ((dictionary->num_entries + 1) * 2 > dictionary->num_buckets) {
+    dictionary_rehash(dictionary, dictionary->num_buckets * 2);
+  }
+
+  uint32_t code = dictionary->num_entries;
+  char* entry = db_malloc(length + 1);
+  memcpy(entry, value, length);
+  entry[length] = 0;
+  dictionary->entries[code] = entry;
+  dictionary->num_entries += 1;
+
+  uint32_t bucket = dictionary_find_bucket(dictionary, entry);
+  dictionary->buckets[bucket] = code + 1;
+  return code;
+}
+
+Dictionary* dictionary_load(Pager* pager) {
+  Dictionary* dictionary = db_malloc(sizeof(Dictionary));
+  dictionary->num_entries = 0;
+  dictionary->capacity = 64;
+  dictionary->entries = db_malloc(dictionary->capacity * sizeof(char*));
+  dictionary->num_buckets = 128;
+  dictionary->buckets = db_calloc(dictionary->num_buckets, sizeof(uint32_t));
+
+  uint32_t page_num = *file_header_dictionary_page(file_header(pager));
+  while (true) {
+    void* page = get_page(pager, page_num);
+    uint8_t* entry = dictionary_entries(page);
+    uint32_t num_entries = *dictionary_num_entries(page);
+    for (uint32_t i = 0; i < num_entries; i++) {
+      uint8_t length = *entry;
+      dictionary_append(dictionary, (char*)entry + DICTIONARY_ENTRY_LENGTH_SIZE,
+                        length);
+      entry += DICTIONARY_ENTRY_LENGTH_SIZE + length;
+    }
+    dictionary->last_page_num = page_num;
+
+    uint32_t next_page_num = *dictionary_next_page(page);
+    if (next_page_num == 0) {
+      break;
+    }
+    page_num = next_page_num;
+  }
+
+  return dictionary;
+}
+
+void dictionary_free(Dictionary* dictionary) {
+  for (uint32_t code = 0; code < dictionary->num_entries; code++) {
+    free(dictionary->entries[code]);
+  }
+  free(dictionary->entries);
+  free(dictionary->buckets);
+  free(dictionary);
+}
+
+/*
+Return the code for value, or DICTIONARY_NO_CODE
+if value has never been stored
+*/
+uint32_t dictionary_lookup(Dictionary* dictionary, const char* value) {
+  uint32_t bucket = dictionary_find_bucket(dictionary, value);
+  if (dictionary->buckets[bucket] == 0) {
+    return DICTIONARY_NO_CODE;
+  }
+  return dictionary->buckets[bucket] - 1;
+}
+
+const char* dictionary_decode(Dictionary* dictionary, uint32_t code) {
+  return dictionary->entries[code];
+}
+
+/*
+Write an entry at the end of the dictionary page chain,
+starting a new page when the last one is full
+*/
+ExecuteResult dictionary_page_append(Pager* pager, uint32_t* last_page_num,
+                                     const char* value, uint32_t length) {
+  void* page = get_page(pager, *last_page_num);
+  uint32_t used_bytes = *dictionary_used_bytes(page);
+  if (used_bytes + DICTIONARY_ENTRY_LENGTH_SIZE + length >
+      DICTIONARY_SPACE_FOR_ENTRIES) {
+    uint32_t new_page_num = get_unused_page_num(pager);
+    if (new_page_num >= TABLE_MAX_PAGES) {
+      return EXECUTE_TABLE_FULL;
+    }
+    void* new_page = get_page(pager, new_page_num);
+    initialize_dictionary_page(new_page);
+    *dictionary_next_page(page) = new_page_num;
+    *last_page_num = new_page_num;
+    page = new_page;
+    used_bytes = 0;
+  }
+
+  uint8_t* entry = dictionary_entries(page) + used_bytes;
+  *entry = length;
+  memcpy(entry + DICTIONARY_ENTRY_LENGTH_SIZE, value, length);
+  *dictionary_used_bytes(page) += DICTIONARY_ENTRY_LENGTH_SIZE + length;
+  *dictionary_num_entries(page) += 1;
+  return EXECUTE_SUCCESS;
+}
+
+/*
+Return the code for value, adding it to the dictionary
+(in memory and on disk) if it is new
+*/
+ExecuteResult dictionary_encode(Table* table, const char* value,
+                                uint32_t* code) {
+  Dictionary* dictionary = table->dictionary;
+  *code = dictionary_lookup(dictionary, value);
+  if (*code != DICTIONARY_NO_CODE) {
+    return EXECUTE_SUCCESS;
+  }
+
+  uint32_t length = strlen(value);
+  ExecuteResult result = dictionary_page_append(
+      table->pager, &(dictionary->last_page_num), value, length);
+  if (result != EXECUTE_SUCCESS) {
+    return result;
+  }
+
+  *code = dictionary_append(dictionary, value, length);
+  return EXECUTE_SUCCESS;
+}
+
+void decode_row(Dictionary* dictionary, Row* row) {
+  strcpy(row->title, dictionary_decode(dictionary, row->title_code));
+  strcpy(row->provider, dictionary_decode(dictionary, row->provider_code));
+}
+
+/*
+Check the header of an existing file and return its page size. The
+header fits in the smallest page, so that much is read from the start;
+its checksum is verified once the page size is known.
+*/
+uint32_t read_page_size(int fd) {
+  void* header = NULL;
+  if (posix_memalign(&header, MIN_PAGE_SIZE, MIN_PAGE_SIZE) != 0) {
+    printf("Unable to allocate header buffer\n");
+    exit(EXIT_FAILURE);
+  }
+  ssize_t bytes_read = pread(fd, header, MIN_PAGE_SIZE, 0);
+  if (bytes_read != MIN_PAGE_SIZE || get_node_type(header) != NODE_FILE_HEADER ||
+      memcmp(file_header_magic(header), FILE_HEADER_MAGIC,
+             FILE_HEADER_MAGIC_SIZE) != 0 ||
+      !is_valid_page_size(*file_header_page_size(header))) {
+    printf("Db file has no valid header. Corrupt file.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (*file_header_version(header) != FILE_FORMAT_VERSION) {
+    printf("Unsupported db file format version %d.\n",
+           *file_header_version(header));
+    exit(EXIT_FAILURE);
+  }
+  uint32_t page_size = *file_header_page_size(header);
+  free(header);
+  return page_size;
+}
+
+/*
+ * Several processes can use one database file. Without --shared a
+ * process write-locks the whole file for as long as it has it open, so a
+ * second process is turned away instead of corrupting it. With --shared
+ * each statement locks the file only while it runs: queries take a read
+ * lock, so any number of them run at once, and everything else a write
+ * lock, which waits for the readers to finish and keeps them out until
+ * it is done. A writer writes its changed pages back and bumps the
+ * change counter in the file header before unlocking; a process that
+ * finds the counter changed when its next statement starts drops its
+ * cached pages and reloads the dictionary and catalog. Unchanged, the
+ * pages it has cached stay valid, so hot pages are not read again.
+ */
+bool shared_access = false;
+const uint32_t LOCK_TIMEOUT_MILLISECONDS = 5000;
+
+/*
+Lock the whole file with an fcntl lock of the given type, trying again
+every millisecond while another process holds a conflicting one
+*/
+bool pager_lock(int fd, short type, uint32_t timeout_milliseconds) {
+  struct flock lock;
+  memset(&lock, 0, sizeof(lock));
+  lock.l_type = type;
+  lock.l_whence = SEEK_SET;  // l_start and l_len 0: the whole file
+  for (uint32_t waited = 0;; waited++) {
+    if (fcntl(fd, F_SETLK, &lock) == 0) {
+      return true;
+    }
+    if ((errno != EACCES && errno != EAGAIN) ||
+        waited >= timeout_milliseconds) {
+      return false;
+    }
+    usleep(1000);
+  }
+}
+
+uint32_t pager_read_change_counter(Pager* pager) {
+  // The header fields sit within the smallest page size
+  ssize_t bytes_read =
+      pread(pager->file_descriptor, pager->header_buffer, MIN_PAGE_SIZE, 0);
+  if (bytes_read != MIN_PAGE_SIZE) {
+    printf("Error reading file: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  return *file_header_change_counter(pager->header_buffer);
+}
+
+int pager_open_file(const char* filename, bool direct) {
+  int flags = O_RDWR |  // Read/Write mode
+              O_CREAT;  // Create file if it does not exist
+#ifdef O_DIRECT
+  if (direct) {
+    flags |= O_DIRECT;  // Transfer straight between frames and the device
+  }
+#endif
+  int fd = open(filename, flags,
+                S_IWUSR |     // User write permission
+                    S_IRUSR   // User read permission
+                );
+#ifdef O_DIRECT
+  if (fd == -1 && direct && errno == EINVAL) {
+    // The file system (e.g. tmpfs) has no direct I/O, use the page cache
+    fd = open(filename, flags & ~O_DIRECT, S_IWUSR | S_IRUSR);
+  }
+#endif
+#ifdef F_NOCACHE
+  if (fd != -1 && direct) {
+    fcntl(fd, F_NOCACHE, 1);  // macOS has no O_DIRECT, only this
+  }
+#endif
+
+  if (fd == -1) {
+    printf("Unable to open file\n");
+    exit(EXIT_FAILURE);
+  }
+  return fd;
+}
+
+/*
+True if filename no longer names the file open on fd: vacuum in another
+process renamed a new file over it while this one waited for its lock.
+*/
+bool pager_file_replaced(int fd, const char* filename) {
+  struct stat open_file;
+  struct stat named_file;
+  if (fstat(fd, &open_file) == -1 || stat(filename, &named_file) == -1) {
+    return false;
+  }
+  return open_file.st_dev != named_file.st_dev ||
+         open_file.st_ino != named_file.st_ino;
+}
+
+/*
+Open the database file. page_size is only used when the
+file is new; an existing file keeps the size it was created with.
+*/
+Pager* pager_open(const char* filename, bool direct, uint32_t page_size) {
+  int fd = pager_open_file(filename, direct);
+  // Lock before looking at the file, another process may be creating it
+  while (true) {
+    if (!pager_lock(fd, F_WRLCK,
+                    shared_access ? LOCK_TIMEOUT_MILLISECONDS : 0)) {
+      printf("Database is locked by another process.\n");
+      exit(EXIT_FAILURE);
+    }
+    if (!pager_file_replaced(fd, filename)) {
+      break;
+    }
+    close(fd);
+    fd = pager_open_file(filename, direct);
+  }
+
+  off_t file_length = lseek(fd, 0, SEEK_END);
+  if (file_length > 0) {
+    page_size = read_page_size(fd);
+  }
+  set_page_size(page_size);
+
+  Pager* pager = db_malloc(sizeof(Pager));
+  pager->filename = filename;
+  pager->direct = direct;
+  pager->file_descriptor = fd;
+  pager->file_length = file_length;
+  pager->num_pages = (file_length / PAGE_SIZE);
+
+  if (file_length % PAGE_SIZE != 0) {
+    printf("Db file is not a whole number of pages. Corrupt file.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
+    pager->pages[i] = NULL;
+    pager->last_access[i] = 0;
+    pager->previous_access[i] = 0;
+    pager->scanned[i] = 0;
+  }
+  pager->statement_clock = 1;
+  pager->lock = F_WRLCK;
+  if (posix_memalign(&(pager->header_buffer), MIN_PAGE_SIZE, MIN_PAGE_SIZE) !=
+      0) {
+    printf("Unable to allocate header buffer\n");
+    exit(EXIT_FAILURE);
+  }
+  pager->change_counter =
+      file_length > 0 ? pager_read_change_counter(pager) : 0;
+  frame_arena_init(pager);
+  prefetcher_start(pager);
+
+  return pager;
+}
+
+/*
+Lay out a new database file: page 0 is the file header, page 1 the
+(empty) root leaf, page 2 the first dictionary page, page 3 the (empty)
+free list, page 4 the (empty) partition directory and page 5 the
+(empty) catalog.
+*/
+void initialize_database(Pager* pager) {
+  void* header = get_page(pager, FILE_HEADER_PAGE_NUM);
+  memset(header, 0, PAGE_SIZE);
+  set_node_type(header, NODE_FILE_HEADER);
+  memcpy(file_header_magic(header), FILE_HEADER_MAGIC, FILE_HEADER_MAGIC_SIZE);
+  *file_header_version(header) = FILE_FORMAT_VERSION;
+  *file_header_page_size(header) = PAGE_SIZE;
+  *file_header_root_page(header) = TABLE_ROOT_PAGE_NUM;
+  *file_header_dictionary_page(header) = DICTIONARY_PAGE_NUM;
+  *file_header_freelist_page(header) = FREELIST_PAGE_NUM;
+  *file_header_directory_page(header) = PARTITION_DIRECTORY_PAGE_NUM;
+  *file_header_num_rows(header) = 0;
+  *file_header_catalog_page(header) = CATALOG_PAGE_NUM;
+  void* root_node = get_page(pager, TABLE_ROOT_PAGE_NUM);
+  initialize_leaf_node(root_node, LEAF_NODE_KEY_SIZE, LEAF_NODE_VALUE_SIZE);
+  set_node_root(root_node, true);
+  void* dictionary_page = get_page(pager, DICTIONARY_PAGE_NUM);
+  initialize_dictionary_page(dictionary_page);
+  void* freelist_page = get_page(pager, FREELIST_PAGE_NUM);
+  initialize_freelist_page(freelist_page);
+  void* directory = partition_directory(pager);
+  initialize_partition_directory_page(directory);
+  initialize_catalog_page(catalog(pager));
+}
+
+Table* db_open(const char* filename, bool direct, uint32_t page_size) {
+  Pager* pager = pager_open(filename, direct, page_size);
+
+  Table* table = db_malloc(sizeof(Table));
+  table->pager = pager;
+  if (pager->num_pages == 0) {
+    initialize_database(pager);
+  }
+  table->root_page_num = *file_header_root_page(file_header(pager));
+
+  table->dictionary = dictionary_load(pager);
+
+  table->codecs = db_calloc(CATALOG_MAX_TABLES, sizeof(RowCodec));
+  if (hash_index_capacity > 0) {
+    hash_index = db_calloc(hash_index_capacity, sizeof(HashIndexEntry));
+  }
+  void* catalog_page = catalog(pager);
+  for (uint32_t i = 0; i < *catalog_num_tables(catalog_page); i++) {
+    row_codec_build(catalog_page, i, &(table->codecs[i]));
+  }
+  bloom_filter_open(table);
+  if (shared_access) {
+    // pager_open locked the file for setting it up; from here on it is
+    // only locked for statements
+    db_end_statement(table);
+  }
+
+  return table;
+}
+
+void pager_flush(Pager* pager, uint32_t page_num) {
+  if (pager->pages[page_num] == NULL) {
+    printf("Tried to flush null page\n");
+    exit(EXIT_FAILURE);
+  }
+
+  void* page = pager->pages[page_num];
+  *page_checksum(page) = crc32c(page, PAGE_USABLE_SIZE);
+  ssize_t bytes_written =
+      pwrite(pager->file_descriptor, page, PAGE_SIZE,
+             (off_t)page_num * PAGE_SIZE);
+
+  if (bytes_written == -1) {
+    printf("Error writing: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  metrics_add(METRIC_PAGES_WRITTEN, 1);
+  metrics_add(METRIC_BYTES_WRITTEN, bytes_written);
+}
+
+uint32_t cache_capacity = TABLE_MAX_PAGES;  // pages kept between statements
+
+/*
+Whether page a should be dropped before page b: internal nodes, which
+every lookup below them needs, go last. Then, as in LRU-2, the page whose
+second to last use is older goes first, so pages used by only one
+statement (like the leaves a report scanned) go before pages that keep
+being used. Ties go to the least recently used.
+*/
+bool pager_evicts_before(Pager* pager, uint32_t a, uint32_t b) {
+  bool a_internal = get_node_type(pager->pages[a]) == NODE_INTERNAL;
+  bool b_internal = get_node_type(pager->pages[b]) == NODE_INTERNAL;
+  if (a_internal != b_internal) {
+    return b_internal;
+  }
+  if (pager->previous_access[a] != pager->previous_access[b]) {
+    return pager->previous_access[a] < pager->previous_access[b];
+  }
+  return pager->last_access[a] < pager->last_access[b];
+}
+
+/*
+Whether a cached page has to be written back: its checksum shows it
+changed since it was read or last written, or it is past the end of the
+file, which must not be left with holes
+*/
+bool pager_page_changed(Pager* pager, uint32_t page_num) {
+  void* page = pager->pages[page_num];
+  return page_num >= pager->file_length / PAGE_SIZE ||
+         crc32c(page, PAGE_USABLE_SIZE) != *page_checksum(page);
+}
+
+void pager_write_back(Pager* pager, uint32_t page_num) {
+  pager_flush(pager, page_num);
+  if (pager->file_length < (page_num + 1) * PAGE_SIZE) {
+    pager->file_length = (page_num + 1) * PAGE_SIZE;
+  }
+}
+
+/*
+Drop a page from the cache, writing it back first if it changed
+*/
+void pager_evict(Pager* pager, uint32_t page_num) {
+  void* page = pager->pages[page_num];
+  if (pager_page_changed(pager, page_num)) {
+    pager_write_back(pager, page_num);
+  }
+  pager->pages[page_num] = NULL;
+  pager_release_frame(pager, page);
+  metrics_add(METRIC_CACHE_EVICTIONS, 1);
+}
+
+/*
+Shrink the cache back to cache_capacity pages. Nodes are used through
+plain pointers while a statement runs, so pages are only dropped once it
+is done; within a statement the cache may grow past the capacity.
+*/
+void pager_end_statement(Pager* pager) {
+  backup_run(pager, BACKUP_PAGES_PER_STATEMENT);
+  uint32_t num_cached = 0;
+  for (uint32_t i = 0; i < pager->num_pages; i++) {
+    if (pager->pages[i] != NULL) {
+      num_cached++;
+    }
+  }
+  while (num_cached > cache_capacity) {
+    uint32_t victim = pager->num_pages;
+    for (uint32_t i = 0; i < pager->num_pages; i++) {
+      if (pager->pages[i] != NULL &&
+          (victim == pager->num_pages || pager_evicts_before(pager, i, victim))) {
+        victim = i;
+      }
+    }
+    pager_evict(pager, victim);
+    num_cached--;
+  }
+  pager->statement_clock += 1;
+}
+
+/*
+Write back every changed page, counting the change in the file header
+so other --shared processes know to drop their copies
+*/
+void pager_commit(Pager* pager) {
+  bool changed = false;
+  for (uint32_t i = 0; i < pager->num_pages && !changed; i++) {
+    changed = pager->pages[i] != NULL && pager_page_changed(pager, i);
+  }
+  if (!changed) {
+    return;
+  }
+  void* header = file_header(pager);
+  *file_header_change_counter(header) += 1;
+  pager->change_counter = *file_header_change_counter(header);
+  for (uint32_t i = 0; i < pager->num_pages; i++) {
+    if (pager->pages[i] != NULL && pager_page_changed(pager, i)) {
+      pager_write_back(pager, i);
+    }
+  }
+}
+
+/*
+Forget every cached and prefetched page, which another process may have
+changed. None of them are changed here; a writer commits before it
+unlocks.
+*/
+void pager_drop_cache(Pager* pager) {
+  for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
+    if (pager->pages[i] != NULL) {
+      pager_release_frame(pager, pager->pages[i]);
+      pager->pages[i] = NULL;
+    }
+    pthread_mutex_lock(&(pager->prefetcher.lock));
+    bool prefetching = pager->prefetcher.states[i] != PREFETCH_NONE;
+    pthread_mutex_unlock(&(pager->prefetcher.lock));
+    if (prefetching) {
+      bool prefetched;
+      pager_release_frame(pager, pager_take_frame(pager, i, &prefetched));
+    }
+  }
+  pager->file_length = lseek(pager->file_descriptor, 0, SEEK_END);
+  pager->num_pages = pager->file_length / PAGE_SIZE;
+  metrics_add(METRIC_CACHE_RELOADS, 1);
+}
+
+/*
+Start a backup of the database to path, which the next statements carry
+on with. An earlier backup at path is updated in place.
+*/
+void db_backup(Table* table, const char* path) {
+  Pager* pager = table->pager;
+  if (backup.pager != NULL) {
+    printf("A backup to %s is already running.\n", backup.path);
+    return;
+  }
+  lsm_settle(table);
+  // Compared by inode, since another path (./, a symlink) can name the
+  // database too. Closing a second descriptor on it would drop this
+  // process's lock, so it is checked before opening one.
+  struct stat database;
+  struct stat target;
+  if (fstat(pager->file_descriptor, &database) == -1) {
+    printf("Error reading file: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  if (stat(path, &target) == 0 && target.st_dev == database.st_dev &&
+      target.st_ino == database.st_ino) {
+    printf("Cannot back up the database onto itself.\n");
+    return;
+  }
+  int fd = open(path, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+  if (fd == -1) {
+    printf("Unable to open backup file %s.\n", path);
+    return;
+  }
+  if (fstat(fd, &target) == 0 && target.st_dev == database.st_dev &&
+      target.st_ino == database.st_ino) {
+    // The path was pointed at the database after the check; take the
+    // lock the close drops again
+    close(fd);
+    if (pager->lock != F_UNLCK) {
+      pager_lock(pager->file_descriptor, pager->lock,
+                 LOCK_TIMEOUT_MILLISECONDS);
+    }
+    printf("Cannot back up the database onto itself.\n");
+    return;
+  }
+  void* buffer = NULL;
+  if (posix_memalign(&buffer, PAGE_SIZE, PAGE_SIZE) != 0) {
+    printf("Unable to allocate backup buffer\n");
+    exit(EXIT_FAILURE);
+  }
+
+  free(backup.path);
+  backup.path = db_malloc(strlen(path) + 1);
+  strcpy(backup.path, path);
+  backup.pager = pager;
+  backup.file_descriptor = fd;
+  backup.num_pages = pager->num_pages;
+  backup.next_page = 0;
+  backup.num_copied = 0;
+  backup.num_written = 0;
+  backup.num_unchanged = 0;
+  memset(backup.copied, 0, sizeof(backup.copied));
+  backup.buffer = buffer;
+  if (shared_access) {
+    // Other processes would not copy a page before changing it, so the
+    // whole copy is made while this process holds the file
+    backup_run(pager, TABLE_MAX_PAGES);
+  }
+}
+
+void print_backup_status() {
+  if (backup.path == NULL) {
+    printf("No backup has been run.\n");
+  } else if (backup.pager != NULL) {
+    printf("Backup to %s: %d of %d pages copied, %d written, %d unchanged.\n",
+           backup.path, backup.num_copied, backup.num_pages,
+           backup.num_written, backup.num_unchanged);
+  } else {
+    printf("Backup to %s finished: %d pages, %d written, %d unchanged.\n",
+           backup.path, backup.num_pages, backup.num_written,
+           backup.num_unchanged);
+  }
+}
+
+/*
+Write every changed page back and make the file durable, keeping the
+pages cached
+*/
+void pager_sync(Pager* pager) {
+  for (uint32_t i = 0; i < pager->num_pages; i++) {
+    if (pager->pages[i] != NULL && pager_page_changed(pager, i)) {
+      pager_write_back(pager, i);
+    }
+  }
+  if (fsync(pager->file_descriptor) == -1) {
+    printf("Error syncing db file: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  metrics_add(METRIC_FSYNCS, 1);
+}
+
+/*
+Write every cached page back (unless the file is being
+thrown away) and release the pager
+*/
+void pager_close(Pager* pager, bool flush) {
+  prefetcher_stop(pager);
+  if (flush) {
+    pager_sync(pager);
+  }
+  for (uint32_t i = 0; i < pager->num_pages; i++) {
+    pager->pages[i] = NULL;
+  }
+
+  int result = close(pager->file_descriptor);
+  if (result == -1) {
+    printf("Error closing db file.\n");
+    exit(EXIT_FAILURE);
+  }
+  munmap(pager->frame_arena, (size_t)TABLE_MAX_PAGES * PAGE_SIZE);
+  free(pager->header_buffer);
+  free(pager);
+}
+
+void db_close(Table* table) {
+  lsm_settle(table);
+  backup_run(table->pager, TABLE_MAX_PAGES);
+  pager_close(table->pager, true);
+  dictionary_free(table->dictionary);
+  free(table->codecs);
+}
+
+/*
+Link the nodes of one tree level under new internal nodes and
+return the number of parents. The single node of the top level
+is written to root_page_num so the root stays where the table
+(or partition directory) expects it.
+*/
+uint32_t vacuum_build_level(Pager* pager, uint32_t root_page_num,
+                            uint32_t* level, uint32_t level_size) {
+  uint32_t fanout = INTERNAL_NODE_MAX_KEYS + 1;
+  bool is_top = level_size <= fanout;
+  uint32_t num_parents = 0;
+
+  for (uint32_t first = 0; first < level_size; first += fanout) {
+    uint32_t last = first + fanout;
+    if (last > level_size) {
+      last = level_size;
+    }
+
+    uint32_t node_page_num = is_top ? root_page_num : pager->num_pages;
+    void* node = get_page(pager, node_page_num);
+    initialize_internal_node(node);
+    *internal_node_num_keys(node) = last - first - 1;
+    for (uint32_t i = first; i < last; i++) {
+      void* child = get_page(pager, level[i]);
+      *node_parent(child) = node_page_num;
+      *internal_node_child(node, i - first) = level[i];
+      if (i < last - 1) {
+        copy_key(internal_node_key(node, i - first),
+                 get_node_max_key(pager, child));
+      }
+    }
+
+    // Children have all been read, so the parent can overwrite the slot
+    level[num_parents++] = node_page_num;
+  }
+
+  return num_parents;
+}
+
+/*
+Stream the rows of one tree in key order into completely full leaves on
+consecutive pages of the new file and build the internal levels on top,
+ending at root_page_num
+*/
+void vacuum_copy_tree(Table* table, uint32_t old_root_page_num,
+                      Pager* pager, uint32_t root_page_num) {
+  Pager* old_pager = table->pager;
+  Cursor cursor;
+  table_start(table, old_root_page_num, &cursor);
+  void* first_leaf = get_page(old_pager, cursor.page_num);
+  uint32_t key_size = *leaf_node_key_size(first_leaf);
+  uint32_t value_size = *leaf_node_value_size(first_leaf);
+  void* root = get_page(pager, root_page_num);
+  initialize_leaf_node(root, key_size, value_size);
+
+  uint32_t* level = db_malloc(TABLE_MAX_PAGES * sizeof(uint32_t));
+  uint32_t level_size = 0;
+  void* leaf = NULL;
+  while (!(cursor.end_of_table)) {
+    if (leaf == NULL ||
+        *leaf_node_num_cells(leaf) == leaf_node_max_cells(leaf)) {
+      uint32_t leaf_page_num = pager->num_pages;
+      void* next_leaf = get_page(pager, leaf_page_num);
+      initialize_leaf_node(next_leaf, key_size, value_size);
+      if (leaf != NULL) {
+        *leaf_node_next_leaf(leaf) = leaf_page_num;
+      }
+      leaf = next_leaf;
+      level[level_size++] = leaf_page_num;
+    }
+
+    void* old_leaf = get_page(old_pager, cursor.page_num);
+    uint32_t cell_num = (*leaf_node_num_cells(leaf))++;
+    memcpy(leaf_node_cell(leaf, cell_num),
+           leaf_node_cell(old_leaf, cursor.cell_num), leaf_node_cell_size(leaf));
+    cursor_advance(&cursor);
+  }
+  for (uint32_t i = 0; i < level_size; i++) {
+    leaf_node_update_heads(get_page(pager, level[i]));
+  }
+
+  if (level_size == 1) {
+    // A single leaf is the root. It is the last page, so just move it.
+    uint32_t leaf_page_num = level[0];
+    memcpy(root, get_page(pager, leaf_page_num), PAGE_SIZE);
+    pager_release_frame(pager, pager->pages[leaf_page_num]);
+    pager->pages[leaf_page_num] = NULL;
+    pager->num_pages = leaf_page_num;
+  }
+  while (level_size > 1) {
+    level_size = vacuum_build_level(pager, root_page_num, level, level_size);
+  }
+  free(level);
+  set_node_root(root, true);
+}
+
+/*
+Rewrite the database into a new file: the dictionary is copied in code
+order (so rows keep their codes), then each tree is rebuilt from full
+leaves on consecutive pages, partitions and created tables right after
+their root. The new file then replaces the old one without closing the
+table, dropping every free page and dropped partition and restoring
+sequential leaf order.
+*/
+void db_vacuum(Table* table) {
+  if (shared_access) {
+    // Other processes would go on using the file vacuum replaces
+    printf("Vacuum needs the database to itself; open it without --shared.\n");
+    return;
+  }
+  lsm_settle(table);
+  hash_index_forget();
+  Pager* old_pager = table->pager;
+  // The backup is of the file vacuum is about to replace
+  backup_run(old_pager, TABLE_MAX_PAGES);
+  const char* filename = old_pager->filename;
+  uint32_t old_num_pages = old_pager->num_pages;
+  bool direct = old_pager->direct;
+
+  char vacuum_filename[strlen(filename) + sizeof("-vacuum")];
+  sprintf(vacuum_filename, "%s-vacuum", filename);
+  unlink(vacuum_filename);
+  Pager* pager = pager_open(vacuum_filename, direct, PAGE_SIZE);
+  initialize_database(pager);
+  void* directory = partition_directory(pager);
+
+  Dictionary* dictionary = table->dictionary;
+  uint32_t dictionary_page_num = DICTIONARY_PAGE_NUM;
+  for (uint32_t code = 0; code < dictionary->num_entries; code++) {
+    char* entry = dictionary->entries[code];
+    dictionary_page_append(pager, &dictionary_page_num, entry, strlen(entry));
+  }
+
+  *file_header_num_rows(file_header(pager)) =
+      *file_header_num_rows(file_header(old_pager));
+
+  void* old_directory = partition_directory(old_pager);
+  if (*partition_is_partitioned(old_directory)) {
+    uint32_t num_partitions = *partition_num_partitions(old_directory);
+    *partition_is_partitioned(directory) = 1;
+    *partition_num_partitions(directory) = num_partitions;
+    for (uint32_t i = 0; i < num_partitions; i++) {
+      uint32_t root_page_num = pager->num_pages;
+      memcpy(partition_name(directory, i), partition_name(old_directory, i),
+             PARTITION_NAME_SIZE);
+      *partition_root(directory, i) = root_page_num;
+      *partition_num_rows(directory, i) = *partition_num_rows(old_directory, i);
+      vacuum_copy_tree(table, *partition_root(old_directory, i), pager,
+                       root_page_num);
+    }
+  } else {
+    vacuum_copy_tree(table, table->root_page_num, pager, TABLE_ROOT_PAGE_NUM);
+  }
+
+  void* old_catalog = catalog(old_pager);
+  void* new_catalog = catalog(pager);
+  uint32_t num_tables = *catalog_num_tables(old_catalog);
+  *catalog_num_tables(new_catalog) = num_tables;
+  for (uint32_t i = 0; i < num_tables; i++) {
+    uint32_t root_page_num = pager->num_pages;
+    memcpy(catalog_table(new_catalog, i), catalog_table(old_catalog, i),
+           CATALOG_TABLE_SIZE);
+    *catalog_table_root(new_catalog, i) = root_page_num;
+    vacuum_copy_tree(table, *catalog_table_root(old_catalog, i), pager,
+                     root_page_num);
+  }
+
+  uint32_t statistics_page_num =
+      *file_header_statistics_page(file_header(old_pager));
+  if (statistics_page_num != 0) {
+    uint32_t page_num = pager->num_pages;
+    memcpy(get_page(pager, page_num), get_page(old_pager, statistics_page_num),
+           PAGE_USABLE_SIZE);
+    *file_header_statistics_page(file_header(pager)) = page_num;
+  }
+
+  // The filter is built again so deleted keys drop out of it
+  uint32_t bits_per_key = 0;
+  uint32_t bloom_filter_page_num =
+      *file_header_bloom_filter_page(file_header(old_pager));
+  if (bloom_filter_page_num != 0) {
+    bits_per_key =
+        *bloom_filter_bits_per_key(get_page(old_pager, bloom_filter_page_num));
+  }
+
+  // The new file stays open, and locked, from before it is renamed over
+  // the old one until it is closed, and the old one is only unlocked once
+  // the rename is done, so another process can never lock either file
+  // while it is not the database. (Reopening it would not do: closing
+  // any descriptor of a file drops all of this process's locks on it.)
+  pager_sync(pager);
+  if (rename(vacuum_filename, filename) == -1) {
+    printf("Error replacing db file: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  pager_close(old_pager, false);
+  pager->filename = filename;
+  table->pager = pager;
+  dictionary_free(table->dictionary);
+  table->dictionary = dictionary_load(table->pager);
+  if (bits_per_key > 0) {
+    bloom_filter_build(table, bits_per_key);
+  }
+
+  printf("Vacuumed %d pages into %d pages.\n", old_num_pages,
+         table->pager->num_pages);
+}
+
+const char* column_name(Column column) {
+  static const char* names[] = {"stb",  "title", "provider", "date",
+                                "rev",  "time",  "key"};
+  return names[column];
+}
+
+/*
+Write a viewing table value the way the statistics page stores it
+*/
+void statistics_encode(Column column, const char* text, float rev,
+                       char* value) {
+  if (column == COLUMN_REV) {
+    uint32_t bits;
+    memcpy(&bits, &rev, sizeof(bits));
+    sprintf(value, "%08x", order_float_bits(bits));
+  } else {
+    // Cut on purpose; see the statistics page layout
+    snprintf(value, STATISTICS_VALUE_SIZE, "%.*s",
+             (int)STATISTICS_VALUE_SIZE - 1, text);
+  }
+}
+
+void statistics_format(Column column, char* value, char* text) {
+  if (column != COLUMN_REV) {
+    strcpy(text, value);
+    return;
+  }
+  uint32_t bits = strtoul(value, NULL, 16);
+  bits = (bits & 0x80000000u) ? bits & 0x7fffffffu : ~bits;
+  float rev;
+  memcpy(&rev, &bits, sizeof(rev));
+  sprintf(text, "%f", rev);
+}
+
+/*
+Describe the file from its header and directory alone, without
+reading any of the table's pages
+*/
+void print_dbinfo(Table* table) {
+  Pager* pager = table->pager;
+  void* header = file_header(pager);
+  printf("Format version: %d\n", *file_header_version(header));
+  printf("Page size: %d\n", *file_header_page_size(header));
+  printf("Pages: %d\n", pager->num_pages);
+  printf("Size: %llu bytes\n",
+         (unsigned long long)pager->num_pages * PAGE_SIZE);
+  printf("Rows: %d\n", *file_header_num_rows(header));
+
+  void* directory = partition_directory(pager);
+  if (*partition_is_partitioned(directory)) {
+    for (uint32_t i = 0; i < *partition_num_partitions(directory); i++) {
+      printf("Partition %s: %d rows\n", partition_name(directory, i),
+             *partition_num_rows(directory, i));
+    }
+  }
+
+  void* catalog_page = catalog(pager);
+  for (uint32_t i = 0; i < *catalog_num_tables(catalog_page); i++) {
+    printf("Table %s: %d rows\n", catalog_table_name(catalog_page, i),
+           *catalog_table_num_rows(catalog_page, i));
+  }
+
+  uint32_t bloom_filter_page_num = *file_header_bloom_filter_page(header);
+  if (bloom_filter_page_num != 0) {
+    // A lookup of a missing key gets through when all of its bits are set
+    void* filter = get_page(pager, bloom_filter_page_num);
+    uint32_t num_bits = *bloom_filter_num_bits(filter);
+    uint32_t num_set = 0;
+    for (uint32_t i = 0; i < (num_bits + 7) / 8; i++) {
+      num_set += __builtin_popcount(bloom_filter_bits(filter)[i]);
+    }
+    double false_positive_rate = 1;
+    for (uint32_t i = 0; i < *bloom_filter_num_hashes(filter); i++) {
+      false_positive_rate *= (double)num_set / num_bits;
+    }
+    printf("Bloom filter: %d bits per key, %d hashes, %d bytes for %d keys, "
+           "%.2f%% false positives\n",
+           *bloom_filter_bits_per_key(filter), *bloom_filter_num_hashes(filter),
+           (num_bits + 7) / 8, *bloom_filter_num_keys(filter),
+           100 * false_positive_rate);
+  }
+
+  uint32_t statistics_page_num = *file_header_statistics_page(header);
+  if (statistics_page_num == 0) {
+    return;
+  }
+  void* statistics = get_page(pager, statistics_page_num);
+  printf("Statistics: %d of %d rows sampled, %d changed since\n",
+         *statistics_num_sampled(statistics),
+         *statistics_analyzed_rows(statistics),
+         *statistics_num_modified(statistics));
+  char min[VALUE_TEXT_SIZE];
+  char max[VALUE_TEXT_SIZE];
+  for (Column column = 0; column < STATISTICS_NUM_COLUMNS; column++) {
+    statistics_format(column, statistics_min(statistics, column), min);
+    statistics_format(column, statistics_max(statistics, column), max);
+    printf("Column %s: %d distinct, %s to %s\n", column_name(column),
+           *statistics_num_distinct(statistics, column), min, max);
+  }
+}
+
+PrepareResult prepare_insert(InputBuffer* input_buffer, Statement* statement) {
+    statement->type = STATEMENT_INSERT;
+    strtok(input_buffer->buffer, " ");  // the insert keyword
+    char* stb = strtok(NULL, " ");
+    char* title = strtok(NULL, " ");
+    char* provider = strtok(NULL, " ");
+    char* date = strtok(NULL, " ");
+    char* rev_string = strtok(NULL, " ");
+    char* time = strtok(NULL, " ");
+
+    if (stb == NULL || title == NULL || provider == NULL || date == NULL ||
+            rev_string == NULL || time == NULL) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    float rev = atof(rev_string);
+    if (rev < 0) {
+        return PREPARE_NEGATIVE_REV;
+    }
+    if (
+            strlen(stb) > COLUMN_STB_SIZE ||
+            strlen(title) > COLUMN_TITLE_SIZE ||
+            strlen(provider) > COLUMN_PROVIDER_SIZE ||
+            strlen(date) > COLUMN_DATE_SIZE ||
+            strlen(time) > COLUMN_TIME_SIZE
+       ) {
+        return PREPARE_STRING_TO_LONG;
+    }
+
+    strcpy(statement->row_to_insert.stb, stb);
+    strcpy(statement->row_to_insert.title, title);
+    strcpy(statement->row_to_insert.provider, provider);
+    strcpy(statement->row_to_insert.date, date);
+    statement->row_to_insert.rev = rev;
+    strcpy(statement->row_to_insert.time, time);
+
+    return PREPARE_SUCCESS;
+}
+
+bool parse_column(const char* name, Column* column) {
+  if (strcmp(name, "stb") == 0) {
+    *column = COLUMN_STB;
+  } else if (strcmp(name, "title") == 0) {
+    *column = COLUMN_TITLE;
+  } else if (strcmp(name, "provider") == 0) {
+    *column = COLUMN_PROVIDER;
+  } else if (strcmp(name, "date") == 0) {
+    *column = COLUMN_DATE;
+  } else if (strcmp(name, "rev") == 0) {
+    *column = COLUMN_REV;
+  } else if (strcmp(name, "time") == 0) {
+    *column = COLUMN_TIME;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool parse_compare_op(const char* token, CompareOp* op) {
+  if (strcmp(token, "=") == 0) {
+    *op = COMPARE_EQUAL;
+  } else if (strcmp(token, "!=") == 0) {
+    *op = COMPARE_NOT_EQUAL;
+  } else if (strcmp(token, "<") == 0) {
+    *op = COMPARE_LESS;
+  } else if (strcmp(token, "<=") == 0) {
+    *op = COMPARE_LESS_EQUAL;
+  } else if (strcmp(token, ">") == 0) {
+    *op = COMPARE_GREATER;
+  } else if (strcmp(token, ">=") == 0) {
+    *op = COMPARE_GREATER_EQUAL;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/*
+Parse "<column> <op> <value>" from the remaining tokens
+*/
+PrepareResult prepare_comparison(Predicate* predicate) {
+  char* column = strtok(NULL, " ");
+  char* op = strtok(NULL, " ");
+  char* value = strtok(NULL, " ");
+  if (column == NULL || op == NULL || value == NULL) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+
+  if (strcmp(column, "key") == 0) {
+    predicate->column = COLUMN_KEY;
+  } else if (!parse_column(column, &(predicate->column))) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  if (!parse_compare_op(op, &(predicate->op))) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  if (strlen(value) > COLUMN_TITLE_SIZE) {
+    return PREPARE_STRING_TO_LONG;
+  }
+  strcpy(predicate->value, value);
+  predicate->rev = atof(value);
+
+  return PREPARE_SUCCESS;
+}
+
+/*
+Parse an optional "where <comparison> [and <comparison>]..."
+from the remaining tokens
+*/
+PrepareResult prepare_where(Statement* statement) {
+  statement->num_predicates = 0;
+  char* where = strtok(NULL, " ");
+  if (where == NULL) {
+    return PREPARE_SUCCESS;
+  }
+  if (strcmp(where, "where") != 0) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+
+  while (true) {
+    if (statement->num_predicates == MAX_PREDICATES) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    Predicate* predicate = &(statement->predicates[statement->num_predicates]);
+    PrepareResult result = prepare_comparison(predicate);
+    if (result != PREPARE_SUCCESS) {
+      return result;
+    }
+    statement->num_predicates += 1;
+
+    char* conjunction = strtok(NULL, " ");
+    if (conjunction == NULL) {
+      return PREPARE_SUCCESS;
+    }
+    if (strcmp(conjunction, "and") != 0) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+  }
+}
+
+/*
+Parse "[order by <column> [asc|desc]] [limit <n>]"
+*/
+PrepareResult prepare_order_by(Statement* statement, char* clause) {
+  char* token = strtok(clause, " ");
+  if (token != NULL && strcmp(token, "order") == 0) {
+    char* by = strtok(NULL, " ");
+    char* column = strtok(NULL, " ");
+    if (by == NULL || column == NULL || strcmp(by, "by") != 0) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    if (strcmp(column, "key") == 0) {
+      statement->order_by = COLUMN_KEY;
+    } else if (!parse_column(column, &(statement->order_by))) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    statement->has_order_by = true;
+
+    token = strtok(NULL, " ");
+    if (token != NULL &&
+        (strcmp(token, "asc") == 0 || strcmp(token, "desc") == 0)) {
+      statement->descending = strcmp(token, "desc") == 0;
+      token = strtok(NULL, " ");
+    }
+  }
+  if (token != NULL && strcmp(token, "limit") == 0) {
+    char* limit = strtok(NULL, " ");
+    if (limit == NULL || strspn(limit, "0123456789") != strlen(limit)) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    statement->has_limit = true;
+    statement->limit = strtoul(limit, NULL, 10);
+    token = strtok(NULL, " ");
+  }
+  return token == NULL ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+}
+
+/*
+select [where ...] [order by <column> [asc|desc]] [limit <n>]
+*/
+PrepareResult prepare_select(InputBuffer* input_buffer, Statement* statement) {
+  statement->type = STATEMENT_SELECT;
+  statement->has_order_by = false;
+  statement->descending = false;
+  statement->has_limit = false;
+
+  // The where clause ends where ordering or a limit starts
+  char* clause = strstr(input_buffer->buffer, " order by ");
+  if (clause == NULL) {
+    clause = strstr(input_buffer->buffer, " limit ");
+  }
+  if (clause != NULL) {
+    *clause++ = '\0';
+  }
+
+  char* keyword = strtok(input_buffer->buffer, " ");
+  if (strcmp(keyword, "select") != 0) {
+    return PREPARE_UNRECOGNIZED_STATEMENT;
+  }
+
+  PrepareResult result = prepare_where(statement);
+  if (result != PREPARE_SUCCESS || clause == NULL) {
+    return result;
+  }
+  return prepare_order_by(statement, clause);
+}
+
+/*
+delete [where ...]
+*/
+PrepareResult prepare_delete(InputBuffer* input_buffer, Statement* statement) {
+  statement->type = STATEMENT_DELETE;
+  char* keyword = strtok(input_buffer->buffer, " ");
+  if (strcmp(keyword, "delete") != 0) {
+    return PREPARE_UNRECOGNIZED_STATEMENT;
+  }
+
+  return prepare_where(statement);
+}
+
+/*
+update set <column> = <value> [where ...]
+Only columns outside the key can be updated in place.
+*/
+PrepareResult prepare_update(InputBuffer* input_buffer, Statement* statement) {
+  statement->type = STATEMENT_UPDATE;
+  char* keyword = strtok(input_buffer->buffer, " ");
+  if (strcmp(keyword, "update") != 0) {
+    return PREPARE_UNRECOGNIZED_STATEMENT;
+  }
+
+  char* set = strtok(NULL, " ");
+  if (set == NULL || strcmp(set, "set") != 0) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  Predicate* assignment = &(statement->assignment);
+  PrepareResult result = prepare_comparison(assignment);
+  if (result != PREPARE_SUCCESS) {
+    return result;
+  }
+  if (assignment->op != COMPARE_EQUAL) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+
+  switch (assignment->column) {
+    case (COLUMN_PROVIDER):
+      if (strlen(assignment->value) > COLUMN_PROVIDER_SIZE) {
+        return PREPARE_STRING_TO_LONG;
+      }
+      break;
+    case (COLUMN_REV):
+      if (assignment->rev < 0) {
+        return PREPARE_NEGATIVE_REV;
+      }
+      break;
+    case (COLUMN_TIME):
+      if (strlen(assignment->value) > COLUMN_TIME_SIZE) {
+        return PREPARE_STRING_TO_LONG;
+      }
+      break;
+    default:
+      return PREPARE_KEY_COLUMN_UPDATE;
+  }
+
+  return prepare_where(statement);
+}
+
+/*
+partition by month
+*/
+PrepareResult prepare_partition(InputBuffer* input_buffer,
+                                Statement* statement) {
+  statement->type = STATEMENT_PARTITION;
+  char* keyword = strtok(input_buffer->buffer, " ");
+  char* by = strtok(NULL, " ");
+  char* unit = strtok(NULL, " ");
+  if (strcmp(keyword, "partition") != 0) {
+    return PREPARE_UNRECOGNIZED_STATEMENT;
+  }
+  if (by == NULL || unit == NULL || strcmp(by, "by") != 0 ||
+      strcmp(unit, "month") != 0 || strtok(NULL, " ") != NULL) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+
+  return PREPARE_SUCCESS;
+}
+
+/*
+drop partition <YYYY-MM>
+*/
+PrepareResult prepare_drop(InputBuffer* input_buffer, Statement* statement) {
+  statement->type = STATEMENT_DROP_PARTITION;
+  char* keyword = strtok(input_buffer->buffer, " ");
+  char* object = strtok(NULL, " ");
+  char* month = strtok(NULL, " ");
+  if (strcmp(keyword, "drop") != 0) {
+    return PREPARE_UNRECOGNIZED_STATEMENT;
+  }
+  if (object == NULL || month == NULL || strcmp(object, "partition") != 0 ||
+      strtok(NULL, " ") != NULL) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  if (strlen(month) > PARTITION_MONTH_SIZE) {
+    return PREPARE_STRING_TO_LONG;
+  }
+
+  strcpy(statement->partition, month);
+  return PREPARE_SUCCESS;
+}
+
+bool parse_column_type(const char* token, ColumnDefinition* column) {
+  char close[2];
+  char rest;
+  column->length = 0;
+  if (strcmp(token, "int") == 0) {
+    column->type = TYPE_INT;
+  } else if (strcmp(token, "bigint") == 0) {
+    column->type = TYPE_BIGINT;
+  } else if (strcmp(token, "float") == 0) {
+    column->type = TYPE_FLOAT;
+  } else if (strcmp(token, "double") == 0) {
+    column->type = TYPE_DOUBLE;
+  } else if (strcmp(token, "date") == 0) {
+    column->type = TYPE_DATE;
+  } else if (sscanf(token, "char(%u%1[)]%c", &(column->length), close,
+                    &rest) == 2) {
+    column->type = TYPE_CHAR;
+  } else if (sscanf(token, "varchar(%u%1[)]%c", &(column->length), close,
+                    &rest) == 2) {
+    column->type = TYPE_VARCHAR;
+  } else {
+    return false;
+  }
+  if (column->type == TYPE_CHAR || column->type == TYPE_VARCHAR) {
+    return column->length > 0 && column->length <= COLUMN_MAX_TEXT_SIZE;
+  }
+  return true;
+}
+
+/*
+create table <name> (<column> <type>, ...)
+The first column is the table's key.
+*/
+PrepareResult prepare_create(InputBuffer* input_buffer, Statement* statement) {
+  statement->type = STATEMENT_CREATE_TABLE;
+  char* keyword = strtok(input_buffer->buffer, " ");
+  char* object = strtok(NULL, " ");
+  char* name = strtok(NULL, " (");
+  char* definitions = strtok(NULL, "");
+  if (strcmp(keyword, "create") != 0) {
+    return PREPARE_UNRECOGNIZED_STATEMENT;
+  }
+  if (object == NULL || strcmp(object, "table") != 0 || name == NULL ||
+      definitions == NULL) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  if (strlen(name) >= CATALOG_NAME_SIZE) {
+    return PREPARE_STRING_TO_LONG;
+  }
+  strcpy(statement->table_name, name);
+
+  // Strip the parentheses around the column list
+  while (*definitions == ' ' || *definitions == '(') {
+    definitions++;
+  }
+  char* close = strrchr(definitions, ')');
+  if (close == NULL || close[strspn(close + 1, " ") + 1] != '\0') {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  *close = '\0';
+
+  statement->num_columns = 0;
+  for (char* definition = strtok(definitions, ","); definition != NULL;
+       definition = strtok(NULL, ",")) {
+    if (statement->num_columns == CATALOG_MAX_COLUMNS) {
+      return PREPARE_TOO_MANY_COLUMNS;
+    }
+    char column_name[COLUMN_MAX_TEXT_SIZE + 1];
+    char type[COLUMN_MAX_TEXT_SIZE + 1];
+    char rest;
+    if (sscanf(definition, " %255s %255s %c", column_name, type, &rest) != 2) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    if (strlen(column_name) >= CATALOG_NAME_SIZE) {
+      return PREPARE_STRING_TO_LONG;
+    }
+    ColumnDefinition* column = &(statement->columns[statement->num_columns]);
+    strcpy(column->name, column_name);
+    if (!parse_column_type(type, column)) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    statement->num_columns++;
+  }
+  if (statement->num_columns == 0) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+
+  return PREPARE_SUCCESS;
+}
+
+/*
+insert into <table> <value> ...
+Values are given in column order.
+*/
+PrepareResult prepare_insert_into(InputBuffer* input_buffer,
+                                  Statement* statement) {
+  statement->type = STATEMENT_INSERT_INTO;
+  strtok(input_buffer->buffer, " ");
+  strtok(NULL, " ");
+  char* name = strtok(NULL, " ");
+  if (name == NULL) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  if (strlen(name) >= CATALOG_NAME_SIZE) {
+    return PREPARE_STRING_TO_LONG;
+  }
+  strcpy(statement->table_name, name);
+
+  statement->num_values = 0;
+  for (char* value = strtok(NULL, " "); value != NULL;
+       value = strtok(NULL, " ")) {
+    if (statement->num_values == CATALOG_MAX_COLUMNS) {
+      return PREPARE_TOO_MANY_COLUMNS;
+    }
+    if (strlen(value) > COLUMN_MAX_TEXT_SIZE) {
+      return PREPARE_STRING_TO_LONG;
+    }
+    strcpy(statement->values[statement->num_values++], value);
+  }
+
+  return PREPARE_SUCCESS;
+}
+
+/*
+select from <table>
+*/
+PrepareResult prepare_select_from(InputBuffer* input_buffer,
+                                  Statement* statement) {
+  statement->type = STATEMENT_SELECT_FROM;
+  strtok(input_buffer->buffer, " ");
+  strtok(NULL, " ");
+  char* name = strtok(NULL, " ");
+  if (name == NULL || strtok(NULL, " ") != NULL) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  if (strlen(name) >= CATALOG_NAME_SIZE) {
+    return PREPARE_STRING_TO_LONG;
+  }
+  strcpy(statement->table_name, name);
+  return PREPARE_SUCCESS;
+}
+
+/*
+select join <table> on <column> = <table column> [where ...]
+Rows of the viewing table are paired with the rows of table whose
+column has the same value. The where clause applies to viewing rows.
+*/
+PrepareResult prepare_select_join(InputBuffer* input_buffer,
+                                  Statement* statement) {
+  statement->type = STATEMENT_SELECT_JOIN;
+  strtok(input_buffer->buffer, " ");
+  strtok(NULL, " ");
+  char* name = strtok(NULL, " ");
+  char* on = strtok(NULL, " ");
+  char* column = strtok(NULL, " ");
+  char* equals = strtok(NULL, " ");
+  char* join_column = strtok(NULL, " ");
+  if (name == NULL || on == NULL || column == NULL || equals == NULL ||
+      join_column == NULL || strcmp(on, "on") != 0 ||
+      strcmp(equals, "=") != 0 || !parse_column(column, &(statement->join_on))) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  if (strlen(name) >= CATALOG_NAME_SIZE ||
+      strlen(join_column) >= CATALOG_NAME_SIZE) {
+    return PREPARE_STRING_TO_LONG;
+  }
+  strcpy(statement->table_name, name);
+  strcpy(statement->join_column, join_column);
+
+  return prepare_where(statement);
+}
+
+PrepareResult prepare_statement(InputBuffer* input_buffer,
+                                Statement* statement) {
+  if (strncmp(input_buffer->buffer, "insert into ", 12) == 0) {
+    return prepare_insert_into(input_buffer, statement);
+  }
+  if (strncmp(input_buffer->buffer, "select from ", 12) == 0) {
+    return prepare_select_from(input_buffer, statement);
+  }
+  if (strncmp(input_buffer->buffer, "select join ", 12) == 0) {
+    return prepare_select_join(input_buffer, statement);
+  }
+  if (strncmp(input_buffer->buffer, "create", 6) == 0) {
+    return prepare_create(input_buffer, statement);
+  }
+  if (strncmp(input_buffer->buffer, "insert", 6) == 0) {
+    return prepare_insert(input_buffer, statement);
+  }
+  if (strncmp(input_buffer->buffer, "select", 6) == 0) {
+    return prepare_select(input_buffer, statement);
+  }
+  if (strncmp(input_buffer->buffer, "delete", 6) == 0) {
+    return prepare_delete(input_buffer, statement);
+  }
+  if (strncmp(input_buffer->buffer, "update", 6) == 0) {
+    return prepare_update(input_buffer, statement);
+  }
+  if (strncmp(input_buffer->buffer, "partition", 9) == 0) {
+    return prepare_partition(input_buffer, statement);
+  }
+  if (strncmp(input_buffer->buffer, "drop", 4) == 0) {
+    return prepare_drop(input_buffer, statement);
+  }
+  if (strcmp(input_buffer->buffer, "analyze") == 0) {
+    statement->type = STATEMENT_ANALYZE;
+    return PREPARE_SUCCESS;
+  }
+
+  return PREPARE_UNRECOGNIZED_STATEMENT;
+}
+
+bool is_query(Statement* statement) {
+  return statement->type == STATEMENT_SELECT ||
+         statement->type == STATEMENT_SELECT_FROM ||
+         statement->type == STATEMENT_SELECT_JOIN;
+}
+
+/*
+ * Queries prepared recently, keyed by their text, so running the same
+ * query again skips parsing it. Preparing only looks at the text, never
+ * at the schema or the rows, so an entry never goes stale. Slots are
+ * picked by the hash of the text and a new query replaces the old one.
+ * Plans are not kept: they depend on the rows and the statistics, so
+ * explain works its plan out again every time.
+ */
+enum { QUERY_CACHE_SIZE = 16, QUERY_CACHE_MAX_TEXT_SIZE = 256 };
+
+struct QueryCacheEntry_t {
+  bool valid;
+  char text[QUERY_CACHE_MAX_TEXT_SIZE];
+  Statement statement;
+};
+typedef struct QueryCacheEntry_t QueryCacheEntry;
+
+QueryCacheEntry query_cache[QUERY_CACHE_SIZE];
+
+/*
+Prepare a statement, optionally prefixed with explain or explain
+analyze, reusing the parse of a query seen before
+*/
+PrepareResult prepare_query(InputBuffer* input_buffer, Statement* statement) {
+  ExplainMode explain = EXPLAIN_NONE;
+  char* text = input_buffer->buffer;
+  if (strncmp(text, "explain analyze ", 16) == 0) {
+    explain = EXPLAIN_ANALYZE;
+    text += 16;
+  } else if (strncmp(text, "explain ", 8) == 0) {
+    explain = EXPLAIN_PLAN;
+    text += 8;
+  }
+  memmove(input_buffer->buffer, text, strlen(text) + 1);
+  text = input_buffer->buffer;
+
+  bool cacheable = strlen(text) < QUERY_CACHE_MAX_TEXT_SIZE;
+  QueryCacheEntry* entry =
+      &(query_cache[hash_string(text) % QUERY_CACHE_SIZE]);
+  if (cacheable && entry->valid && strcmp(entry->text, text) == 0) {
+    *statement = entry->statement;
+    statement->explain = explain;
+    return PREPARE_SUCCESS;
+  }
+
+  char key[QUERY_CACHE_MAX_TEXT_SIZE];
+  if (cacheable) {
+    strcpy(key, text);  // preparing tokenizes the buffer in place
+  }
+  PrepareResult result = prepare_statement(input_buffer, statement);
+  if (result != PREPARE_SUCCESS) {
+    return result;
+  }
+  if (explain != EXPLAIN_NONE && !is_query(statement)) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  statement->explain = explain;
+  if (cacheable && is_query(statement)) {
+    entry->valid = true;
+    strcpy(entry->text, key);
+    entry->statement = *statement;
+  }
+  return PREPARE_SUCCESS;
+}
+
+void create_new_root(Table* table, uint32_t root_page_num,
+                     uint32_t right_child_page_num) {
+  /*
+  Handle splitting the root.
+  Old root copied to new page, becomes left child.
+  Address of right child passed in.
+  Re-initialize root page to contain the new root node.
+  New root node points to two children.
+  */
+  Pager* pager = table->pager;
+  void* root = get_page(pager, root_page_num);
+  void* right_child = get_page(pager, right_child_page_num);
+  uint32_t left_child_page_num = get_unused_page_num(pager);
+  void* left_child = get_page(pager, left_child_page_num);
+
+  /* Left child has data copied from old root */
+  memcpy(left_child, root, PAGE_SIZE);
+  set_node_root(left_child, false);
+
+  if (get_node_type(left_child) == NODE_INTERNAL) {
+    uint32_t num_keys = *internal_node_num_keys(left_child);
+    for (uint32_t i = 0; i <= num_keys; i++) {
+      void* child = get_page(pager, *internal_node_child(left_child, i));
+      *node_parent(child) = left_child_page_num;
+    }
+  }
+
+  /* Root node is a new internal node with one key and two children */
+  initialize_internal_node(root);
+  set_node_root(root, true);
+  *internal_node_num_keys(root) = 1;
+  *internal_node_child(root, 0) = left_child_page_num;
+  copy_key(internal_node_key(root, 0), get_node_max_key(pager, left_child));
+  *internal_node_right_child(root) = right_child_page_num;
+  *node_parent(left_child) = root_page_num;
+  *node_parent(right_child) = root_page_num;
+}
+
+void update_internal_node_key(void* node, char* old_key, char* new_key) {
+  uint32_t old_child_index = internal_node_find_child(node, old_key);
+  // The right child has no key of its own
+  if (old_child_index < *internal_node_num_keys(node)) {
+    copy_key(internal_node_key(node, old_child_index), new_key);
+  }
+}
+
+void internal_node_split_and_insert(Table* table, uint32_t parent_page_num,
+                                    uint32_t child_page_num);
+
+/*
+Add a new child/key pair to parent that corresponds to child
+*/
+void internal_node_insert(Table* table, uint32_t parent_page_num,
+                          uint32_t child_page_num) {
+  Pager* pager = table->pager;
+  void* parent = get_page(pager, parent_page_num);
+  void* child = get_page(pager, child_page_num);
+  char child_max_key[INTERNAL_NODE_KEY_SIZE];
+  copy_key(child_max_key, get_node_max_key(pager, child));
+  uint32_t index = internal_node_find_child(parent, child_max_key);
+
+  uint32_t original_num_keys = *internal_node_num_keys(parent);
+  if (original_num_keys >= INTERNAL_NODE_MAX_KEYS) {
+    internal_node_split_and_insert(table, parent_page_num, child_page_num);
+    return;
+  }
+
+  uint32_t right_child_page_num = *internal_node_right_child(parent);
+  char* right_child_max_key =
+      get_node_max_key(pager, get_page(pager, right_child_page_num));
+  *internal_node_num_keys(parent) = original_num_keys + 1;
+
+  if (strncmp(child_max_key, right_child_max_key, INTERNAL_NODE_KEY_SIZE) > 0) {
+    /* Replace right child */
+    *internal_node_child(parent, original_num_keys) = right_child_page_num;
+    copy_key(internal_node_key(parent, original_num_keys), right_child_max_key);
+    *internal_node_right_child(parent) = child_page_num;
+  } else {
+    /* Make room for the new cell */
+    for (uint32_t i = original_num_keys; i > index; i--) {
+      internal_node_copy_cell(parent, i, i - 1);
+    }
+    *internal_node_child(parent, index) = child_page_num;
+    copy_key(internal_node_key(parent, index), child_max_key);
+  }
+}
+
+/*
+Split a full internal node while adding child to it. The children
+(including the new one) are divided evenly between the old node and a
+new sibling, which is then inserted into the grandparent.
+*/
+void internal_node_split_and_insert(Table* table, uint32_t parent_page_num,
+                                    uint32_t child_page_num) {
+  metrics_add(METRIC_SPLITS, 1);
+  Pager* pager = table->pager;
+  void* old_node = get_page(pager, parent_page_num);
+  uint32_t num_keys = *internal_node_num_keys(old_node);
+  char old_max[INTERNAL_NODE_KEY_SIZE];
+  copy_key(old_max, get_node_max_key(pager, old_node));
+  char child_max_key[INTERNAL_NODE_KEY_SIZE];
+  copy_key(child_max_key,
+           get_node_max_key(pager, get_page(pager, child_page_num)));
+
+  /* Gather every child and its key in order, including the new child */
+  uint32_t total = num_keys + 2;
+  uint32_t children[total];
+  char keys[total][INTERNAL_NODE_KEY_SIZE];
+  uint32_t count = 0;
+  bool placed = false;
+  for (uint32_t i = 0; i <= num_keys; i++) {
+    uint32_t page_num = *internal_node_child(old_node, i);
+    char* key = (i < num_keys)
+                    ? internal_node_key(old_node, i)
+                    : get_node_max_key(pager, get_page(pager, page_num));
+    if (!placed && strncmp(child_max_key, key, INTERNAL_NODE_KEY_SIZE) < 0) {
+      children[count] = child_page_num;
+      copy_key(keys[count], child_max_key);
+      count++;
+      placed = true;
+    }
+    children[count] = page_num;
+    copy_key(keys[count], key);
+    count++;
+  }
+  if (!placed) {
+    children[count] = child_page_num;
+    copy_key(keys[count], child_max_key);
+  }
+
+  uint32_t left_count = total / 2;
+  uint32_t new_page_num = get_unused_page_num(pager);
+  void* new_node = get_page(pager, new_page_num);
+  initialize_internal_node(new_node);
+
+  *internal_node_num_keys(old_node) = left_count - 1;
+  for (uint32_t i = 0; i < left_count - 1; i++) {
+    *internal_node_child(old_node, i) = children[i];
+    copy_key(internal_node_key(old_node, i), keys[i]);
+  }
+  *internal_node_right_child(old_node) = children[left_count - 1];
+
+  *internal_node_num_keys(new_node) = total - left_count - 1;
+  for (uint32_t i = left_count; i < total - 1; i++) {
+    *internal_node_child(new_node, i - left_count) = children[i];
+    copy_key(internal_node_key(new_node, i - left_count), keys[i]);
+  }
+  *internal_node_right_child(new_node) = children[total - 1];
+
+  for (uint32_t i = 0; i < total; i++) {
+    void* child = get_page(pager, children[i]);
+    *node_parent(child) = (i < left_count) ? parent_page_num : new_page_num;
+  }
+
+  if (is_node_root(old_node)) {
+    create_new_root(table, parent_page_num, new_page_num);
+  } else {
+    uint32_t grandparent_page_num = *node_parent(old_node);
+    void* grandparent = get_page(pager, grandparent_page_num);
+    *node_parent(new_node) = grandparent_page_num;
+    update_internal_node_key(grandparent, old_max, keys[left_count - 1]);
+    internal_node_insert(table, grandparent_page_num, new_page_num);
+  }
+}
+
+void leaf_node_split_and_insert(Cursor* cursor, char* key, void* value) {
+  /*
+  Create a new node and move half the cells over.
+  Insert the new value in one of the two nodes.
+  Update parent or create a new parent.
+  */
+  metrics_add(METRIC_SPLITS, 1);
+  Pager* pager = cursor->table->pager;
+  void* old_node = get_page(pager, cursor->page_num);
+  char old_max[LEAF_NODE_KEY_SIZE];
+  copy_key(old_max, get_node_max_key(pager, old_node));
+  uint32_t cell_size = leaf_node_cell_size(old_node);
+  uint32_t max_cells = leaf_node_max_cells(old_node);
+  uint32_t right_split_count = (max_cells + 1) / 2;
+  uint32_t left_split_count = (max_cells + 1) - right_split_count;
+  uint32_t new_page_num = get_unused_page_num(pager);
+  void* new_node = get_page(pager, new_page_num);
+  initialize_leaf_node(new_node, *leaf_node_key_size(old_node),
+                       *leaf_node_value_size(old_node));
+  *node_parent(new_node) = *node_parent(old_node);
+  *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
+  *leaf_node_next_leaf(old_node) = new_page_num;
+
+  /*
+  All existing keys plus new key should be divided
+  evenly between old (left) and new (right) nodes.
+  Starting from the right, move each key to correct position.
+  */
+  for (int32_t i = max_cells; i >= 0; i--) {
+    void* destination_node;
+    uint32_t index_within_node;
+    if (i >= (int32_t)left_split_count) {
+      destination_node = new_node;
+      index_within_node = i - left_split_count;
+    } else {
+      destination_node = old_node;
+      index_within_node = i;
+    }
+    void* destination = leaf_node_cell(destination_node, index_within_node);
+
+    if (i == (int32_t)cursor->cell_num) {
+      strcpy(leaf_node_key(destination_node, index_within_node), key);
+      memcpy(leaf_node_value(destination_node, index_within_node), value,
+             *leaf_node_value_size(old_node));
+    } else if (i > (int32_t)cursor->cell_num) {
+      memcpy(destination, leaf_node_cell(old_node, i - 1), cell_size);
+    } else {
+      memcpy(destination, leaf_node_cell(old_node, i), cell_size);
+    }
+  }
+
+  /* Update cell count on both leaf nodes */
+  *(leaf_node_num_cells(old_node)) = left_split_count;
+  *(leaf_node_num_cells(new_node)) = right_split_count;
+  leaf_node_update_heads(old_node);
+  leaf_node_update_heads(new_node);
+
+  if (is_node_root(old_node)) {
+    create_new_root(cursor->table, cursor->page_num, new_page_num);
+  } else {
+    uint32_t parent_page_num = *node_parent(old_node);
+    void* parent = get_page(pager, parent_page_num);
+    update_internal_node_key(parent, old_max, get_node_max_key(pager, old_node));
+    internal_node_insert(cursor->table, parent_page_num, new_page_num);
+  }
+}
+
+/*
+Give the cell just inserted at cell_num its head. A new first or last
+key may share less with the others, then every head is redone.
+*/
+void leaf_node_insert_head(void* node, uint32_t cell_num) {
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  uint64_t* heads = leaf_node_heads(node);
+  memmove(heads + cell_num + 1, heads + cell_num,
+          (num_cells - 1 - cell_num) * sizeof(uint64_t));
+
+  char* key = leaf_node_key(node, cell_num);
+  uint32_t skip = *leaf_node_head_skip(node);
+  uint32_t other = cell_num == 0 ? 1 : 0;
+  if (num_cells == 1 ||
+      strncmp(key, leaf_node_key(node, other), skip) != 0) {
+    leaf_node_update_heads(node);
+    return;
+  }
+  heads[cell_num] = key_head(key, skip);
+}
+
+void leaf_node_insert(Cursor* cursor, char* key, void* value) {
+  void* node = get_page(cursor->table->pager, cursor->page_num);
+
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  if (num_cells >= leaf_node_max_cells(node)) {
+    // Node full
+    leaf_node_split_and_insert(cursor, key, value);
+    return;
+  }
+
+  if (cursor->cell_num < num_cells) {
+    // Make room for new cell
+    for (uint32_t i = num_cells; i > cursor->cell_num; i--) {
+      memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i - 1),
+             leaf_node_cell_size(node));
+    }
+  }
+
+  *(leaf_node_num_cells(node)) += 1;
+  strcpy(leaf_node_key(node, cursor->cell_num), key);
+  memcpy(leaf_node_value(node, cursor->cell_num), value,
+         *leaf_node_value_size(node));
+  leaf_node_insert_head(node, cursor->cell_num);
+}
+
+void reparent_children(Pager* pager, void* node, uint32_t page_num) {
+  if (get_node_type(node) != NODE_INTERNAL) {
+    return;
+  }
+  uint32_t num_keys = *internal_node_num_keys(node);
+  for (uint32_t i = 0; i <= num_keys; i++) {
+    void* child = get_page(pager, *internal_node_child(node, i));
+    *node_parent(child) = page_num;
+  }
+}
+
+/*
+Remove the child to the right of child left_index after its
+entries have been merged into the left child, which takes over
+the removed child's key
+*/
+void internal_node_remove_right_sibling(void* node, uint32_t left_index) {
+  uint32_t num_keys = *internal_node_num_keys(node);
+  if (left_index + 1 == num_keys) {
+    *internal_node_right_child(node) = *internal_node_child(node, left_index);
+  } else {
+    copy_key(internal_node_key(node, left_index),
+             internal_node_key(node, left_index + 1));
+    for (uint32_t i = left_index + 1; i < num_keys - 1; i++) {
+      internal_node_copy_cell(node, i, i + 1);
+    }
+  }
+  *internal_node_num_keys(node) = num_keys - 1;
+}
+
+/*
+Merge two sibling leaves if their cells fit in one node, otherwise
+split the cells evenly between them. Returns true if right was
+emptied into left.
+*/
+bool leaf_nodes_rebalance(void* parent, uint32_t left_index, void* left,
+                          void* right) {
+  uint32_t left_cells = *leaf_node_num_cells(left);
+  uint32_t right_cells = *leaf_node_num_cells(right);
+  uint32_t total = left_cells + right_cells;
+  uint32_t cell_size = leaf_node_cell_size(left);
+
+  if (total <= leaf_node_max_cells(left)) {
+    memcpy(leaf_node_cell(left, left_cells), leaf_node_cell(right, 0),
+           right_cells * cell_size);
+    *leaf_node_num_cells(left) = total;
+    *leaf_node_next_leaf(left) = *leaf_node_next_leaf(right);
+    leaf_node_update_heads(left);
+    return true;
+  }
+
+  uint32_t left_count = total / 2;
+  if (left_cells < left_count) {
+    uint32_t moved = left_count - left_cells;
+    memcpy(leaf_node_cell(left, left_cells), leaf_node_cell(right, 0),
+           moved * cell_size);
+    memmove(leaf_node_cell(right, 0), leaf_node_cell(right, moved),
+            (right_cells - moved) * cell_size);
+  } else {
+    uint32_t moved = left_cells - left_count;
+    memmove(leaf_node_cell(right, moved), leaf_node_cell(right, 0),
+            right_cells * cell_size);
+    memcpy(leaf_node_cell(right, 0), leaf_node_cell(left, left_count),
+           moved * cell_size);
+  }
+  *leaf_node_num_cells(left) = left_count;
+  *leaf_node_num_cells(right) = total - left_count;
+  leaf_node_update_heads(left);
+  leaf_node_update_heads(right);
+  copy_key(internal_node_key(parent, left_index),
+           leaf_node_key(left, left_count - 1));
+  return false;
+}
+
+/*
+Same as leaf_nodes_rebalance for two sibling internal nodes. The
+parent's key between them becomes the key of the left node's
+right child.
+*/
+bool internal_nodes_rebalance(Pager* pager, void* parent, uint32_t left_index,
+                              uint32_t left_page_num, void* left,
+                              uint32_t right_page_num, void* right) {
+  uint32_t left_keys = *internal_node_num_keys(left);
+  uint32_t right_keys = *internal_node_num_keys(right);
+
+  /* Gather every child and its key in order */
+  uint32_t total = left_keys + right_keys + 2;
+  uint32_t children[total];
+  char keys[total][INTERNAL_NODE_KEY_SIZE];
+  for (uint32_t i = 0; i <= left_keys; i++) {
+    children[i] = *internal_node_child(left, i);
+    char* key = (i < left_keys) ? internal_node_key(left, i)
+                                : internal_node_key(parent, left_index);
+    copy_key(keys[i], key);
+  }
+  for (uint32_t i = 0; i <= right_keys; i++) {
+    children[left_keys + 1 + i] = *internal_node_child(right, i);
+    if (i < right_keys) {
+      copy_key(keys[left_keys + 1 + i], internal_node_key(right, i));
+    }
+  }
+
+  bool merged = (total - 1 <= INTERNAL_NODE_MAX_KEYS);
+  uint32_t left_count = merged ? total : total / 2;
+
+  *internal_node_num_keys(left) = left_count - 1;
+  for (uint32_t i = 0; i < left_count - 1; i++) {
+    *internal_node_child(left, i) = children[i];
+    copy_key(internal_node_key(left, i), keys[i]);
+  }
+  *internal_node_right_child(left) = children[left_count - 1];
+
+  if (!merged) {
+    *internal_node_num_keys(right) = total - left_count - 1;
+    for (uint32_t i = left_count; i < total - 1; i++) {
+      *internal_node_child(right, i - left_count) = children[i];
+      copy_key(internal_node_key(right, i - left_count), keys[i]);
+    }
+    *internal_node_right_child(right) = children[total - 1];
+    copy_key(internal_node_key(parent, left_index), keys[left_count - 1]);
+  }
+
+  for (uint32_t i = 0; i < total; i++) {
+    void* child = get_page(pager, children[i]);
+    *node_parent(child) =
+        (i < left_count) ? left_page_num : right_page_num;
+  }
+  return merged;
+}
+
+/*
+Fix an underfull node by merging it with, or refilling it from, a
+sibling under the same parent, then fix the parent in turn. A root
+left with a single child is replaced by that child so the tree gets
+shorter. Returns the page that now holds the node's entries.
+*/
+uint32_t node_rebalance(Table* table, uint32_t page_num) {
+  Pager* pager = table->pager;
+  void* node = get_page(pager, page_num);
+
+  if (is_node_root(node)) {
+    while (get_node_type(node) == NODE_INTERNAL &&
+           *internal_node_num_keys(node) == 0) {
+      uint32_t child_page_num = *internal_node_right_child(node);
+      memcpy(node, get_page(pager, child_page_num), PAGE_SIZE);
+      set_node_root(node, true);
+      reparent_children(pager, node, page_num);
+      pager_free_page(pager, child_page_num);
+    }
+    return page_num;
+  }
+
+  bool is_leaf = get_node_type(node) == NODE_LEAF;
+  uint32_t size = is_leaf ? *leaf_node_num_cells(node)
+                          : *internal_node_num_keys(node);
+  if (size >= (is_leaf ? leaf_node_min_cells(node) : INTERNAL_NODE_MIN_KEYS)) {
+    return page_num;
+  }
+
+  uint32_t parent_page_num = *node_parent(node);
+  void* parent = get_page(pager, parent_page_num);
+  if (*internal_node_num_keys(parent) == 0) {
+    // No sibling under this parent, so rebalance the parent first
+    node_rebalance(table, parent_page_num);
+    if (get_node_type(node) == NODE_FREELIST) {
+      // The parent was a root with only this child, which replaced it
+      return parent_page_num;
+    }
+    parent_page_num = *node_parent(node);
+    parent = get_page(pager, parent_page_num);
+  }
+
+  uint32_t num_keys = *internal_node_num_keys(parent);
+  uint32_t index = 0;
+  while (*internal_node_child(parent, index) != page_num) {
+    index++;
+  }
+  uint32_t left_index = (index < num_keys) ? index : index - 1;
+  uint32_t left_page_num = *internal_node_child(parent, left_index);
+  uint32_t right_page_num = *internal_node_child(parent, left_index + 1);
+  void* left = get_page(pager, left_page_num);
+  void* right = get_page(pager, right_page_num);
+
+  bool merged =
+      is_leaf ? leaf_nodes_rebalance(parent, left_index, left, right)
+              : internal_nodes_rebalance(pager, parent, left_index,
+                                         left_page_num, left, right_page_num,
+                                         right);
+  if (!merged) {
+    return page_num;
+  }
+
+  internal_node_remove_right_sibling(parent, left_index);
+  pager_free_page(pager, right_page_num);
+  node_rebalance(table, parent_page_num);
+  if (get_node_type(left) == NODE_FREELIST) {
+    // The parent was a root left with only this child, which replaced it
+    return parent_page_num;
+  }
+  return left_page_num;
+}
+
+/*
+Keep the row counts in the file header, and in the directory entry of
+the partition rooted at root_page_num, in step with the table
+*/
+void table_add_rows(Table* table, uint32_t root_page_num, int32_t delta) {
+  void* header = file_header(table->pager);
+  *file_header_num_rows(header) += delta;
+
+  uint32_t statistics_page_num = *file_header_statistics_page(header);
+  if (statistics_page_num != 0) {
+    void* statistics = get_page(table->pager, statistics_page_num);
+    *statistics_num_modified(statistics) += delta < 0 ? -delta : delta;
+  }
+  uint32_t bloom_filter_page_num = *file_header_bloom_filter_page(header);
+  if (bloom_filter_page_num != 0) {
+    void* filter = get_page(table->pager, bloom_filter_page_num);
+    *bloom_filter_num_rows(filter) = *file_header_num_rows(header);
+  }
+
+  void* directory = partition_directory(table->pager);
+  for (uint32_t i = 0; i < *partition_num_partitions(directory); i++) {
+    if (*partition_root(directory, i) == root_page_num) {
+      *partition_num_rows(directory, i) += delta;
+      return;
+    }
+  }
+}
+
+/*
+Find the root of the tree a row with this date belongs to,
+creating the month's partition if it does not exist yet
+*/
+ExecuteResult table_insert_root(Table* table, char* date,
+                                uint32_t* root_page_num) {
+  Pager* pager = table->pager;
+  void* directory = partition_directory(pager);
+  if (!*partition_is_partitioned(directory)) {
+    *root_page_num = table->root_page_num;
+    return EXECUTE_SUCCESS;
+  }
+
+  char month[PARTITION_NAME_SIZE];
+  memset(month, 0, PARTITION_NAME_SIZE);
+  strncpy(month, date, PARTITION_MONTH_SIZE);
+  uint32_t num_partitions = *partition_num_partitions(directory);
+  uint32_t index = partition_find(directory, month);
+  if (index < num_partitions &&
+      strncmp(month, partition_name(directory, index), PARTITION_NAME_SIZE) ==
+          0) {
+    *root_page_num = *partition_root(directory, index);
+    return EXECUTE_SUCCESS;
+  }
+
+  if (num_partitions >= PARTITION_MAX_PARTITIONS) {
+    return EXECUTE_TABLE_FULL;
+  }
+  uint32_t new_page_num = get_unused_page_num(pager);
+  if (new_page_num >= TABLE_MAX_PAGES) {
+    return EXECUTE_TABLE_FULL;
+  }
+  void* root = get_page(pager, new_page_num);
+  initialize_leaf_node(root, LEAF_NODE_KEY_SIZE, LEAF_NODE_VALUE_SIZE);
+  set_node_root(root, true);
+
+  memmove(partition_entry(directory, index + 1),
+          partition_entry(directory, index),
+          (num_partitions - index) * PARTITION_ENTRY_SIZE);
+  memcpy(partition_name(directory, index), month, PARTITION_NAME_SIZE);
+  *partition_root(directory, index) = new_page_num;
+  *partition_num_rows(directory, index) = 0;
+  *partition_num_partitions(directory) = num_partitions + 1;
+
+  *root_page_num = new_page_num;
+  return EXECUTE_SUCCESS;
+}
+
+/*
+ * Log-structured ingest, on with --memtable <rows>. Inserts into the
+ * viewing table (while it is not partitioned) go to the memtable, a
+ * sorted buffer in memory, instead of straight into the tree. A full
+ * memtable is written out as a run: its cells in key order on leaf
+ * pages that belong to no tree, with the first key of each page and a
+ * bloom filter of all its keys kept in memory. Once there are
+ * LSM_MAX_RUNS runs they are merged into the tree in key order,
+ * LSM_MERGE_ROWS rows after each statement, so a leaf is changed once
+ * per merge rather than once per insert.
+ *
+ * Inserts and key = <value> lookups look in the memtable, then in the
+ * runs whose bloom filter may hold the key, then in the tree. Any other
+ * statement on the viewing table first merges everything into the tree,
+ * as does closing, vacuuming or backing up the database, so the file
+ * format does not change.
+ */
+uint32_t memtable_capacity = 0;  // rows, 0 when log-structured ingest is off
+
+enum {
+  LSM_MAX_RUNS = 4,
+  LSM_MERGE_ROWS = 256,
+  LSM_BLOOM_BITS_PER_KEY = 10,  // about 1% false positives
+  LSM_BLOOM_HASHES = 7
+};
+
+struct BloomFilter_t {
+  uint8_t* bits;
+  uint32_t num_bits;
+  uint32_t num_hashes;
+};
+typedef struct BloomFilter_t BloomFilter;
+
+void bloom_init(BloomFilter* filter, uint32_t num_keys, uint32_t bits_per_key,
+                uint32_t num_hashes) {
+  filter->num_bits = num_keys * bits_per_key;
+  if (filter->num_bits < 64) {
+    filter->num_bits = 64;
+  }
+  filter->num_hashes = num_hashes;
+  filter->bits = db_calloc((filter->num_bits + 7) / 8, 1);
+}
+
+/*
+The num_hashes bit positions of a key come from two hashes of it,
+h1 + i * h2 (double hashing)
+*/
+void bloom_hashes(const char* key, uint32_t* h1, uint32_t* h2) {
+  size_t length = strnlen(key, LEAF_NODE_KEY_SIZE);
+  *h1 = crc32c((const uint8_t*)key, length);
+  *h2 = 2166136261u;  // FNV-1a
+  for (size_t i = 0; i < length; i++) {
+    *h2 = (*h2 ^ (uint8_t)key[i]) * 16777619u;
+  }
+  *h2 |= 1;
+}
+
+void bloom_add(BloomFilter* filter, const char* key) {
+  uint32_t h1, h2;
+  bloom_hashes(key, &h1, &h2);
+  for (uint32_t i = 0; i < filter->num_hashes; i++) {
+    uint32_t bit = (h1 + i * h2) % filter->num_bits;
+    filter->bits[bit / 8] |= 1 << (bit % 8);
+  }
+}
+
+bool bloom_may_contain(BloomFilter* filter, const char* key) {
+  uint32_t h1, h2;
+  bloom_hashes(key, &h1, &h2);
+  for (uint32_t i = 0; i < filter->num_hashes; i++) {
+    uint32_t bit = (h1 + i * h2) % filter->num_bits;
+    if (!(filter->bits[bit / 8] & (1 << (bit % 8)))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+Cells are appended to cells as they arrive; order holds their indexes
+in key order
+*/
+struct Memtable_t {
+  uint8_t* cells;
+  uint32_t* order;
+  uint32_t num_rows;
+};
+typedef struct Memtable_t Memtable;
+
+struct Run_t {
+  uint32_t* page_nums;
+  char* first_keys;  // LEAF_NODE_KEY_SIZE bytes per page
+  uint32_t num_pages;
+  uint32_t num_rows;
+  uint32_t num_merged;  // rows already moved into the tree
+  BloomFilter bloom;
+};
+typedef struct Run_t Run;
+
+Memtable memtable;
+Run runs[2 * LSM_MAX_RUNS];
+uint32_t num_runs = 0;
+uint32_t num_merging = 0;  // runs[0..num_merging) are being merged
+
+char* memtable_key(uint32_t position) {
+  return (char*)memtable.cells +
+         memtable.order[position] * LEAF_NODE_CELL_SIZE;
+}
+
+/*
+Position of the first memtable row whose key is not smaller than key
+*/
+uint32_t memtable_lower_bound(char* key) {
+  uint32_t min_index = 0;
+  uint32_t one_past_max_index = memtable.num_rows;
+  while (one_past_max_index != min_index) {
+    uint32_t index = (min_index + one_past_max_index) / 2;
+    if (strncmp(memtable_key(index), key, LEAF_NODE_KEY_SIZE) < 0) {
+      min_index = index + 1;
+    } else {
+      one_past_max_index = index;
+    }
+  }
+  return min_index;
+}
+
+/*
+Find key among the rows of a run that are not merged yet
+*/
+void* run_find(Table* table, Run* run, char* key) {
+  if (!bloom_may_contain(&(run->bloom), key)) {
+    metrics_add(METRIC_BLOOM_SKIPS, 1);
+    return NULL;
+  }
+  // The last page starting at or before key
+  uint32_t min_index = 0;
+  uint32_t one_past_max_index = run->num_pages;
+  while (one_past_max_index != min_index) {
+    uint32_t index = (min_index + one_past_max_index) / 2;
+    if (strncmp(run->first_keys + index * LEAF_NODE_KEY_SIZE, key,
+                LEAF_NODE_KEY_SIZE) <= 0) {
+      min_index = index + 1;
+    } else {
+      one_past_max_index = index;
+    }
+  }
+  if (min_index == 0 ||
+      min_index * LEAF_NODE_MAX_CELLS <= run->num_merged) {
+    return NULL;  // before the run, or on a page merged and freed already
+  }
+  uint32_t page_index = min_index - 1;
+  metrics_add(METRIC_RUN_PAGE_READS, 1);
+  Cursor cursor;
+  leaf_node_find(table, run->page_nums[page_index], key, &cursor);
+  void* node = get_page(table->pager, cursor.page_num);
+  if (cursor.cell_num >= *leaf_node_num_cells(node) ||
+      strncmp(leaf_node_key(node, cursor.cell_num), key,
+              LEAF_NODE_KEY_SIZE) != 0 ||
+      page_index * LEAF_NODE_MAX_CELLS + cursor.cell_num < run->num_merged) {
+    return NULL;
+  }
+  return leaf_node_cell(node, cursor.cell_num);
+}
+
+/*
+The cell with this key if it is in the memtable or a run, else NULL
+*/
+void* lsm_find(Table* table, char* key) {
+  if (memtable.num_rows > 0) {
+    uint32_t position = memtable_lower_bound(key);
+    if (position < memtable.num_rows &&
+        strncmp(memtable_key(position), key, LEAF_NODE_KEY_SIZE) == 0) {
+      return memtable_key(position);
+    }
+  }
+  for (uint32_t i = num_runs; i > 0; i--) {
+    void* cell = run_find(table, &(runs[i - 1]), key);
+    if (cell != NULL) {
+      return cell;
+    }
+  }
+  return NULL;
+}
+
+/*
+Write the memtable out as a new run
+*/
+void memtable_flush(Table* table) {
+  Pager* pager = table->pager;
+  Run* run = &(runs[num_runs++]);
+  uint32_t num_pages =
+      (memtable.num_rows + LEAF_NODE_MAX_CELLS - 1) / LEAF_NODE_MAX_CELLS;
+  run->page_nums = db_malloc(num_pages * sizeof(uint32_t));
+  run->first_keys = db_malloc(num_pages * LEAF_NODE_KEY_SIZE);
+  run->num_pages = num_pages;
+  run->num_rows = memtable.num_rows;
+  run->num_merged = 0;
+  bloom_init(&(run->bloom), memtable.num_rows, LSM_BLOOM_BITS_PER_KEY,
+             LSM_BLOOM_HASHES);
+
+  void* node = NULL;
+  for (uint32_t i = 0; i < memtable.num_rows; i++) {
+    uint32_t page_index = i / LEAF_NODE_MAX_CELLS;
+    uint32_t cell_num = i % LEAF_NODE_MAX_CELLS;
+    if (cell_num == 0) {
+      uint32_t page_num = get_unused_page_num(pager);
+      void* next_node = get_page(pager, page_num);
+      initialize_leaf_node(next_node, LEAF_NODE_KEY_SIZE, LEAF_NODE_VALUE_SIZE);
+      if (node != NULL) {
+        leaf_node_update_heads(node);
+        *leaf_node_next_leaf(node) = page_num;
+      }
+      node = next_node;
+      run->page_nums[page_index] = page_num;
+      memcpy(run->first_keys + page_index * LEAF_NODE_KEY_SIZE,
+             memtable_key(i), LEAF_NODE_KEY_SIZE);
+    }
+    memcpy(leaf_node_cell(node, cell_num), memtable_key(i),
+           LEAF_NODE_CELL_SIZE);
+    *leaf_node_num_cells(node) = cell_num + 1;
+    bloom_add(&(run->bloom), memtable_key(i));
+  }
+  leaf_node_update_heads(node);
+  memtable.num_rows = 0;
+  metrics_add(METRIC_MEMTABLE_FLUSHES, 1);
+}
+
+void tree_insert_cell(Table* table, void* cell) {
+  Cursor cursor;
+  table_find(table, table->root_page_num, cell, &cursor);
+  leaf_node_insert(&cursor, cell, cell + LEAF_NODE_KEY_SIZE);
+}
+
+/*
+Move up to max_rows rows of the runs being merged into the tree,
+smallest key first, and free each run page once it is all moved. A new
+merge of every run starts once there are LSM_MAX_RUNS of them.
+*/
+void lsm_merge(Table* table, uint32_t max_rows) {
+  if (num_merging == 0 && num_runs >= LSM_MAX_RUNS) {
+    num_merging = num_runs;
+  }
+  uint32_t num_moved = 0;
+  while (num_merging > 0 && num_moved < max_rows) {
+    Run* smallest = NULL;
+    void* smallest_cell = NULL;
+    for (uint32_t i = 0; i < num_merging; i++) {
+      Run* run = &(runs[i]);
+      if (run->num_merged == run->num_rows) {
+        continue;
+      }
+      void* node = get_page(table->pager,
+                            run->page_nums[run->num_merged / LEAF_NODE_MAX_CELLS]);
+      void* cell = leaf_node_cell(node, run->num_merged % LEAF_NODE_MAX_CELLS);
+      if (smallest == NULL ||
+          strncmp(cell, smallest_cell, LEAF_NODE_KEY_SIZE) < 0) {
+        smallest = run;
+        smallest_cell = cell;
+      }
+    }
+
+    if (smallest == NULL) {
+      // Every run being merged is in the tree now
+      for (uint32_t i = 0; i < num_merging; i++) {
+        free(runs[i].page_nums);
+        free(runs[i].first_keys);
+        free(runs[i].bloom.bits);
+      }
+      memmove(runs, runs + num_merging, (num_runs - num_merging) * sizeof(Run));
+      num_runs -= num_merging;
+      num_merging = 0;
+      break;
+    }
+
+    tree_insert_cell(table, smallest_cell);
+    smallest->num_merged++;
+    num_moved++;
+    if (smallest->num_merged % LEAF_NODE_MAX_CELLS == 0 ||
+        smallest->num_merged == smallest->num_rows) {
+      pager_free_page(table->pager,
+                      smallest->page_nums[(smallest->num_merged - 1) /
+                                          LEAF_NODE_MAX_CELLS]);
+    }
+  }
+  metrics_add(METRIC_MERGED_ROWS, num_moved);
+}
+
+/*
+Move every buffered row into the tree
+*/
+void lsm_settle(Table* table) {
+  if (num_runs > 0) {
+    num_merging = num_runs;
+    lsm_merge(table, UINT32_MAX);
+  }
+  for (uint32_t i = 0; i < memtable.num_rows; i++) {
+    tree_insert_cell(table, memtable_key(i));
+  }
+  metrics_add(METRIC_MERGED_ROWS, memtable.num_rows);
+  memtable.num_rows = 0;
+}
+
+/*
+Pages to hold back so that every buffered row, plus one more, can be
+written out and merged. Merging splits each leaf at most once plus once
+per half a leaf of rows it receives; every page in use is counted as a
+leaf rather than reading the internal nodes on each insert.
+*/
+uint32_t memtable_pages_needed(Table* table) {
+  Pager* pager = table->pager;
+  uint32_t num_available = pager_num_available_pages(pager);
+  uint32_t num_buffered = memtable.num_rows + 1;
+  for (uint32_t i = 0; i < num_runs; i++) {
+    num_buffered += runs[i].num_rows - runs[i].num_merged;
+  }
+  uint32_t num_splits = (TABLE_MAX_PAGES - num_available) +
+                        2 * num_buffered / LEAF_NODE_MAX_CELLS + 1;
+  if (num_splits > num_buffered) {
+    num_splits = num_buffered;
+  }
+  return (memtable.num_rows + LEAF_NODE_MAX_CELLS) / LEAF_NODE_MAX_CELLS +
+         num_splits + tree_depth(pager, table->root_page_num) + 1;
+}
+
+/*
+Buffer a new row of the viewing table in the memtable. Pages for writing
+out and merging every buffered row are reserved up front. Near the end of
+the file that reservation grows past what the tree itself would need, so
+the buffered rows are then merged into the tree before giving up; the
+caller inserts the row into the tree instead, and the table holds as many
+rows as without the memtable.
+*/
+ExecuteResult memtable_insert(Table* table, char* key, Row* row) {
+  Pager* pager = table->pager;
+  if (pager_num_available_pages(pager) < memtable_pages_needed(table) &&
+      (memtable.num_rows > 0 || num_runs > 0)) {
+    lsm_settle(table);
+  }
+  if (pager_num_available_pages(pager) < memtable_pages_needed(table)) {
+    return EXECUTE_TABLE_FULL;
+  }
+
+  if (memtable.cells == NULL) {
+    memtable.cells = db_malloc((size_t)memtable_capacity * LEAF_NODE_CELL_SIZE);
+    memtable.order = db_malloc(memtable_capacity * sizeof(uint32_t));
+  }
+  uint32_t position = memtable_lower_bound(key);
+  uint32_t index = memtable.num_rows;
+  uint8_t* cell = memtable.cells + index * LEAF_NODE_CELL_SIZE;
+  memcpy(cell, key, LEAF_NODE_KEY_SIZE);
+  serialize_row(row, cell + LEAF_NODE_KEY_SIZE);
+  memmove(memtable.order + position + 1, memtable.order + position,
+          (memtable.num_rows - position) * sizeof(uint32_t));
+  memtable.order[position] = index;
+  memtable.num_rows++;
+  table_add_rows(table, table->root_page_num, 1);
+
+  if (memtable.num_rows == memtable_capacity) {
+    if (num_runs == sizeof(runs) / sizeof(Run)) {
+      lsm_merge(table, UINT32_MAX);  // merging has fallen behind
+    }
+    memtable_flush(table);
+  }
+  return EXECUTE_SUCCESS;
+}
+
+/*
+ * The viewing table's bloom filter (see the page layout) checked before
+ * an insert looks for a duplicate and before a key = <value> lookup
+ * descends the tree. With log-structured ingest an insert the filter
+ * rules out reads no page at all.
+ */
+int32_t bloom_filter_option = -1;  // bits per key, -1 keeps the file's
+
+void* bloom_filter_page(Pager* pager) {
+  uint32_t page_num = *file_header_bloom_filter_page(file_header(pager));
+  if (page_num == 0) {
+    return NULL;
+  }
+  return get_page(pager, page_num);
+}
+
+/*
+The filter on the page; its bits stay on the page, so they are only
+good until the statement ends
+*/
+void bloom_filter_view(void* page, BloomFilter* filter) {
+  filter->bits = bloom_filter_bits(page);
+  filter->num_bits = *bloom_filter_num_bits(page);
+  filter->num_hashes = *bloom_filter_num_hashes(page);
+}
+
+/*
+Build the filter from every key of the viewing table, reusing its page
+if it has one. Returns false if there is no page left for it.
+*/
+bool bloom_filter_build(Table* table, uint32_t bits_per_key) {
+  Pager* pager = table->pager;
+  void* header = file_header(pager);
+  uint32_t page_num = *file_header_bloom_filter_page(header);
+  if (page_num == 0) {
+    if (pager_num_available_pages(pager) == 0) {
+      return false;
+    }
+    page_num = get_unused_page_num(pager);
+    *file_header_bloom_filter_page(header) = page_num;
+  }
+  void* page = get_page(pager, page_num);
+  memset(page, 0, PAGE_USABLE_SIZE);
+  set_node_type(page, NODE_BLOOM_FILTER);
+
+  uint32_t num_rows = *file_header_num_rows(header);
+  uint32_t capacity = 2 * num_rows;
+  if (capacity < BLOOM_FILTER_MIN_KEYS) {
+    capacity = BLOOM_FILTER_MIN_KEYS;
+  }
+  uint32_t num_bits = bloom_filter_max_bits();
+  if ((uint64_t)capacity * bits_per_key < num_bits) {
+    num_bits = capacity * bits_per_key;
+  }
+  // k = ln 2 * bits per key hashes give the fewest false positives
+  uint32_t num_hashes = (bits_per_key * 69 + 50) / 100;
+  *bloom_filter_bits_per_key(page) = bits_per_key;
+  *bloom_filter_num_hashes(page) = num_hashes > 0 ? num_hashes : 1;
+  *bloom_filter_num_bits(page) = num_bits;
+  *bloom_filter_num_rows(page) = num_rows;
+
+  BloomFilter filter;
+  bloom_filter_view(page, &filter);
+  for (uint32_t i = 0; i < table_num_trees(table); i++) {
+    Cursor cursor;
+    table_start(table, table_tree_root(table, i), &cursor);
+    while (!cursor.end_of_table) {
+      void* node = get_page(pager, cursor.page_num);
+      bloom_add(&filter, leaf_node_key(node, cursor.cell_num));
+      cursor_advance(&cursor);
+    }
+  }
+  // Rows log-structured ingest still holds are in no tree yet
+  for (uint32_t i = 0; i < memtable.num_rows; i++) {
+    bloom_add(&filter, memtable_key(i));
+  }
+  for (uint32_t i = 0; i < num_runs; i++) {
+    Run* run = &(runs[i]);
+    for (uint32_t row = run->num_merged; row < run->num_rows; row++) {
+      void* node = get_page(pager, run->page_nums[row / LEAF_NODE_MAX_CELLS]);
+      bloom_add(&filter, leaf_node_key(node, row % LEAF_NODE_MAX_CELLS));
+    }
+  }
+  *bloom_filter_num_keys(page) = num_rows;
+  return true;
+}
+
+void bloom_filter_drop(Table* table) {
+  void* header = file_header(table->pager);
+  uint32_t page_num = *file_header_bloom_filter_page(header);
+  if (page_num != 0) {
+    *file_header_bloom_filter_page(header) = 0;
+    pager_free_page(table->pager, page_num);
+  }
+}
+
+/*
+Apply --bloom-filter to the file just opened, and rebuild a filter that
+missed changes to the table
+*/
+void bloom_filter_open(Table* table) {
+  void* page = bloom_filter_page(table->pager);
+  if (bloom_filter_option == 0) {
+    bloom_filter_drop(table);
+    return;
+  }
+  uint32_t bits_per_key = bloom_filter_option;
+  if (page != NULL) {
+    if (bloom_filter_option < 0) {
+      bits_per_key = *bloom_filter_bits_per_key(page);
+    }
+    if (bits_per_key == *bloom_filter_bits_per_key(page) &&
+        *bloom_filter_num_rows(page) ==
+            *file_header_num_rows(file_header(table->pager))) {
+      return;
+    }
+  } else if (bloom_filter_option < 0) {
+    return;
+  }
+  if (!bloom_filter_build(table, bits_per_key)) {
+    printf("No room for a bloom filter.\n");
+  }
+}
+
+/*
+False if the viewing table has a bloom filter and key was never added
+to it
+*/
+bool bloom_filter_may_contain(Table* table, char* key) {
+  void* page = bloom_filter_page(table->pager);
+  if (page == NULL) {
+    return true;
+  }
+  BloomFilter filter;
+  bloom_filter_view(page, &filter);
+  if (bloom_may_contain(&filter, key)) {
+    return true;
+  }
+  metrics_add(METRIC_BLOOM_FILTER_NEGATIVES, 1);
+  return false;
+}
+
+/*
+Add the key of a new row, building the filter again at twice the size
+once it holds more keys than it was sized for
+*/
+void bloom_filter_add(Table* table, char* key) {
+  void* page = bloom_filter_page(table->pager);
+  if (page == NULL) {
+    return;
+  }
+  uint32_t bits_per_key = *bloom_filter_bits_per_key(page);
+  uint32_t num_keys = *bloom_filter_num_keys(page) + 1;
+  if (*bloom_filter_num_bits(page) < bloom_filter_max_bits() &&
+      (uint64_t)num_keys * bits_per_key > *bloom_filter_num_bits(page)) {
+    bloom_filter_build(table, bits_per_key);
+    return;
+  }
+  BloomFilter filter;
+  bloom_filter_view(page, &filter);
+  bloom_add(&filter, key);
+  *bloom_filter_num_keys(page) = num_keys;
+}
+
+/*
+Lock the database file for a statement under --shared, a write lock
+if it may change the file, and catch up with changes other processes
+made since the last one
+*/
+ExecuteResult db_begin_statement(Table* table, bool writes) {
+  Pager* pager = table->pager;
+  if (!shared_access) {
+    return EXECUTE_SUCCESS;
+  }
+  short type = writes ? F_WRLCK : F_RDLCK;
+  if (!pager_lock(pager->file_descriptor, type, LOCK_TIMEOUT_MILLISECONDS)) {
+    return EXECUTE_DATABASE_LOCKED;
+  }
+  pager->lock = type;
+
+  while (pager_file_replaced(pager->file_descriptor, pager->filename)) {
+    // A process without --shared vacuumed the database into a new file
+    // between statements; move over to it and read everything again.
+    // Counts never go down from 0, so the next check always reloads.
+    close(pager->file_descriptor);
+    pager->file_descriptor = pager_open_file(pager->filename, pager->direct);
+    pager->change_counter = UINT32_MAX;
+    if (!pager_lock(pager->file_descriptor, type,
+                    LOCK_TIMEOUT_MILLISECONDS)) {
+      pager->lock = F_UNLCK;
+      return EXECUTE_DATABASE_LOCKED;
+    }
+  }
+
+  uint32_t change_counter = pager_read_change_counter(pager);
+  if (change_counter == pager->change_counter) {
+    return EXECUTE_SUCCESS;
+  }
+  pager_drop_cache(pager);
+  pager->change_counter = change_counter;
+  hash_index_forget();
+  table->root_page_num = *file_header_root_page(file_header(pager));
+  dictionary_free(table->dictionary);
+  table->dictionary = dictionary_load(pager);
+  void* catalog_page = catalog(pager);
+  for (uint32_t i = 0; i < *catalog_num_tables(catalog_page); i++) {
+    row_codec_build(catalog_page, i, &(table->codecs[i]));
+  }
+  return EXECUTE_SUCCESS;
+}
+
+/*
+Work done between statements: merging runs into the tree and trimming
+the page cache. Under --shared a writer's changes go to the file and
+the lock is released.
+*/
+void db_end_statement(Table* table) {
+  Pager* pager = table->pager;
+  if (num_runs > 0) {
+    lsm_merge(table, LSM_MERGE_ROWS);
+  }
+  if (shared_access && pager->lock == F_WRLCK) {
+    pager_commit(pager);
+  }
+  pager_end_statement(pager);
+  if (shared_access && pager->lock != F_UNLCK) {
+    pager_lock(pager->file_descriptor, F_UNLCK, 0);
+    pager->lock = F_UNLCK;
+  }
+}
+
+/*
+True if inserting into node, a leaf of the tree at root_page_num holding
+num_cells cells, could need more pages than are left. Only a full leaf
+splits, but its split can cascade up to the root and then needs a new
+root as well.
+*/
+bool leaf_insert_out_of_pages(Table* table, uint32_t root_page_num,
+                              void* node, uint32_t num_cells) {
+  return num_cells >= leaf_node_max_cells(node) &&
+         pager_num_available_pages(table->pager) <
+             tree_depth(table->pager, root_page_num) + 1;
+}
+
+ExecuteResult execute_insert(Statement* statement, Table* table) {
+  Row* row_to_insert = &(statement->row_to_insert);
+  char* title = row_to_insert->title;
+  char* date = row_to_insert->date;
+  char key[LEAF_NODE_KEY_SIZE];
+  row_key(row_to_insert, key);
+
+  uint32_t root_page_num;
+  ExecuteResult result = table_insert_root(table, date, &root_page_num);
+  if (result != EXECUTE_SUCCESS) {
+    return result;
+  }
+  bool buffered = memtable_capacity > 0 &&
+                  !*partition_is_partitioned(partition_directory(table->pager));
+  bool may_exist = bloom_filter_may_contain(table, key);
+  // A buffered row needs no leaf, so a key the filter rules out is
+  // inserted without reading the tree
+  Cursor cursor;
+  void* node = NULL;
+  uint32_t num_cells = 0;
+  if (!buffered || may_exist) {
+    table_find(table, root_page_num, key, &cursor);
+    node = get_page(table->pager, cursor.page_num);
+    num_cells = *leaf_node_num_cells(node);
+  }
+  if (may_exist) {
+    if (cursor.cell_num < num_cells &&
+        strncmp(key, leaf_node_key(node, cursor.cell_num),
+                LEAF_NODE_KEY_SIZE) == 0) {
+      return EXECUTE_DUPLICATE_KEY;
+    }
+    if (buffered && lsm_find(table, key) != NULL) {
+      return EXECUTE_DUPLICATE_KEY;
+    }
+    if (bloom_filter_page(table->pager) != NULL) {
+      metrics_add(METRIC_BLOOM_FILTER_FALSE_POSITIVES, 1);
+    }
+  }
+
+  result = dictionary_encode(table, title, &(row_to_insert->title_code));
+  if (result == EXECUTE_SUCCESS) {
+    result = dictionary_encode(table, row_to_insert->provider,
+                               &(row_to_insert->provider_code));
+  }
+  if (result != EXECUTE_SUCCESS) {
+    return result;
+  }
+  if (buffered) {
+    result = memtable_insert(table, key, row_to_insert);
+    if (result != EXECUTE_TABLE_FULL) {
+      if (result == EXECUTE_SUCCESS) {
+        bloom_filter_add(table, key);
+      }
+      return result;
+    }
+    // Too few pages are left to buffer it, and every buffered row is in
+    // the tree now, so the row goes straight into a leaf with room
+    table_find(table, root_page_num, key, &cursor);
+    node = get_page(table->pager, cursor.page_num);
+    num_cells = *leaf_node_num_cells(node);
+  }
+
+  if (leaf_insert_out_of_pages(table, root_page_num, node, num_cells)) {
+    return EXECUTE_TABLE_FULL;
+  }
+
+  uint8_t value[ROW_SIZE];
+  serialize_row(row_to_insert, value);
+  leaf_node_insert(&cursor, key, value);
+  if (hash_index != NULL && num_cells < leaf_node_max_cells(node)) {
+    // Without a split the row is where the cursor points
+    hash_index_store(table, root_page_num, key, &cursor);
+  }
+  table_add_rows(table, root_page_num, 1);
+  bloom_filter_add(table, key);
+
+  return EXECUTE_SUCCESS;
+}
+
+bool compare_matches(CompareOp op, int cmp) {
+  switch (op) {
+    case (COMPARE_EQUAL):
+      return cmp == 0;
+    case (COMPARE_NOT_EQUAL):
+      return cmp != 0;
+    case (COMPARE_LESS):
+      return cmp < 0;
+    case (COMPARE_LESS_EQUAL):
+      return cmp <= 0;
+    case (COMPARE_GREATER):
+      return cmp > 0;
+    case (COMPARE_GREATER_EQUAL):
+      return cmp >= 0;
+  }
+  return false;
+}
+
+/*
+Compare a dictionary encoded column. Equality only needs the codes;
+ordering needs the strings since codes follow insertion order.
+*/
+int compare_code(Dictionary* dictionary, Predicate* predicate, uint32_t code) {
+  if (predicate->op == COMPARE_EQUAL || predicate->op == COMPARE_NOT_EQUAL) {
+    return code == predicate->code ? 0 : 1;
+  }
+  return strcmp(dictionary_decode(dictionary, code), predicate->value);
+}
+
+/*
+Title and provider are compared by dictionary code,
+so they are never decoded for rows that do not match
+*/
+bool row_matches(Dictionary* dictionary, Predicate* predicate, char* key,
+                 Row* row) {
+  int cmp = 0;
+  switch (predicate->column) {
+    case (COLUMN_STB):
+      cmp = strcmp(row->stb, predicate->value);
+      break;
+    case (COLUMN_TITLE):
+      cmp = compare_code(dictionary, predicate, row->title_code);
+      break;
+    case (COLUMN_PROVIDER):
+      cmp = compare_code(dictionary, predicate, row->provider_code);
+      break;
+    case (COLUMN_DATE):
+      cmp = strcmp(row->date, predicate->value);
+      break;
+    case (COLUMN_REV):
+      cmp = (row->rev > predicate->rev) - (row->rev < predicate->rev);
+      break;
+    case (COLUMN_TIME):
+      cmp = strcmp(row->time, predicate->value);
+      break;
+    case (COLUMN_KEY):
+      cmp = strncmp(key, predicate->value, LEAF_NODE_KEY_SIZE);
+      break;
+  }
+  return compare_matches(predicate->op, cmp);
+}
+
+bool statement_matches(Statement* statement, Dictionary* dictionary, char* key,
+                       Row* row) {
+  for (uint32_t i = 0; i < statement->num_predicates; i++) {
+    if (!row_matches(dictionary, &(statement->predicates[i]), key, row)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+Resolve title/provider values to dictionary codes once per statement.
+Unknown strings have no code and so are equal to no row.
+*/
+void statement_resolve_codes(Statement* statement, Dictionary* dictionary) {
+  for (uint32_t i = 0; i < statement->num_predicates; i++) {
+    Predicate* predicate = &(statement->predicates[i]);
+    predicate->code = dictionary_lookup(dictionary, predicate->value);
+  }
+}
+
+/*
+True if no row of the given tree can match the statement's date
+predicates. A partition holds exactly the dates starting with its
+month, so comparing the month with the value's month prefix decides
+it without reading a page of the tree.
+*/
+bool table_tree_pruned(Table* table, uint32_t tree_num, Statement* statement) {
+  void* directory = partition_directory(table->pager);
+  if (!*partition_is_partitioned(directory)) {
+    return false;
+  }
+
+  char* month = partition_name(directory, tree_num);
+  for (uint32_t i = 0; i < statement->num_predicates; i++) {
+    Predicate* predicate = &(statement->predicates[i]);
+    if (predicate->column != COLUMN_DATE) {
+      continue;
+    }
+    int cmp = strncmp(month, predicate->value, PARTITION_MONTH_SIZE);
+    switch (predicate->op) {
+      case (COMPARE_EQUAL):
+        if (cmp != 0) {
+          return true;
+        }
+        break;
+      case (COMPARE_LESS):
+      case (COMPARE_LESS_EQUAL):
+        if (cmp > 0) {
+          return true;
+        }
+        break;
+      case (COMPARE_GREATER):
+      case (COMPARE_GREATER_EQUAL):
+        if (cmp < 0) {
+          return true;
+        }
+        break;
+      case (COMPARE_NOT_EQUAL):
+        break;
+    }
+  }
+  return false;
+}
+
+/*
+The smallest key a row matching the statement can have. A lower bound
+on key, or an stb equality (which fixes the key prefix), lets a scan
+start inside the tree instead of at the first leaf.
+*/
+void scan_start_key(Statement* statement, char* start_key) {
+  start_key[0] = 0;
+  char candidate[LEAF_NODE_KEY_SIZE];
+  for (uint32_t i = 0; i < statement->num_predicates; i++) {
+    Predicate* predicate = &(statement->predicates[i]);
+    if (predicate->column == COLUMN_KEY &&
+        (predicate->op == COMPARE_EQUAL || predicate->op == COMPARE_GREATER ||
+         predicate->op == COMPARE_GREATER_EQUAL)) {
+      snprintf(candidate, sizeof(candidate), "%s", predicate->value);
+    } else if (predicate->column == COLUMN_STB &&
+               predicate->op == COMPARE_EQUAL) {
+      snprintf(candidate, sizeof(candidate), "%s_", predicate->value);
+    } else {
+      continue;
+    }
+    if (strncmp(candidate, start_key, LEAF_NODE_KEY_SIZE) > 0) {
+      strcpy(start_key, candidate);
+    }
+  }
+}
+
+/*
+True if the statement asks for the row whose key is start_key
+*/
+bool statement_is_point_lookup(Statement* statement, char* start_key) {
+  for (uint32_t i = 0; i < statement->num_predicates; i++) {
+    Predicate* predicate = &(statement->predicates[i]);
+    if (predicate->column == COLUMN_KEY && predicate->op == COMPARE_EQUAL &&
+        strncmp(predicate->value, start_key, LEAF_NODE_KEY_SIZE) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+The buffered row a key = <value> lookup asks for, if log-structured
+ingest still holds it
+*/
+void* lsm_point_lookup(Table* table, Statement* statement) {
+  char start_key[LEAF_NODE_KEY_SIZE];
+  scan_start_key(statement, start_key);
+  if (!statement_is_point_lookup(statement, start_key)) {
+    return NULL;
+  }
+  return lsm_find(table, start_key);
+}
+
+/*
+True if the statement is a key = <value> lookup of a key the viewing
+table's bloom filter rules out
+*/
+bool bloom_filter_rules_out(Table* table, Statement* statement) {
+  char start_key[LEAF_NODE_KEY_SIZE];
+  scan_start_key(statement, start_key);
+  return statement_is_point_lookup(statement, start_key) &&
+         !bloom_filter_may_contain(table, start_key);
+}
+
+/*
+Position a cursor at the first row of the tree that can match the
+statement
+*/
+void table_scan_start(Table* table, uint32_t root_page_num,
+                      Statement* statement, Cursor* cursor) {
+  char start_key[LEAF_NODE_KEY_SIZE];
+  scan_start_key(statement, start_key);
+  bool point_lookup =
+      hash_index != NULL && statement_is_point_lookup(statement, start_key);
+  if (point_lookup &&
+      hash_index_find(table, root_page_num, start_key, cursor)) {
+    return;
+  }
+  table_find(table, root_page_num, start_key, cursor);
+  if (point_lookup) {
+    hash_index_store(table, root_page_num, start_key, cursor);
+  }
+  void* node = get_page(table->pager, cursor->page_num);
+  if (cursor->cell_num >= *leaf_node_num_cells(node)) {
+    // Every key in this leaf is smaller, start at the next one
+    uint32_t next_page_num = *leaf_node_next_leaf(node);
+    if (next_page_num == 0) {
+      cursor->end_of_table = true;
+    } else {
+      cursor->page_num = next_page_num;
+      cursor->cell_num = 0;
+    }
+  }
+}
+
+/*
+True once key is beyond every row the statement can match,
+so the scan can stop
+*/
+bool key_past_range(Statement* statement, char* key) {
+  for (uint32_t i = 0; i < statement->num_predicates; i++) {
+    Predicate* predicate = &(statement->predicates[i]);
+    if (predicate->column == COLUMN_KEY) {
+      int cmp = strncmp(key, predicate->value, LEAF_NODE_KEY_SIZE);
+      if ((predicate->op == COMPARE_LESS && cmp >= 0) ||
+          ((predicate->op == COMPARE_LESS_EQUAL ||
+            predicate->op == COMPARE_EQUAL) &&
+           cmp > 0)) {
+        return true;
+      }
+    } else if (predicate->column == COLUMN_STB &&
+               predicate->op == COMPARE_EQUAL) {
+      uint32_t length = strlen(predicate->value);
+      int cmp = strncmp(key, predicate->value, length);
+      if (cmp > 0 || (cmp == 0 && key[length] > '_')) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+/*
+ * Streams the cells of a table: the viewing table's rows matching the
+ * statement's where clause, or every row of a created table
+ */
+struct RowScan_t {
+  Table* table;
+  bool is_viewing;
+  uint32_t root_page_num;  // created tables only
+  Statement* statement;
+  uint32_t tree_num;
+  bool started;
+  Cursor cursor;
+  OperatorStats* stats;  // only under explain analyze
+  bool nonblocking;       // return instead of waiting for a page read
+  uint32_t waiting_page;  // the page it returned for, 0 if none
+};
+typedef struct RowScan_t RowScan;
+
+void row_scan_init(RowScan* scan, Table* table, bool is_viewing,
+                   uint32_t root_page_num, Statement* statement) {
+  scan->table = table;
+  scan->is_viewing = is_viewing;
+  scan->root_page_num = root_page_num;
+  scan->statement = statement;
+  scan->tree_num = 0;
+  scan->started = false;
+  scan->stats = NULL;
+  scan->nonblocking = false;
+  scan->waiting_page = 0;
+  if (profile != NULL) {
+    scan->stats =
+        &(profile->steps[is_viewing ? PLAN_SCAN : PLAN_TABLE_SCAN].actual);
+  }
+}
+
+/*
+Return the cell of the next matching row, or NULL at the end. A
+nonblocking scan also returns NULL, with waiting_page set, when the next
+step needs a page that is still being read; calling it again once the
+page is in picks up where it stopped.
+*/
+void* row_scan_fetch(RowScan* scan) {
+  Table* table = scan->table;
+  Statement* statement = scan->statement;
+  Row row;
+  while (true) {
+    if (!scan->started) {
+      if (!scan->is_viewing) {
+        if (scan->tree_num > 0) {
+          return NULL;
+        }
+        table_start(table, scan->root_page_num, &(scan->cursor));
+      } else {
+        if (scan->tree_num == 0 && bloom_filter_rules_out(table, statement)) {
+          scan->tree_num = table_num_trees(table);
+          return NULL;
+        }
+        while (scan->tree_num < table_num_trees(table) &&
+               table_tree_pruned(table, scan->tree_num, statement)) {
+          scan->tree_num++;
+        }
+        if (scan->tree_num >= table_num_trees(table)) {
+          return NULL;
+        }
+        if (scan->nonblocking) {
+          char start_key[LEAF_NODE_KEY_SIZE];
+          scan_start_key(statement, start_key);
+          scan->waiting_page = table_find_missing_page(
+              table, table_tree_root(table, scan->tree_num), start_key);
+          if (scan->waiting_page != 0) {
+            return NULL;
+          }
+        }
+        if (scan->tree_num == 0 && memtable_capacity > 0) {
+          void* cell = lsm_point_lookup(table, statement);
+          if (cell != NULL) {
+            // Buffered rows are in no tree, so this is the only match
+            scan->tree_num = table_num_trees(table);
+            Row row;
+            deserialize_row(cell + LEAF_NODE_KEY_SIZE, &row);
+            if (statement_matches(statement, table->dictionary, cell, &row)) {
+              return cell;
+            }
+            return NULL;
+          }
+        }
+        table_scan_start(table, table_tree_root(table, scan->tree_num),
+                         statement, &(scan->cursor));
+      }
+      scan->started = true;
+    } else if (scan->waiting_page != 0) {
+      // The cursor already moved onto the page that was being read
+      scan->waiting_page = 0;
+    } else {
+      cursor_advance(&(scan->cursor));
+    }
+
+    Cursor* cursor = &(scan->cursor);
+    if (scan->nonblocking &&
+        !pager_page_ready(table->pager, cursor->page_num)) {
+      scan->waiting_page = cursor->page_num;
+      return NULL;
+    }
+    void* node = get_page(table->pager, cursor->page_num);
+    char* key = cursor->end_of_table ? NULL
+                                     : leaf_node_key(node, cursor->cell_num);
+    if (key != NULL) {
+      metrics_add(METRIC_ROWS_SCANNED, 1);
+    }
+    if (key == NULL ||
+        (scan->is_viewing && key_past_range(statement, key))) {
+      scan->tree_num++;
+      scan->started = false;
+      continue;
+    }
+    if (scan->is_viewing) {
+      deserialize_row(leaf_node_value(node, cursor->cell_num), &row);
+      if (!statement_matches(statement, table->dictionary, key, &row)) {
+        continue;
+      }
+    }
+    return leaf_node_cell(node, cursor->cell_num);
+  }
+}
+
+/*
+Return the cell of the next row, or NULL at the end
+*/
+void* row_scan_next(RowScan* scan) {
+  OperatorStats* stats = scan->stats;
+  if (stats == NULL) {
+    return row_scan_fetch(scan);
+  }
+
+  uint64_t* counters = metrics_local()->counters;
+  uint64_t start = now_nanoseconds();
+  uint64_t page_reads = counters[METRIC_CACHE_MISSES];
+  uint64_t cache_hits = counters[METRIC_CACHE_HITS];
+  void* cell = row_scan_fetch(scan);
+  stats->nanoseconds += now_nanoseconds() - start;
+  stats->page_reads += counters[METRIC_CACHE_MISSES] - page_reads;
+  stats->cache_hits += counters[METRIC_CACHE_HITS] - cache_hits;
+  if (cell != NULL) {
+    stats->rows++;
+  }
+  return cell;
+}
+
+/*
+ * order by. With a limit the best rows seen so far are kept in a heap
+ * while the scan runs. Otherwise rows are sorted in runs that fit in
+ * sort_memory_budget, which are spilled to temp files when there is
+ * more than one and merged, SORT_MAX_MERGE_WIDTH runs at a time.
+ */
+const uint32_t DEFAULT_SORT_MEMORY_BUDGET = 16 * 1024 * 1024;
+const uint32_t SORT_MAX_MERGE_WIDTH = 64;
+uint32_t sort_memory_budget = DEFAULT_SORT_MEMORY_BUDGET;
+
+struct SortOrder_t {
+  Dictionary* dictionary;
+  Column column;
+  bool descending;
+};
+typedef struct SortOrder_t SortOrder;
+
+/* The order qsort's comparator sorts by */
+SortOrder sort_order;
+
+/*
+Compare two cells of the viewing table by the order by column,
+then by key so equal values come out in a fixed order
+*/
+int compare_cells(SortOrder* order, void* a, void* b) {
+  void* a_value = a + LEAF_NODE_KEY_SIZE;
+  void* b_value = b + LEAF_NODE_KEY_SIZE;
+  int cmp = 0;
+  uint32_t a_code, b_code;
+  float a_rev, b_rev;
+  switch (order->column) {
+    case (COLUMN_STB):
+      cmp = strcmp(a_value + STB_OFFSET, b_value + STB_OFFSET);
+      break;
+    case (COLUMN_TITLE):
+    case (COLUMN_PROVIDER): {
+      uint32_t offset = (order->column == COLUMN_TITLE) ? TITLE_CODE_OFFSET
+                                                        : PROVIDER_CODE_OFFSET;
+      memcpy(&a_code, a_value + offset, sizeof(a_code));
+      memcpy(&b_code, b_value + offset, sizeof(b_code));
+      if (a_code != b_code) {
+        cmp = strcmp(dictionary_decode(order->dictionary, a_code),
+                     dictionary_decode(order->dictionary, b_code));
+      }
+      break;
+    }
+    case (COLUMN_DATE):
+      cmp = strcmp(a_value + DATE_OFFSET, b_value + DATE_OFFSET);
+      break;
+    case (COLUMN_REV):
+      memcpy(&a_rev, a_value + REV_OFFSET, sizeof(a_rev));
+      memcpy(&b_rev, b_value + REV_OFFSET, sizeof(b_rev));
+      cmp = (a_rev > b_rev) - (a_rev < b_rev);
+      break;
+    case (COLUMN_TIME):
+      cmp = strcmp(a_value + TIME_OFFSET, b_value + TIME_OFFSET);
+      break;
+    default:
+      break;
+  }
+  if (cmp == 0) {
+    cmp = strcmp(a, b);
+  }
+  return order->descending ? -cmp : cmp;
+}
+
+int compare_cell_pointers(const void* a, const void* b) {
+  return compare_cells(&sort_order, *(void**)a, *(void**)b);
+}
+
+void print_cell(Table* table, void* cell) {
+  Row row;
+  deserialize_row(cell + LEAF_NODE_KEY_SIZE, &row);
+  decode_row(table->dictionary, &row);
+  print_row(&row);
+}
+
+/*
+Restore the heap below index. The root is the row that sorts last,
+so it is the one a better row replaces.
+*/
+void sort_heap_sift_down(SortOrder* order, void** heap, uint32_t size,
+                         uint32_t index) {
+  while (true) {
+    uint32_t largest = index;
+    uint32_t left = 2 * index + 1;
+    uint32_t right = left + 1;
+    if (left < size && compare_cells(order, heap[left], heap[largest]) > 0) {
+      largest = left;
+    }
+    if (right < size && compare_cells(order, heap[right], heap[largest]) > 0) {
+      largest = right;
+    }
+    if (largest == index) {
+      return;
+    }
+    void* swap = heap[index];
+    heap[index] = heap[largest];
+    heap[largest] = swap;
+    index = largest;
+  }
+}
+
+void sort_heap_sift_up(SortOrder* order, void** heap, uint32_t index) {
+  while (index > 0) {
+    uint32_t parent = (index - 1) / 2;
+    if (compare_cells(order, heap[index], heap[parent]) <= 0) {
+      return;
+    }
+    void* swap = heap[index];
+    heap[index] = heap[parent];
+    heap[parent] = swap;
+    index = parent;
+  }
+}
+
+/*
+Keep the first limit rows in sort order in a heap of that size
+*/
+void select_top_n(Table* table, Statement* statement, uint32_t limit) {
+  uint8_t* cells = db_malloc((size_t)limit * LEAF_NODE_CELL_SIZE);
+  void** heap = db_malloc(limit * sizeof(void*));
+  uint32_t size = 0;
+
+  RowScan scan;
+  row_scan_init(&scan, table, true, 0, statement);
+  void* cell;
+  while ((cell = row_scan_next(&scan)) != NULL) {
+    if (size < limit) {
+      heap[size] = cells + (size_t)size * LEAF_NODE_CELL_SIZE;
+      memcpy(heap[size], cell, LEAF_NODE_CELL_SIZE);
+      sort_heap_sift_up(&sort_order, heap, size);
+      size++;
+    } else if (compare_cells(&sort_order, cell, heap[0]) < 0) {
+      memcpy(heap[0], cell, LEAF_NODE_CELL_SIZE);
+      sort_heap_sift_down(&sort_order, heap, size, 0);
+    }
+  }
+
+  qsort(heap, size, sizeof(void*), compare_cell_pointers);
+  for (uint32_t i = 0; i < size; i++) {
+    print_cell(table, heap[i]);
+  }
+  free(heap);
+  free(cells);
+}
+
+FILE* sort_write_run(void** cells, uint32_t num_cells) {
+  FILE* run = tmpfile();
+  if (run == NULL) {
+    printf("Unable to create sort run file: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  if (profile != NULL) {
+    profile->sort_runs++;
+  }
+  for (uint32_t i = 0; i < num_cells; i++) {
+    if (fwrite(cells[i], LEAF_NODE_CELL_SIZE, 1, run) != 1) {
+      printf("Error writing sort run file: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+  }
+  rewind(run);
+  return run;
+}
+
+/*
+Merge sorted runs into output, or print them if output is NULL.
+Each run is closed once it is used up. Returns the rows left to print.
+*/
+uint32_t sort_merge_runs(Table* table, FILE** runs, uint32_t num_runs,
+                         FILE* output, uint32_t remaining) {
+  uint8_t* cells = db_malloc((size_t)num_runs * LEAF_NODE_CELL_SIZE);
+  // Heap of the runs' current cells, the one that sorts first on top
+  void** heap = db_malloc(num_runs * sizeof(void*));
+  SortOrder reverse = sort_order;
+  reverse.descending = !reverse.descending;
+  uint32_t size = 0;
+  for (uint32_t i = 0; i < num_runs; i++) {
+    void* cell = cells + (size_t)i * LEAF_NODE_CELL_SIZE;
+    if (fread(cell, LEAF_NODE_CELL_SIZE, 1, runs[i]) == 1) {
+      heap[size] = cell;
+      sort_heap_sift_up(&reverse, heap, size);
+      size++;
+    }
+  }
+
+  while (size > 0 && remaining > 0) {
+    void* cell = heap[0];
+    if (output == NULL) {
+      print_cell(table, cell);
+      remaining--;
+    } else if (fwrite(cell, LEAF_NODE_CELL_SIZE, 1, output) != 1) {
+      printf("Error writing sort run file: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+    uint32_t run = ((uint8_t*)cell - cells) / LEAF_NODE_CELL_SIZE;
+    if (fread(cell, LEAF_NODE_CELL_SIZE, 1, runs[run]) != 1) {
+      heap[0] = heap[--size];
+    }
+    sort_heap_sift_down(&reverse, heap, size, 0);
+  }
+
+  for (uint32_t i = 0; i < num_runs; i++) {
+    fclose(runs[i]);
+  }
+  free(heap);
+  free(cells);
+  return remaining;
+}
+
+/*
+A limit small enough to keep that many rows in memory is sorted
+with a heap
+*/
+bool select_uses_top_n(Statement* statement) {
+  return statement->has_limit &&
+         (uint64_t)statement->limit * LEAF_NODE_CELL_SIZE <=
+             sort_memory_budget;
+}
+
+/*
+External merge sort of the matching rows, printing the first limit
+*/
+void select_sorted(Table* table, Statement* statement, uint32_t limit) {
+  uint32_t capacity =
+      sort_memory_budget / (LEAF_NODE_CELL_SIZE + sizeof(void*));
+  if (capacity < 2) {
+    capacity = 2;
+  }
+  uint8_t* buffer = db_malloc((size_t)capacity * LEAF_NODE_CELL_SIZE);
+  void** cells = db_malloc(capacity * sizeof(void*));
+  FILE** runs = NULL;
+  uint32_t num_runs = 0;
+  uint32_t num_cells = 0;
+
+  RowScan scan;
+  row_scan_init(&scan, table, true, 0, statement);
+  void* cell;
+  while (true) {
+    cell = row_scan_next(&scan);
+    if (cell == NULL || num_cells == capacity) {
+      qsort(cells, num_cells, sizeof(void*), compare_cell_pointers);
+      if (cell == NULL && num_runs == 0) {
+        // Everything fit in memory
+        for (uint32_t i = 0; i < num_cells && i < limit; i++) {
+          print_cell(table, cells[i]);
+        }
+        break;
+      }
+      if (num_cells > 0) {
+        runs = db_realloc(runs, (num_runs + 1) * sizeof(FILE*));
+        runs[num_runs++] = sort_write_run(cells, num_cells);
+        num_cells = 0;
+      }
+      if (cell == NULL) {
+        break;
+      }
+    }
+    cells[num_cells] = buffer + (size_t)num_cells * LEAF_NODE_CELL_SIZE;
+    memcpy(cells[num_cells], cell, LEAF_NODE_CELL_SIZE);
+    num_cells++;
+  }
+  free(cells);
+  free(buffer);
+
+  // Merge groups of runs into longer runs until one merge is enough
+  while (num_runs > SORT_MAX_MERGE_WIDTH) {
+    uint32_t num_merged = 0;
+    for (uint32_t first = 0; first < num_runs; first += SORT_MAX_MERGE_WIDTH) {
+      uint32_t width = num_runs - first;
+      if (width > SORT_MAX_MERGE_WIDTH) {
+        width = SORT_MAX_MERGE_WIDTH;
+      }
+      FILE* merged = tmpfile();
+      if (merged == NULL) {
+        printf("Unable to create sort run file: %d\n", errno);
+        exit(EXIT_FAILURE);
+      }
+      sort_merge_runs(table, runs + first, width, merged, UINT32_MAX);
+      rewind(merged);
+      runs[num_merged++] = merged;
+    }
+    num_runs = num_merged;
+  }
+  if (num_runs > 0) {
+    sort_merge_runs(table, runs, num_runs, NULL, limit);
+  }
+  free(runs);
+}
+
+ExecuteResult execute_select(Statement* statement, Table* table) {
+  statement_resolve_codes(statement, table->dictionary);
+  uint32_t limit = statement->has_limit ? statement->limit : UINT32_MAX;
+  if (limit == 0) {
+    return EXECUTE_SUCCESS;
+  }
+
+  if (statement->has_order_by) {
+    sort_order.dictionary = table->dictionary;
+    sort_order.column = statement->order_by;
+    sort_order.descending = statement->descending;
+    if (select_uses_top_n(statement)) {
+      select_top_n(table, statement, limit);
+    } else {
+      select_sorted(table, statement, limit);
+    }
+    return EXECUTE_SUCCESS;
+  }
+
+  RowScan scan;
+  row_scan_init(&scan, table, true, 0, statement);
+  void* cell;
+  while (limit > 0 && (cell = row_scan_next(&scan)) != NULL) {
+    print_cell(table, cell);
+    limit--;
+  }
+
+  return EXECUTE_SUCCESS;
+}
+
+/*
+ * A select run as a stackless task: its nonblocking scan holds everything
+ * needed to carry on, so when the scan needs a page that is not cached the
+ * task just returns and other queries run while the prefetch workers
+ * read it.
+ */
+struct QueryTask_t {
+  RowScan scan;
+  uint32_t remaining;  // rows still wanted under the limit
+  uint32_t statement_num;
+  RowCallback callback;
+  void* context;
+};
+typedef struct QueryTask_t QueryTask;
+
+/*
+Only what execute_select does with a plain scan: a select on the viewing
+table, without order by (the rows would have to be held back and sorted)
+and without explain
+*/
+bool query_task_supported(Statement* statement) {
+  return statement->type == STATEMENT_SELECT &&
+         statement->explain == EXPLAIN_NONE && !statement->has_order_by;
+}
+
+void query_task_init(QueryTask* task, Table* table, Statement* statement,
+                     uint32_t statement_num, RowCallback callback,
+                     void* context) {
+  statement_resolve_codes(statement, table->dictionary);
+  row_scan_init(&(task->scan), table, true, 0, statement);
+  task->scan.nonblocking = true;
+  task->remaining = statement->has_limit ? statement->limit : UINT32_MAX;
+  task->statement_num = statement_num;
+  task->callback = callback;
+  task->context = context;
+}
+
+/*
+Run a task until it has to wait for a page. Returns false once it is
+done.
+*/
+bool query_task_step(QueryTask* task) {
+  void* cell;
+  while (task->remaining > 0 &&
+         (cell = row_scan_fetch(&(task->scan))) != NULL) {
+    Row row;
+    deserialize_row(cell + LEAF_NODE_KEY_SIZE, &row);
+    decode_row(task->scan.table->dictionary, &row);
+    task->callback(task->context, task->statement_num, &row);
+    task->remaining--;
+  }
+  return task->remaining > 0 && task->scan.waiting_page != 0;
+}
+
+/*
+Run selects on the viewing table with up to max_tasks of them in flight
+on this thread, switching to another whenever one has to wait for a page,
+so their reads overlap. Each statement's rows are handed to callback, with
+the statement's index, in the order execute_select would print them; the
+rows of different statements are interleaved. Nothing runs if any of the
+statements is not a select this can run.
+*/
+ExecuteResult execute_concurrently(Table* table, Statement* statements,
+                                   uint32_t num_statements, uint32_t max_tasks,
+                                   RowCallback callback, void* context) {
+  for (uint32_t i = 0; i < num_statements; i++) {
+    if (!query_task_supported(&(statements[i]))) {
+      return EXECUTE_UNSUPPORTED;
+    }
+  }
+  // Scans other than point lookups do not look in the memtable
+  lsm_settle(table);
+  if (max_tasks > MAX_QUERY_TASKS) {
+    max_tasks = MAX_QUERY_TASKS;
+  }
+  QueryTask tasks[MAX_QUERY_TASKS];
+  uint32_t num_tasks = 0;
+  uint32_t next_statement = 0;
+  while (num_tasks > 0 || next_statement < num_statements) {
+    while (num_tasks < max_tasks && next_statement < num_statements) {
+      query_task_init(&(tasks[num_tasks++]), table,
+                      &(statements[next_statement]), next_statement,
+                      callback, context);
+      next_statement++;
+    }
+
+    bool progressed = false;
+    uint32_t i = 0;
+    while (i < num_tasks) {
+      uint32_t waiting_page = tasks[i].scan.waiting_page;
+      if (waiting_page != 0 && !pager_page_ready(table->pager, waiting_page)) {
+        i++;
+        continue;
+      }
+      progressed = true;
+      if (query_task_step(&(tasks[i]))) {
+        i++;
+      } else {
+        tasks[i] = tasks[--num_tasks];
+      }
+    }
+    if (!progressed) {
+      pager_wait_for_prefetch(table->pager);
+    }
+  }
+  return EXECUTE_SUCCESS;
+}
+
+/*
+Delete in two passes. First every leaf in the scan range is compacted in
+place, dropping matching cells without touching the rest of the tree.
+Then the leaves that lost cells are merged with or refilled from a
+sibling, so a purge costs one write per leaf rather than a tree
+descent per row.
+*/
+ExecuteResult execute_delete(Statement* statement, Table* table) {
+  Pager* pager = table->pager;
+  statement_resolve_codes(statement, table->dictionary);
+
+  uint32_t changed_leaves[TABLE_MAX_PAGES];
+  uint32_t num_changed_leaves = 0;
+  Row row;
+  for (uint32_t tree_num = 0; tree_num < table_num_trees(table); tree_num++) {
+    if (table_tree_pruned(table, tree_num, statement)) {
+      continue;
+    }
+    uint32_t root_page_num = table_tree_root(table, tree_num);
+    uint32_t num_deleted = 0;
+    Cursor cursor;
+    table_scan_start(table, root_page_num, statement, &cursor);
+    bool past_range = cursor.end_of_table;
+    uint32_t page_num = cursor.page_num;
+    uint32_t cell_num = cursor.cell_num;
+
+    while (!past_range) {
+      void* node = get_page(pager, page_num);
+      uint32_t num_cells = *leaf_node_num_cells(node);
+      uint32_t num_kept = cell_num;
+      for (uint32_t i = cell_num; i < num_cells; i++) {
+        char* key = leaf_node_key(node, i);
+        if (!past_range && key_past_range(statement, key)) {
+          past_range = true;
+        }
+        if (!past_range) {
+          metrics_add(METRIC_ROWS_SCANNED, 1);
+          deserialize_row(leaf_node_value(node, i), &row);
+          if (statement_matches(statement, table->dictionary, key, &row)) {
+            continue;
+          }
+        }
+        if (num_kept != i) {
+          memcpy(leaf_node_cell(node, num_kept), leaf_node_cell(node, i),
+                 leaf_node_cell_size(node));
+        }
+        num_kept++;
+      }
+
+      if (num_kept != num_cells) {
+        *leaf_node_num_cells(node) = num_kept;
+        leaf_node_update_heads(node);
+        changed_leaves[num_changed_leaves++] = page_num;
+        num_deleted += num_cells - num_kept;
+      }
+
+      page_num = *leaf_node_next_leaf(node);
+      cell_num = 0;
+      if (page_num == 0) {
+        break;
+      }
+    }
+    table_add_rows(table, root_page_num, -(int32_t)num_deleted);
+  }
+
+  for (uint32_t i = 0; i < num_changed_leaves; i++) {
+    // Earlier merges may already have freed this leaf
+    uint32_t leaf_page_num = changed_leaves[i];
+    void* node = get_page(pager, leaf_page_num);
+    while (get_node_type(node) == NODE_LEAF && !is_node_root(node) &&
+           *leaf_node_num_cells(node) < leaf_node_min_cells(node)) {
+      leaf_page_num = node_rebalance(table, leaf_page_num);
+      node = get_page(pager, leaf_page_num);
+    }
+  }
+
+  return EXECUTE_SUCCESS;
+}
+
+/*
+Rewrite a non-key column of every matching row in place
+*/
+ExecuteResult execute_update(Statement* statement, Table* table) {
+  statement_resolve_codes(statement, table->dictionary);
+  Predicate* assignment = &(statement->assignment);
+  if (assignment->column == COLUMN_PROVIDER) {
+    ExecuteResult result =
+        dictionary_encode(table, assignment->value, &(assignment->code));
+    if (result != EXECUTE_SUCCESS) {
+      return result;
+    }
+  }
+
+  Row row;
+  for (uint32_t tree_num = 0; tree_num < table_num_trees(table); tree_num++) {
+    if (table_tree_pruned(table, tree_num, statement)) {
+      continue;
+    }
+    Cursor cursor;
+    table_scan_start(table, table_tree_root(table, tree_num), statement,
+                     &cursor);
+    while (!(cursor.end_of_table)) {
+      void* node = get_page(table->pager, cursor.page_num);
+      char* key = leaf_node_key(node, cursor.cell_num);
+      if (key_past_range(statement, key)) {
+        break;
+      }
+      metrics_add(METRIC_ROWS_SCANNED, 1);
+      deserialize_row(cursor_value(&cursor), &row);
+      if (statement_matches(statement, table->dictionary, key, &row)) {
+        switch (assignment->column) {
+          case (COLUMN_PROVIDER):
+            row.provider_code = assignment->code;
+            break;
+          case (COLUMN_REV):
+            row.rev = assignment->rev;
+            break;
+          case (COLUMN_TIME):
+            strcpy(row.time, assignment->value);
+            break;
+          default:
+            break;
+        }
+        serialize_row(&row, cursor_value(&cursor));
+      }
+      cursor_advance(&cursor);
+    }
+  }
+
+  return EXECUTE_SUCCESS;
+}
+
+/*
+Switch an empty table to one tree per month of the date column
+*/
+ExecuteResult execute_partition(Statement* statement, Table* table) {
+  void* root = get_page(table->pager, table->root_page_num);
+  if (get_node_type(root) != NODE_LEAF || *leaf_node_num_cells(root) != 0) {
+    return EXECUTE_TABLE_NOT_EMPTY;
+  }
+
+  void* directory = partition_directory(table->pager);
+  *partition_is_partitioned(directory) = 1;
+  return EXECUTE_SUCCESS;
+}
+
+/*
+Unlink a month's tree from the directory. Its pages are not touched
+now; they are queued and handed out once the free list is empty.
+*/
+ExecuteResult execute_drop_partition(Statement* statement, Table* table) {
+  Pager* pager = table->pager;
+  void* directory = partition_directory(pager);
+  uint32_t num_partitions = *partition_num_partitions(directory);
+  if (!*partition_is_partitioned(directory)) {
+    return EXECUTE_NO_SUCH_PARTITION;
+  }
+  uint32_t index = partition_find(directory, statement->partition);
+  if (index >= num_partitions ||
+      strncmp(statement->partition, partition_name(directory, index),
+              PARTITION_NAME_SIZE) != 0) {
+    return EXECUTE_NO_SUCH_PARTITION;
+  }
+
+  uint32_t num_dropped = *partition_num_dropped(directory);
+  if (num_dropped == PARTITION_MAX_DROPPED) {
+    // Queue is full, release the oldest dropped tree now
+    pager_free_tree(pager, *partition_dropped_root(directory, 0));
+    memmove(partition_dropped_root(directory, 0),
+            partition_dropped_root(directory, 1),
+            (num_dropped - 1) * PARTITION_DROPPED_ROOT_SIZE);
+    num_dropped -= 1;
+  }
+  *partition_dropped_root(directory, num_dropped) =
+      *partition_root(directory, index);
+  *partition_num_dropped(directory) = num_dropped + 1;
+  *file_header_num_rows(file_header(pager)) -=
+      *partition_num_rows(directory, index);
+
+  memmove(partition_entry(directory, index),
+          partition_entry(directory, index + 1),
+          (num_partitions - index - 1) * PARTITION_ENTRY_SIZE);
+  *partition_num_partitions(directory) = num_partitions - 1;
+  return EXECUTE_SUCCESS;
+}
+
+/*
+Add a table to the catalog with an empty tree whose cells
+are laid out by the new table's row codec
+*/
+ExecuteResult execute_create_table(Statement* statement, Table* table) {
+  Pager* pager = table->pager;
+  void* catalog_page = catalog(pager);
+  uint32_t index = catalog_find(catalog_page, statement->table_name);
+  if (index < *catalog_num_tables(catalog_page)) {
+    return EXECUTE_TABLE_EXISTS;
+  }
+  if (index >= CATALOG_MAX_TABLES) {
+    return EXECUTE_TABLE_FULL;
+  }
+
+  memset(catalog_table(catalog_page, index), 0, CATALOG_TABLE_SIZE);
+  strcpy(catalog_table_name(catalog_page, index), statement->table_name);
+  *catalog_table_num_columns(catalog_page, index) = statement->num_columns;
+  for (uint32_t i = 0; i < statement->num_columns; i++) {
+    ColumnDefinition* column = &(statement->columns[i]);
+    strcpy(catalog_column_name(catalog_page, index, i), column->name);
+    *catalog_column_type(catalog_page, index, i) = column->type;
+    *catalog_column_length(catalog_page, index, i) = column->length;
+  }
+  RowCodec* codec = &(table->codecs[index]);
+  row_codec_build(catalog_page, index, codec);
+  // Splitting a leaf needs room for at least three cells
+  if (leaf_node_capacity(codec->key_size + codec->value_size) < 3) {
+    return EXECUTE_ROW_TOO_LARGE;
+  }
+
+  uint32_t root_page_num = get_unused_page_num(pager);
+  if (root_page_num >= TABLE_MAX_PAGES) {
+    return EXECUTE_TABLE_FULL;
+  }
+  void* root = get_page(pager, root_page_num);
+  initialize_leaf_node(root, codec->key_size, codec->value_size);
+  set_node_root(root, true);
+
+  *catalog_table_root(catalog_page, index) = root_page_num;
+  *catalog_table_num_rows(catalog_page, index) = 0;
+  *catalog_num_tables(catalog_page) = index + 1;
+  return EXECUTE_SUCCESS;
+}
+
+ExecuteResult execute_insert_into(Statement* statement, Table* table) {
+  void* catalog_page = catalog(table->pager);
+  uint32_t index = catalog_find(catalog_page, statement->table_name);
+  if (index >= *catalog_num_tables(catalog_page)) {
+    return EXECUTE_NO_SUCH_TABLE;
+  }
+  RowCodec* codec = &(table->codecs[index]);
+  if (statement->num_values != codec->num_fields) {
+    return EXECUTE_BAD_VALUE;
+  }
+
+  Value row[CATALOG_MAX_COLUMNS];
+  for (uint32_t i = 0; i < codec->num_fields; i++) {
+    if (!parse_value(&(codec->fields[i]), statement->values[i], &(row[i]))) {
+      return EXECUTE_BAD_VALUE;
+    }
+  }
+  char key[LEAF_NODE_KEY_SIZE];
+  uint8_t value[codec->value_size];
+  row_codec_encode(codec, row, key, value);
+
+  uint32_t root_page_num = *catalog_table_root(catalog_page, index);
+  Cursor cursor;
+  table_find(table, root_page_num, key, &cursor);
+  void* node = get_page(table->pager, cursor.page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  if (cursor.cell_num < num_cells &&
+      strcmp(key, leaf_node_key(node, cursor.cell_num)) == 0) {
+    return EXECUTE_DUPLICATE_KEY;
+  }
+
+  if (leaf_insert_out_of_pages(table, root_page_num, node, num_cells)) {
+    return EXECUTE_TABLE_FULL;
+  }
+
+  leaf_node_insert(&cursor, key, value);
+  *catalog_table_num_rows(catalog_page, index) += 1;
+  return EXECUTE_SUCCESS;
+}
+
+ExecuteResult execute_select_from(Statement* statement, Table* table) {
+  void* catalog_page = catalog(table->pager);
+  uint32_t index = catalog_find(catalog_page, statement->table_name);
+  if (index >= *catalog_num_tables(catalog_page)) {
+    return EXECUTE_NO_SUCH_TABLE;
+  }
+  RowCodec* codec = &(table->codecs[index]);
+
+  Value row[CATALOG_MAX_COLUMNS];
+  RowScan scan;
+  row_scan_init(&scan, table, false, *catalog_table_root(catalog_page, index),
+                statement);
+  void* cell;
+  while ((cell = row_scan_next(&scan)) != NULL) {
+    row_codec_decode(codec, cell, cell + codec->key_size, row);
+    print_values(codec, row);
+  }
+
+  return EXECUTE_SUCCESS;
+}
+
+/*
+Estimate how many rows of a tree lie in the statement's key range.
+While the range falls inside one child the estimate follows it down,
+assuming every child holds the same share of the rows; at the first
+node the range spans, the share of children (or cells) it covers
+gives the estimate.
+*/
+uint64_t tree_estimate_rows(Table* table, uint32_t root_page_num,
+                            Statement* statement, uint32_t num_rows) {
+  char start_key[LEAF_NODE_KEY_SIZE];
+  scan_start_key(statement, start_key);
+  double share = 1.0;
+  void* node = get_page(table->pager, root_page_num);
+  while (get_node_type(node) == NODE_INTERNAL) {
+    uint32_t num_keys = *internal_node_num_keys(node);
+    uint32_t first = 0;
+    uint32_t num_covered = 0;
+    for (uint32_t i = 0; i <= num_keys; i++) {
+      // Child i holds the keys after key i - 1 up to key i
+      if (i < num_keys && strcmp(internal_node_key(node, i), start_key) < 0) {
+        first = i + 1;
+        continue;
+      }
+      if (i > 0 && key_past_range(statement, internal_node_key(node, i - 1))) {
+        break;
+      }
+      num_covered++;
+    }
+    share = share * num_covered / (num_keys + 1);
+    if (num_covered != 1) {
+      return num_rows * share;
+    }
+    node = get_page(table->pager, *internal_node_child(node, first));
+  }
+
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  uint32_t num_covered = 0;
+  for (uint32_t i = 0; i < num_cells; i++) {
+    char* key = leaf_node_key(node, i);
+    if (strcmp(key, start_key) >= 0 && !key_past_range(statement, key)) {
+      num_covered++;
+    }
+  }
+  if (num_cells > 0) {
+    share = share * num_covered / num_cells;
+  }
+  return num_rows * share;
+}
+
+/*
+True if the where clause bounds the key, so the scan reads a range of
+each tree rather than all of it
+*/
+bool statement_has_key_range(Statement* statement) {
+  for (uint32_t i = 0; i < statement->num_predicates; i++) {
+    Predicate* predicate = &(statement->predicates[i]);
+    if ((predicate->column == COLUMN_KEY &&
+         predicate->op != COMPARE_NOT_EQUAL) ||
+        (predicate->column == COLUMN_STB && predicate->op == COMPARE_EQUAL)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * analyze. The internal nodes of every tree of the viewing table are
+ * walked to list its leaves, and at most STATISTICS_SAMPLE_LEAVES of
+ * them, spread evenly, are read. Each column's sampled values are
+ * sorted to find the distinct count, the range and the histogram
+ * bounds. Inserts and deletes count against the statistics, and once
+ * more than a tenth of the rows analyzed (plus
+ * STATISTICS_STALE_ROWS) have changed the next plan analyzes again.
+ */
+const uint32_t STATISTICS_STALE_ROWS = 50;
+
+void statistics_collect_leaves(Pager* pager, uint32_t page_num,
+                               uint32_t depth, uint32_t* leaves,
+                               uint32_t* num_leaves) {
+  if (depth == 1) {
+    leaves[(*num_leaves)++] = page_num;
+    return;
+  }
+  void* node = get_page(pager, page_num);
+  for (uint32_t i = 0; i <= *internal_node_num_keys(node); i++) {
+    statistics_collect_leaves(pager, *internal_node_child(node, i), depth - 1,
+                              leaves, num_leaves);
+  }
+}
+
+const char* row_column_text(Row* row, Column column) {
+  switch (column) {
+    case (COLUMN_STB):
+      return row->stb;
+    case (COLUMN_TITLE):
+      return row->title;
+    case (COLUMN_PROVIDER):
+      return row->provider;
+    case (COLUMN_DATE):
+      return row->date;
+    case (COLUMN_TIME):
+      return row->time;
+    default:
+      return "";
+  }
+}
+
+int compare_statistics_values(const void* a, const void* b) {
+  return strcmp(a, b);
+}
+
+void statistics_build_column(void* statistics, Column column, char* values,
+                             uint32_t num_values, uint32_t num_rows) {
+  qsort(values, num_values, STATISTICS_VALUE_SIZE, compare_statistics_values);
+  uint64_t num_distinct = 0;
+  uint32_t num_singletons = 0;
+  uint32_t i = 0;
+  while (i < num_values) {
+    uint32_t j = i + 1;
+    while (j < num_values && strcmp(values + j * STATISTICS_VALUE_SIZE,
+                                    values + i * STATISTICS_VALUE_SIZE) == 0) {
+      j++;
+    }
+    num_distinct++;
+    if (j - i == 1) {
+      num_singletons++;
+    }
+    i = j;
+  }
+  // Values seen once in the sample stand for more the sample missed
+  if (num_values > 0 && num_values < num_rows) {
+    num_distinct += (uint64_t)num_singletons * (num_rows - num_values) /
+                    num_values;
+  }
+  if (num_distinct > num_rows) {
+    num_distinct = num_rows;
+  }
+  *statistics_num_distinct(statistics, column) = num_distinct;
+  if (num_values == 0) {
+    return;
+  }
+
+  strcpy(statistics_min(statistics, column), values);
+  strcpy(statistics_max(statistics, column),
+         values + (num_values - 1) * STATISTICS_VALUE_SIZE);
+  uint32_t num_buckets = num_values < STATISTICS_NUM_BUCKETS
+                             ? num_values
+                             : STATISTICS_NUM_BUCKETS;
+  *statistics_num_buckets(statistics, column) = num_buckets;
+  for (uint32_t bucket = 0; bucket < num_buckets; bucket++) {
+    uint32_t last = (uint64_t)(bucket + 1) * num_values / num_buckets - 1;
+    strcpy(statistics_bound(statistics, column, bucket),
+           values + last * STATISTICS_VALUE_SIZE);
+  }
+}
+
+ExecuteResult table_analyze(Table* table) {
+  Pager* pager = table->pager;
+  void* header = file_header(pager);
+  uint32_t page_num = *file_header_statistics_page(header);
+  if (page_num == 0) {
+    if (pager_num_available_pages(pager) < 1) {
+      return EXECUTE_TABLE_FULL;
+    }
+    page_num = get_unused_page_num(pager);
+    *file_header_statistics_page(header) = page_num;
+  }
 
-  if (offset == -1) {
-    printf("Error seeking: %d\n", errno);
-    exit(EXIT_FAILURE);
+  uint32_t* leaves = db_malloc(pager->num_pages * sizeof(uint32_t));
+  uint32_t num_leaves = 0;
+  for (uint32_t tree_num = 0; tree_num < table_num_trees(table); tree_num++) {
+    uint32_t root_page_num = table_tree_root(table, tree_num);
+    statistics_collect_leaves(pager, root_page_num,
+                              tree_depth(pager, root_page_num), leaves,
+                              &num_leaves);
   }
+  uint32_t num_samples = num_leaves < STATISTICS_SAMPLE_LEAVES
+                             ? num_leaves
+                             : STATISTICS_SAMPLE_LEAVES;
 
-  ssize_t bytes_written =
-      write(pager->file_descriptor, pager->pages[page_num], PAGE_SIZE);
+  uint32_t capacity = num_samples * LEAF_NODE_MAX_CELLS;
+  char* values[STATISTICS_NUM_COLUMNS];
+  for (Column column = 0; column < STATISTICS_NUM_COLUMNS; column++) {
+    values[column] = db_malloc((size_t)capacity * STATISTICS_VALUE_SIZE);
+  }
+  uint32_t num_values = 0;
+  Row row;
+  for (uint32_t sample = 0; sample < num_samples; sample++) {
+    void* node = get_page(pager, leaves[sample * num_leaves / num_samples]);
+    for (uint32_t i = 0; i < *leaf_node_num_cells(node); i++) {
+      deserialize_row(leaf_node_value(node, i), &row);
+      decode_row(table->dictionary, &row);
+      for (Column column = 0; column < STATISTICS_NUM_COLUMNS; column++) {
+        statistics_encode(column, row_column_text(&row, column), row.rev,
+                          values[column] + num_values * STATISTICS_VALUE_SIZE);
+      }
+      num_values++;
+    }
+  }
 
-  if (bytes_written == -1) {
-    printf("Error writing: %d\n", errno);
-    exit(EXIT_FAILURE);
+  void* statistics = get_page(pager, page_num);
+  memset(statistics, 0, PAGE_USABLE_SIZE);
+  set_node_type(statistics, NODE_STATISTICS);
+  uint32_t num_rows = *file_header_num_rows(header);
+  *statistics_analyzed_rows(statistics) = num_rows;
+  *statistics_num_sampled(statistics) = num_values;
+  *statistics_num_modified(statistics) = 0;
+  for (Column column = 0; column < STATISTICS_NUM_COLUMNS; column++) {
+    statistics_build_column(statistics, column, values[column], num_values,
+                            num_rows);
+    free(values[column]);
   }
+  free(leaves);
+  return EXECUTE_SUCCESS;
 }
 
-void db_close(Table* table) {
-  Pager* pager = table->pager;
+/*
+The viewing table's statistics, analyzed again if they have gone
+stale, or NULL if it was never analyzed
+*/
+void* table_statistics(Table* table) {
+  uint32_t page_num = *file_header_statistics_page(file_header(table->pager));
+  if (page_num == 0) {
+    return NULL;
+  }
+  void* statistics = get_page(table->pager, page_num);
+  // A query under a --shared read lock may not write, and makes do
+  // with the stale statistics
+  if (*statistics_num_modified(statistics) >
+          *statistics_analyzed_rows(statistics) / 10 + STATISTICS_STALE_ROWS &&
+      table->pager->lock != F_RDLCK) {
+    table_analyze(table);
+  }
+  return statistics;
+}
 
-  for (uint32_t i = 0; i < pager->num_pages; i++) {
-    if (pager->pages[i] == NULL) {
+/*
+Share of the rows a predicate is expected to match. A value that is
+the bound of several buckets is that common; any other value gets an
+even share of the distinct values.
+*/
+double statistics_selectivity(void* statistics, Predicate* predicate) {
+  Column column = predicate->column;
+  uint32_t num_buckets = *statistics_num_buckets(statistics, column);
+  if (num_buckets == 0) {
+    return 1.0;
+  }
+  char value[STATISTICS_VALUE_SIZE];
+  statistics_encode(column, predicate->value, predicate->rev, value);
+
+  uint32_t num_less = 0;
+  uint32_t num_equal = 0;
+  for (uint32_t bucket = 0; bucket < num_buckets; bucket++) {
+    int cmp = strcmp(statistics_bound(statistics, column, bucket), value);
+    if (cmp < 0) {
+      num_less++;
+    } else if (cmp == 0) {
+      num_equal++;
+    }
+  }
+
+  bool below = strcmp(value, statistics_min(statistics, column)) < 0;
+  bool above = strcmp(value, statistics_max(statistics, column)) > 0;
+  uint32_t num_distinct = *statistics_num_distinct(statistics, column);
+  double equal = 0.0;
+  if (!below && !above) {
+    equal = num_equal > 0 ? (double)num_equal / num_buckets
+                          : 1.0 / (num_distinct > 0 ? num_distinct : 1);
+  }
+  double less = 1.0;
+  if (below || strcmp(value, statistics_min(statistics, column)) == 0) {
+    less = 0.0;
+  } else if (!above) {
+    less = (num_less + (num_equal > 0 ? 0.0 : 0.5)) / num_buckets;
+  }
+  if (less + equal > 1.0) {
+    less = 1.0 - equal;
+  }
+
+  switch (predicate->op) {
+    case (COMPARE_EQUAL):
+      return equal;
+    case (COMPARE_NOT_EQUAL):
+      return 1.0 - equal;
+    case (COMPARE_LESS):
+      return less;
+    case (COMPARE_LESS_EQUAL):
+      return less + equal;
+    case (COMPARE_GREATER):
+      return 1.0 - less - equal;
+    case (COMPARE_GREATER_EQUAL):
+      return 1.0 - less;
+  }
+  return 1.0;
+}
+
+/*
+Estimate the viewing rows matching the statement: the rows of the
+partitions it cannot prune within its key range, scaled by the
+statistics' share for the conditions the scan does not narrow by
+itself
+*/
+uint64_t estimate_viewing_rows(Statement* statement, Table* table,
+                               uint32_t* num_scanned) {
+  void* directory = partition_directory(table->pager);
+  bool is_partitioned = *partition_is_partitioned(directory);
+  double estimated_rows = 0;
+  *num_scanned = 0;
+  for (uint32_t tree_num = 0; tree_num < table_num_trees(table); tree_num++) {
+    if (table_tree_pruned(table, tree_num, statement)) {
       continue;
     }
-    pager_flush(pager, i);
-    free(pager->pages[i]);
-    pager->pages[i] = NULL;
+    (*num_scanned)++;
+    uint32_t num_rows = is_partitioned
+                            ? *partition_num_rows(directory, tree_num)
+                            : *file_header_num_rows(file_header(table->pager));
+    estimated_rows += tree_estimate_rows(
+        table, table_tree_root(table, tree_num), statement, num_rows);
   }
 
-  int result = close(pager->file_descriptor);
-  if (result == -1) {
-    printf("Error closing db file.\n");
-    exit(EXIT_FAILURE);
+  void* statistics = table_statistics(table);
+  if (statistics == NULL) {
+    return estimated_rows;
   }
-  for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-    void* page = pager->pages[i];
-    if (page) {
-      free(page);
-      pager->pages[i] = NULL;
+  for (uint32_t i = 0; i < statement->num_predicates; i++) {
+    Predicate* predicate = &(statement->predicates[i]);
+    if (predicate->column == COLUMN_KEY ||
+        (predicate->column == COLUMN_STB && predicate->op == COMPARE_EQUAL) ||
+        (predicate->column == COLUMN_DATE && is_partitioned)) {
+      continue;  // already counted by the key range or partition pruning
     }
+    estimated_rows *= statistics_selectivity(statistics, predicate);
   }
-  free(pager);
+  return estimated_rows + 0.5;
 }
 
-MetaCommandResult do_meta_command(InputBuffer* input_buffer, Table* table) {
-  if (strcmp(input_buffer->buffer, ".exit") == 0) {
-    db_close(table);
-    exit(EXIT_SUCCESS);
-  } else if (strcmp(input_buffer->buffer, ".btree") == 0) {
-    printf("Tree:\n");
-    print_leaf_node(get_page(table->pager, 0));
-    return META_COMMAND_SUCCESS;
-  } else if (strcmp(input_buffer->buffer, ".constants") == 0) {
-    printf("Constants:\n");
-    print_constants();
-    return META_COMMAND_SUCCESS;
-  } else {
-    return META_COMMAND_UNRECOGNIZED_COMMAND;
+ExecuteResult execute_analyze(Statement* statement, Table* table) {
+  return table_analyze(table);
+}
+
+/*
+ * Hash join of the viewing table with a created table. The side
+ * expected to have fewer rows, counting only the viewing rows the where
+ * clause leaves, is read into a hash table keyed by the text of its join
+ * column; the other side is streamed from its B+ tree scan and probes
+ * it. If the hash table outgrows join_memory_budget, both sides are
+ * split by hash into JOIN_NUM_PARTITIONS temp files and each pair of
+ * partitions is joined in turn. A partition still too big is split again
+ * on other bits of the hash, and one that cannot be split (every row has
+ * the same join value) is joined a budget's worth of build rows at a time.
+ */
+const uint32_t JOIN_NUM_PARTITIONS = 16;
+const uint32_t JOIN_MAX_DEPTH = 8;
+const uint32_t DEFAULT_JOIN_MEMORY_BUDGET = 16 * 1024 * 1024;
+uint32_t join_memory_budget = DEFAULT_JOIN_MEMORY_BUDGET;
+
+/* One side of a join and the column its rows are matched on */
+struct JoinSide_t {
+  bool is_viewing;
+  uint32_t root_page_num;  // created tables only
+  RowCodec* codec;         // created tables only
+  uint32_t column;         // a Column of the viewing table or a field index
+  uint32_t cell_size;
+};
+typedef struct JoinSide_t JoinSide;
+
+/*
+ * Entries are packed in an arena as a JoinEntry followed by the join
+ * text and the row's cell. Buckets hold arena offset + 1 (0 is empty)
+ * and entries in a bucket are chained through next.
+ */
+struct JoinEntry_t {
+  uint32_t hash;
+  uint32_t next;
+  uint32_t text_size;
+};
+typedef struct JoinEntry_t JoinEntry;
+
+struct JoinTable_t {
+  uint8_t* arena;
+  uint32_t arena_size;
+  uint32_t arena_capacity;
+  uint32_t* buckets;
+  uint32_t num_buckets;
+  uint32_t num_entries;
+};
+typedef struct JoinTable_t JoinTable;
+
+/*
+Write the join column of a cell as text, the way select prints it
+*/
+void join_text(Table* table, JoinSide* side, void* cell, char* text) {
+  if (!side->is_viewing) {
+    RowCodec* codec = side->codec;
+    Value values[CATALOG_MAX_COLUMNS];
+    row_codec_decode(codec, cell, cell + codec->key_size, values);
+    format_value(&(codec->fields[side->column]), &(values[side->column]),
+                 text);
+    return;
+  }
+
+  Row row;
+  deserialize_row(cell + LEAF_NODE_KEY_SIZE, &row);
+  switch (side->column) {
+    case (COLUMN_STB):
+      strcpy(text, row.stb);
+      break;
+    case (COLUMN_TITLE):
+      strcpy(text, dictionary_decode(table->dictionary, row.title_code));
+      break;
+    case (COLUMN_PROVIDER):
+      strcpy(text, dictionary_decode(table->dictionary, row.provider_code));
+      break;
+    case (COLUMN_DATE):
+      strcpy(text, row.date);
+      break;
+    case (COLUMN_REV):
+      sprintf(text, "%f", row.rev);
+      break;
+    case (COLUMN_TIME):
+      strcpy(text, row.time);
+      break;
+    default:
+      strcpy(text, cell);
+      break;
   }
 }
 
-PrepareResult prepare_insert(InputBuffer* input_buffer, Statement* statement) {
-    statement->type = STATEMENT_INSERT;
-    char* keyword = strtok(input_buffer->buffer, " ");
-    char* stb = strtok(NULL, " ");
-    char* title = strtok(NULL, " ");
-    char* provider = strtok(NULL, " ");
-    char* date = strtok(NULL, " ");
-    char* rev_string = strtok(NULL, " ");
-    char* time = strtok(NULL, " ");
+void join_table_init(JoinTable* join_table, uint32_t num_buckets) {
+  join_table->arena = NULL;
+  join_table->arena_size = 0;
+  join_table->arena_capacity = 0;
+  join_table->num_buckets = num_buckets;
+  join_table->buckets = db_calloc(num_buckets, sizeof(uint32_t));
+  join_table->num_entries = 0;
+}
 
-    if (stb == NULL || title == NULL || provider == NULL || date == NULL ||
-            rev_string == NULL || time == NULL) {
-        return PREPARE_SYNTAX_ERROR;
-    }
+void join_table_free(JoinTable* join_table) {
+  free(join_table->arena);
+  free(join_table->buckets);
+}
 
-    float rev = atof(rev_string);
-    if (rev < 0) {
-        return PREPARE_NEGATIVE_REV;
-    }
-    if (
-            strlen(stb) > COLUMN_STB_SIZE ||
-            strlen(title) > COLUMN_TITLE_SIZE ||
-            strlen(provider) > COLUMN_PROVIDER_SIZE ||
-            strlen(date) > COLUMN_DATE_SIZE ||
-            strlen(time) > COLUMN_TIME_SIZE
-       ) {
-        return PREPARE_STRING_TO_LONG;
-    }
+uint32_t join_table_memory(JoinTable* join_table) {
+  return join_table->arena_capacity +
+         join_table->num_buckets * sizeof(uint32_t);
+}
 
-    strcpy(statement->row_to_insert.stb, stb);
-    strcpy(statement->row_to_insert.title, title);
-    strcpy(statement->row_to_insert.provider, provider);
-    strcpy(statement->row_to_insert.date, date);
-    statement->row_to_insert.rev = rev;
-    strcpy(statement->row_to_insert.time, time);
+JoinEntry* join_table_entry(JoinTable* join_table, uint32_t offset) {
+  return (JoinEntry*)(join_table->arena + offset);
+}
 
-    return PREPARE_SUCCESS;
+char* join_entry_text(JoinEntry* entry) {
+  return (char*)(entry + 1);
 }
 
-PrepareResult prepare_statement(InputBuffer* input_buffer,
-                                Statement* statement) {
-  if (strncmp(input_buffer->buffer, "insert", 6) == 0) {
-    return prepare_insert(input_buffer, statement);
+void* join_entry_cell(JoinEntry* entry) {
+  return join_entry_text(entry) + entry->text_size;
+}
+
+/*
+Double the buckets once they are half full and relink every entry
+*/
+void join_table_grow(JoinTable* join_table, uint32_t cell_size) {
+  free(join_table->buckets);
+  join_table->num_buckets *= 2;
+  join_table->buckets = db_calloc(join_table->num_buckets, sizeof(uint32_t));
+  uint32_t mask = join_table->num_buckets - 1;
+  uint32_t offset = 0;
+  while (offset < join_table->arena_size) {
+    JoinEntry* entry = join_table_entry(join_table, offset);
+    uint32_t bucket = entry->hash & mask;
+    entry->next = join_table->buckets[bucket];
+    join_table->buckets[bucket] = offset + 1;
+    offset += sizeof(JoinEntry) + entry->text_size + cell_size;
   }
-  if (strcmp(input_buffer->buffer, "select") == 0) {
-    statement->type = STATEMENT_SELECT;
-    return PREPARE_SUCCESS;
+}
+
+void join_table_insert(JoinTable* join_table, uint32_t hash, char* text,
+                       void* cell, uint32_t cell_size) {
+  uint32_t text_size = strlen(text) + 1;
+  // Keep every entry 4 byte aligned
+  uint32_t padded_text_size =
+      (text_size + cell_size + 3) / 4 * 4 - cell_size;
+  uint32_t entry_size = sizeof(JoinEntry) + padded_text_size + cell_size;
+  if (join_table->arena_size + entry_size > join_table->arena_capacity) {
+    uint32_t capacity = join_table->arena_capacity * 2;
+    if (capacity < join_table->arena_size + entry_size) {
+      capacity = join_table->arena_size + entry_size + PAGE_SIZE;
+    }
+    join_table->arena = db_realloc(join_table->arena, capacity);
+    join_table->arena_capacity = capacity;
   }
 
-  return PREPARE_UNRECOGNIZED_STATEMENT;
+  uint32_t offset = join_table->arena_size;
+  JoinEntry* entry = join_table_entry(join_table, offset);
+  entry->hash = hash;
+  entry->text_size = padded_text_size;
+  memcpy(join_entry_text(entry), text, text_size);
+  memcpy(join_entry_cell(entry), cell, cell_size);
+  join_table->arena_size += entry_size;
+
+  uint32_t bucket = hash & (join_table->num_buckets - 1);
+  entry->next = join_table->buckets[bucket];
+  join_table->buckets[bucket] = offset + 1;
+  join_table->num_entries++;
+  if (join_table->num_entries > join_table->num_buckets / 2) {
+    join_table_grow(join_table, cell_size);
+  }
 }
 
-void leaf_node_insert(Cursor* cursor, char* key, Row* value) {
-  void* node = get_page(cursor->table->pager, cursor->page_num);
+void print_joined_row(Table* table, RowCodec* codec, void* viewing_cell,
+                      void* dimension_cell) {
+  if (!emit_row()) {
+    return;
+  }
+  Row row;
+  deserialize_row(viewing_cell + LEAF_NODE_KEY_SIZE, &row);
+  decode_row(table->dictionary, &row);
+  printf("(%s, %s, %s, %s, %f, %s", row.stb, row.title, row.provider,
+         row.date, row.rev, row.time);
 
-  uint32_t num_cells = *leaf_node_num_cells(node);
-  if (num_cells >= LEAF_NODE_MAX_CELLS) {
-    // Node full
-    printf("Need to implement splitting a leaf node.\n");
-    exit(EXIT_FAILURE);
+  Value values[CATALOG_MAX_COLUMNS];
+  row_codec_decode(codec, dimension_cell, dimension_cell + codec->key_size,
+                   values);
+  char text[VALUE_TEXT_SIZE];
+  for (uint32_t i = 0; i < codec->num_fields; i++) {
+    format_value(&(codec->fields[i]), &(values[i]), text);
+    printf(", %s", text);
   }
+  printf(")\n");
+}
 
-  if (cursor->cell_num < num_cells) {
-    // Make room for new cell
-    for (uint32_t i = num_cells; i > cursor->cell_num; i--) {
-      memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i - 1),
-             LEAF_NODE_CELL_SIZE);
+/*
+Print every build row matching a probe row, viewing columns first
+*/
+void join_probe(Table* table, JoinTable* join_table, JoinSide* build,
+                RowCodec* codec, uint32_t hash, char* text, void* cell) {
+  uint32_t bucket = hash & (join_table->num_buckets - 1);
+  uint32_t offset = join_table->buckets[bucket];
+  while (offset != 0) {
+    JoinEntry* entry = join_table_entry(join_table, offset - 1);
+    if (entry->hash == hash && strcmp(join_entry_text(entry), text) == 0) {
+      void* build_cell = join_entry_cell(entry);
+      if (build->is_viewing) {
+        print_joined_row(table, codec, build_cell, cell);
+      } else {
+        print_joined_row(table, codec, cell, build_cell);
+      }
     }
+    offset = entry->next;
   }
+}
 
-  *(leaf_node_num_cells(node)) += 1;
-  //*(leaf_node_key(node, cursor->cell_num)) = key;
-  strcpy(leaf_node_key(node, cursor->cell_num), key);
-  serialize_row(value, leaf_node_value(node, cursor->cell_num));
+/*
+Partition files hold records of the hash, the text size,
+the join text and the cell
+*/
+void join_spill(FILE* file, uint32_t hash, char* text, void* cell,
+                uint32_t cell_size) {
+  uint32_t text_size = strlen(text) + 1;
+  if (fwrite(&hash, sizeof(hash), 1, file) != 1 ||
+      fwrite(&text_size, sizeof(text_size), 1, file) != 1 ||
+      fwrite(text, text_size, 1, file) != 1 ||
+      fwrite(cell, cell_size, 1, file) != 1) {
+    printf("Error writing join spill file: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
 }
 
-void leaf_node_insert_in_place(Cursor* cursor, char* key, Row* value) {
-  void* node = get_page(cursor->table->pager, cursor->page_num);
+bool join_read_spilled(FILE* file, uint32_t* hash, char* text, void* cell,
+                       uint32_t cell_size) {
+  uint32_t text_size;
+  if (fread(hash, sizeof(*hash), 1, file) != 1) {
+    return false;
+  }
+  if (fread(&text_size, sizeof(text_size), 1, file) != 1 ||
+      fread(text, text_size, 1, file) != 1 ||
+      fread(cell, cell_size, 1, file) != 1) {
+    printf("Error reading join spill file: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  return true;
+}
 
-  uint32_t num_cells = *leaf_node_num_cells(node);
-  if (num_cells >= LEAF_NODE_MAX_CELLS) {
-    // Node full
-    printf("Need to implement splitting a leaf node.\n");
+/*
+The partition of a hash when splitting at depth. The low bits pick the
+bucket, so partition on the high ones, mixed with the depth below the
+top level so rows that shared a partition spread out again.
+*/
+uint32_t join_partition(uint32_t hash, uint32_t depth) {
+  if (depth > 0) {
+    // murmur3's finalizer
+    hash ^= depth * 0x9e3779b9u;
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+  }
+  return (hash >> 24) % JOIN_NUM_PARTITIONS;
+}
+
+FILE* join_open_spill_file() {
+  FILE* file = tmpfile();
+  if (file == NULL) {
+    printf("Unable to create join spill file: %d\n", errno);
     exit(EXIT_FAILURE);
   }
+  return file;
+}
 
-  if (cursor->cell_num < num_cells) {
-    // Make room for new cell
-    for (uint32_t i = num_cells; i > cursor->cell_num; i--) {
-      memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i - 1),
-             LEAF_NODE_CELL_SIZE);
-    }
+/*
+Move the rows already in the hash table out to the partition files
+*/
+void join_table_spill(JoinTable* join_table, FILE** files, uint32_t depth,
+                      uint32_t cell_size) {
+  uint32_t offset = 0;
+  while (offset < join_table->arena_size) {
+    JoinEntry* entry = join_table_entry(join_table, offset);
+    join_spill(files[join_partition(entry->hash, depth)], entry->hash,
+               join_entry_text(entry), join_entry_cell(entry), cell_size);
+    offset += sizeof(JoinEntry) + entry->text_size + cell_size;
   }
+}
 
-  *(leaf_node_num_cells(node)) += 1;
-  //*(leaf_node_key(node, cursor->cell_num)) = key;
-  strcpy(leaf_node_key(node, cursor->cell_num), key);
-  serialize_row(value, leaf_node_value(node, cursor->cell_num));
+uint32_t join_num_buckets(uint32_t num_rows) {
+  uint32_t num_buckets = 16;
+  while (num_buckets < 2 * num_rows) {
+    num_buckets *= 2;
+  }
+  return num_buckets;
 }
 
-ExecuteResult execute_insert(Statement* statement, Table* table) {
-  void* node = get_page(table->pager, table->root_page_num);
-  uint32_t num_cells = (*leaf_node_num_cells(node));
-  if (num_cells >= LEAF_NODE_MAX_CELLS) {
-    return EXECUTE_TABLE_FULL;
+/*
+Join a pair of partition files. The build rows are loaded until they
+outgrow the budget; then, if splitting can still help, the pair is
+split into JOIN_NUM_PARTITIONS smaller pairs joined in turn. Otherwise
+the probe file is read once for each budget's worth of build rows.
+*/
+void join_partitions(Table* table, JoinSide* build, JoinSide* probe,
+                     RowCodec* codec, FILE* build_file, FILE* probe_file,
+                     uint32_t depth, bool can_split) {
+  char text[VALUE_TEXT_SIZE];
+  uint8_t build_cell[build->cell_size];
+  uint8_t probe_cell[probe->cell_size];
+  uint32_t hash;
+  rewind(build_file);
+  bool more = true;
+  while (more) {
+    JoinTable join_table;
+    join_table_init(&join_table, join_num_buckets(0));
+    more = false;
+    while (join_read_spilled(build_file, &hash, text, build_cell,
+                             build->cell_size)) {
+      join_table_insert(&join_table, hash, text, build_cell, build->cell_size);
+      if (join_table_memory(&join_table) > join_memory_budget) {
+        more = true;
+        break;
+      }
+    }
+
+    if (more && can_split && depth < JOIN_MAX_DEPTH) {
+      FILE* build_files[JOIN_NUM_PARTITIONS];
+      FILE* probe_files[JOIN_NUM_PARTITIONS];
+      uint32_t num_rows[JOIN_NUM_PARTITIONS];
+      for (uint32_t i = 0; i < JOIN_NUM_PARTITIONS; i++) {
+        build_files[i] = join_open_spill_file();
+        probe_files[i] = join_open_spill_file();
+        num_rows[i] = 0;
+      }
+      uint32_t offset = 0;
+      while (offset < join_table.arena_size) {
+        JoinEntry* entry = join_table_entry(&join_table, offset);
+        num_rows[join_partition(entry->hash, depth)]++;
+        offset += sizeof(JoinEntry) + entry->text_size + build->cell_size;
+      }
+      join_table_spill(&join_table, build_files, depth, build->cell_size);
+      uint32_t total_rows = join_table.num_entries;
+      join_table_free(&join_table);
+      while (join_read_spilled(build_file, &hash, text, build_cell,
+                               build->cell_size)) {
+        uint32_t partition = join_partition(hash, depth);
+        join_spill(build_files[partition], hash, text, build_cell,
+                   build->cell_size);
+        num_rows[partition]++;
+        total_rows++;
+      }
+      rewind(probe_file);
+      while (join_read_spilled(probe_file, &hash, text, probe_cell,
+                               probe->cell_size)) {
+        join_spill(probe_files[join_partition(hash, depth)], hash, text,
+                   probe_cell, probe->cell_size);
+      }
+
+      for (uint32_t i = 0; i < JOIN_NUM_PARTITIONS; i++) {
+        // A partition that got every row would only split the same way
+        join_partitions(table, build, probe, codec, build_files[i],
+                        probe_files[i], depth + 1, num_rows[i] < total_rows);
+        fclose(build_files[i]);
+        fclose(probe_files[i]);
+      }
+      return;
+    }
+
+    rewind(probe_file);
+    while (join_read_spilled(probe_file, &hash, text, probe_cell,
+                             probe->cell_size)) {
+      join_probe(table, &join_table, build, codec, hash, text, probe_cell);
+    }
+    join_table_free(&join_table);
   }
+}
 
-  Row* row_to_insert = &(statement->row_to_insert);
-  char* stb = row_to_insert->stb;
-  char* title = row_to_insert->title;
-  char* date = row_to_insert->date;
-  char key[LEAF_NODE_KEY_SIZE];
-  snprintf(key, sizeof(key), "%s_%s_%s", stb, title, date); 
-  Cursor* cursor = table_find(table, key);
-  if (cursor->cell_num < num_cells) {
-    char* key_at_index = leaf_node_key(node, cursor->cell_num);
-    if (strncmp(key, key_at_index, LEAF_NODE_KEY_SIZE) == 0) {
-      return EXECUTE_DUPLICATE_KEY;
+ExecuteResult execute_select_join(Statement* statement, Table* table) {
+  void* catalog_page = catalog(table->pager);
+  uint32_t index = catalog_find(catalog_page, statement->table_name);
+  if (index >= *catalog_num_tables(catalog_page)) {
+    return EXECUTE_NO_SUCH_TABLE;
+  }
+  RowCodec* codec = &(table->codecs[index]);
+  uint32_t field =
+      catalog_find_column(catalog_page, index, statement->join_column);
+  if (field == codec->num_fields) {
+    return EXECUTE_NO_SUCH_COLUMN;
+  }
+  statement_resolve_codes(statement, table->dictionary);
+
+  JoinSide viewing = {true, 0, NULL, statement->join_on,
+                      LEAF_NODE_CELL_SIZE};
+  JoinSide dimension = {false, *catalog_table_root(catalog_page, index), codec,
+                        field, codec->key_size + codec->value_size};
+  uint32_t num_scanned;
+  uint64_t viewing_rows = estimate_viewing_rows(statement, table, &num_scanned);
+  uint32_t dimension_rows = *catalog_table_num_rows(catalog_page, index);
+  bool build_viewing = viewing_rows < dimension_rows;
+  JoinSide* build = build_viewing ? &viewing : &dimension;
+  JoinSide* probe = build_viewing ? &dimension : &viewing;
+  uint32_t build_rows = build_viewing ? viewing_rows : dimension_rows;
+
+  char text[VALUE_TEXT_SIZE];
+  JoinTable join_table;
+  join_table_init(&join_table, join_num_buckets(build_rows));
+  FILE* build_files[JOIN_NUM_PARTITIONS];
+  FILE* probe_files[JOIN_NUM_PARTITIONS];
+  bool spilled = false;
+
+  RowScan scan;
+  row_scan_init(&scan, table, build->is_viewing, build->root_page_num,
+                statement);
+  void* cell;
+  while ((cell = row_scan_next(&scan)) != NULL) {
+    join_text(table, build, cell, text);
+    uint32_t hash = hash_string(text);
+    if (spilled) {
+      join_spill(build_files[join_partition(hash, 0)], hash, text, cell,
+                 build->cell_size);
+      continue;
+    }
+    join_table_insert(&join_table, hash, text, cell, build->cell_size);
+    if (join_table_memory(&join_table) > join_memory_budget) {
+      for (uint32_t i = 0; i < JOIN_NUM_PARTITIONS; i++) {
+        build_files[i] = join_open_spill_file();
+        probe_files[i] = join_open_spill_file();
+      }
+      join_table_spill(&join_table, build_files, 0, build->cell_size);
+      join_table_free(&join_table);
+      spilled = true;
+      if (profile != NULL) {
+        profile->join_spilled = true;
+      }
     }
   }
 
-  leaf_node_insert(cursor, key, row_to_insert);
+  row_scan_init(&scan, table, probe->is_viewing, probe->root_page_num,
+                statement);
+  while ((cell = row_scan_next(&scan)) != NULL) {
+    join_text(table, probe, cell, text);
+    uint32_t hash = hash_string(text);
+    if (spilled) {
+      join_spill(probe_files[join_partition(hash, 0)], hash, text, cell,
+                 probe->cell_size);
+    } else {
+      join_probe(table, &join_table, build, codec, hash, text, cell);
+    }
+  }
+  if (!spilled) {
+    join_table_free(&join_table);
+    return EXECUTE_SUCCESS;
+  }
 
-  free(cursor);
+  for (uint32_t i = 0; i < JOIN_NUM_PARTITIONS; i++) {
+    join_partitions(table, build, probe, codec, build_files[i],
+                    probe_files[i], 1, true);
+    fclose(build_files[i]);
+    fclose(probe_files[i]);
+  }
 
   return EXECUTE_SUCCESS;
 }
 
-ExecuteResult execute_select(Statement* statement, Table* table) {
-  Cursor* cursor = table_start(table);
+void plan_viewing_scan(Statement* statement, Table* table, PlanStep* step) {
+  bool is_partitioned =
+      *partition_is_partitioned(partition_directory(table->pager));
+  uint32_t num_trees = table_num_trees(table);
+  uint32_t num_scanned = 0;
+  step->used = true;
+  step->estimated_rows = estimate_viewing_rows(statement, table, &num_scanned);
 
-  Row row;
-  while (!(cursor->end_of_table)) {
-    deserialize_row(cursor_value(cursor), &row);
-    print_row(&row);
-    cursor_advance(cursor);
+  char start_key[LEAF_NODE_KEY_SIZE];
+  scan_start_key(statement, start_key);
+  uint32_t length = 0;
+  if (!statement_has_key_range(statement)) {
+    length = snprintf(step->detail, PLAN_DETAIL_SIZE,
+                      "Full scan of the viewing table");
+  } else if (hash_index != NULL &&
+             statement_is_point_lookup(statement, start_key)) {
+    length = snprintf(step->detail, PLAN_DETAIL_SIZE,
+                      "Hash index lookup of key '%.40s'", start_key);
+  } else if (start_key[0] == 0) {
+    length = snprintf(step->detail, PLAN_DETAIL_SIZE,
+                      "Range scan of the viewing table on its key");
+  } else {
+    length = snprintf(step->detail, PLAN_DETAIL_SIZE,
+                      "Range scan of the viewing table from key '%.40s'",
+                      start_key);
+  }
+  if (is_partitioned && length < PLAN_DETAIL_SIZE) {
+    snprintf(step->detail + length, PLAN_DETAIL_SIZE - length,
+             ", %d of %d partitions", num_scanned, num_trees);
+  }
+}
+
+/*
+Work out how the query will run, the same way its execute function
+decides, without reading any rows beyond the tree roots
+*/
+ExecuteResult plan_query(Statement* statement, Table* table,
+                         QueryPlan* plan) {
+  memset(plan, 0, sizeof(QueryPlan));
+  PlanStep* scan = &(plan->steps[PLAN_SCAN]);
+  PlanStep* table_scan = &(plan->steps[PLAN_TABLE_SCAN]);
+  void* catalog_page = catalog(table->pager);
+  uint32_t index = 0;
+  if (statement->type != STATEMENT_SELECT) {
+    index = catalog_find(catalog_page, statement->table_name);
+    if (index >= *catalog_num_tables(catalog_page)) {
+      return EXECUTE_NO_SUCH_TABLE;
+    }
+    table_scan->used = true;
+    table_scan->estimated_rows = *catalog_table_num_rows(catalog_page, index);
+    snprintf(table_scan->detail, PLAN_DETAIL_SIZE, "Full scan of %s",
+             statement->table_name);
+    if (statement->type == STATEMENT_SELECT_FROM) {
+      return EXECUTE_SUCCESS;
+    }
   }
+  plan_viewing_scan(statement, table, scan);
+
+  if (statement->type == STATEMENT_SELECT_JOIN) {
+    uint32_t field =
+        catalog_find_column(catalog_page, index, statement->join_column);
+    if (field == *catalog_table_num_columns(catalog_page, index)) {
+      return EXECUTE_NO_SUCH_COLUMN;
+    }
+    uint64_t viewing_rows = scan->estimated_rows;
+    uint32_t dimension_rows = *catalog_table_num_rows(catalog_page, index);
+    bool build_viewing = viewing_rows < dimension_rows;
+    RowCodec* codec = &(table->codecs[index]);
+    uint64_t build_cell_size = build_viewing
+                                   ? LEAF_NODE_CELL_SIZE
+                                   : codec->key_size + codec->value_size;
+    uint64_t build_rows = build_viewing ? viewing_rows : dimension_rows;
+    uint64_t build_memory =
+        build_rows * (sizeof(JoinEntry) + build_cell_size) +
+        join_num_buckets(build_rows) * sizeof(uint32_t);
 
-  free(cursor);
+    PlanStep* join = &(plan->steps[PLAN_JOIN]);
+    join->used = true;
+    // Every viewing row is expected to find one row of the other table
+    join->estimated_rows = scan->estimated_rows;
+    snprintf(join->detail, PLAN_DETAIL_SIZE,
+             "Hash join on %s = %s.%s, building on %s%s",
+             column_name(statement->join_on), statement->table_name,
+             statement->join_column,
+             build_viewing ? "the viewing table" : statement->table_name,
+             build_memory > join_memory_budget ? ", spilling partitions"
+                                               : "");
+    return EXECUTE_SUCCESS;
+  }
 
+  uint64_t estimated_rows = scan->estimated_rows;
+  if (statement->has_order_by) {
+    PlanStep* sort = &(plan->steps[PLAN_SORT]);
+    sort->used = true;
+    sort->estimated_rows = estimated_rows;
+    const char* direction = statement->descending ? "desc" : "asc";
+    if (select_uses_top_n(statement)) {
+      snprintf(sort->detail, PLAN_DETAIL_SIZE, "Top-N heap sort on %s %s",
+               column_name(statement->order_by), direction);
+    } else {
+      uint64_t run_rows =
+          sort_memory_budget / (LEAF_NODE_CELL_SIZE + sizeof(void*));
+      snprintf(sort->detail, PLAN_DETAIL_SIZE,
+               "%s sort on %s %s",
+               estimated_rows > run_rows ? "External merge" : "In-memory",
+               column_name(statement->order_by), direction);
+    }
+  }
+  if (statement->has_limit) {
+    PlanStep* limit = &(plan->steps[PLAN_LIMIT]);
+    limit->used = true;
+    limit->estimated_rows = estimated_rows < statement->limit
+                                ? estimated_rows
+                                : statement->limit;
+    snprintf(limit->detail, PLAN_DETAIL_SIZE, "Limit %d", statement->limit);
+  }
   return EXECUTE_SUCCESS;
 }
 
+void print_plan(QueryPlan* plan, bool analyze) {
+  uint32_t depth = 0;
+  for (uint32_t i = 0; i < NUM_PLAN_OPERATORS; i++) {
+    PlanStep* step = &(plan->steps[i]);
+    if (!step->used) {
+      continue;
+    }
+    indent(depth);
+    printf("%s (estimated rows %lu", step->detail,
+           (unsigned long)step->estimated_rows);
+    if (analyze) {
+      OperatorStats* actual = &(step->actual);
+      printf(", actual rows %lu, pages read %lu, cache hits %lu, %.3f ms",
+             (unsigned long)actual->rows, (unsigned long)actual->page_reads,
+             (unsigned long)actual->cache_hits, actual->nanoseconds / 1e6);
+      if (i == PLAN_SORT && plan->sort_runs > 0) {
+        printf(", %d runs spilled", plan->sort_runs);
+      }
+      if (i == PLAN_JOIN && plan->join_spilled) {
+        printf(", spilled");
+      }
+    }
+    printf(")\n");
+    // Both sides of a join are its children
+    if (i != PLAN_SCAN || !plan->steps[PLAN_JOIN].used) {
+      depth++;
+    }
+  }
+}
+
+/*
+Whether a statement reads or changes the viewing table's tree, so rows
+still buffered by log-structured ingest have to be merged into it first.
+key = <value> lookups read the buffers themselves.
+*/
+bool statement_needs_settled_tree(Statement* statement) {
+  switch (statement->type) {
+    case (STATEMENT_SELECT): {
+      char start_key[LEAF_NODE_KEY_SIZE];
+      scan_start_key(statement, start_key);
+      return !statement_is_point_lookup(statement, start_key);
+    }
+    case (STATEMENT_DELETE):
+    case (STATEMENT_UPDATE):
+    case (STATEMENT_PARTITION):
+    case (STATEMENT_DROP_PARTITION):
+    case (STATEMENT_SELECT_JOIN):
+    case (STATEMENT_ANALYZE):
+      return true;
+    default:
+      return false;
+  }
+}
+
 ExecuteResult execute_statement(Statement* statement, Table* table) {
+  if (statement_needs_settled_tree(statement)) {
+    lsm_settle(table);
+  }
   switch (statement->type) {
     case (STATEMENT_INSERT):
       return execute_insert(statement, table);
     case (STATEMENT_SELECT):
       return execute_select(statement, table);
+    case (STATEMENT_DELETE):
+      return execute_delete(statement, table);
+    case (STATEMENT_UPDATE):
+      return execute_update(statement, table);
+    case (STATEMENT_PARTITION):
+      return execute_partition(statement, table);
+    case (STATEMENT_DROP_PARTITION):
+      return execute_drop_partition(statement, table);
+    case (STATEMENT_CREATE_TABLE):
+      return execute_create_table(statement, table);
+    case (STATEMENT_INSERT_INTO):
+      return execute_insert_into(statement, table);
+    case (STATEMENT_SELECT_FROM):
+      return execute_select_from(statement, table);
+    case (STATEMENT_SELECT_JOIN):
+      return execute_select_join(statement, table);
+    case (STATEMENT_ANALYZE):
+      return execute_analyze(statement, table);
   }
+  return EXECUTE_SUCCESS;
 }
 
-int main(int argc, char* argv[]) {
-  if (argc < 2) {
-    printf("Must supply a database filename.\n");
-    exit(EXIT_FAILURE);
+/*
+explain prints the plan a query would run with. explain analyze also
+runs it, without printing its rows, and adds what each operator did:
+the rows it returned, the pages it read from disk or found in the
+cache, and its wall time. Times include the operators below.
+*/
+ExecuteResult execute_explain(Statement* statement, Table* table) {
+  lsm_settle(table);
+  QueryPlan plan;
+  ExecuteResult result = plan_query(statement, table, &plan);
+  if (result != EXECUTE_SUCCESS) {
+    return result;
   }
 
-  char* filename = argv[1];
-  Table* table = db_open(filename);
-
-  InputBuffer* input_buffer = new_input_buffer();
-  while (true) {
-    print_prompt();
-    read_input(input_buffer);
-
-    if (input_buffer->buffer[0] == '.') {
-      switch (do_meta_command(input_buffer, table)) {
-        case (META_COMMAND_SUCCESS):
-          continue;
-        case (META_COMMAND_UNRECOGNIZED_COMMAND):
-          printf("Unrecognized command '%s'\n", input_buffer->buffer);
-          continue;
-      }
-    }
-
-    Statement statement;
-    switch (prepare_statement(input_buffer, &statement)) {
-      case (PREPARE_SUCCESS):
-        break;
-      case (PREPARE_NEGATIVE_REV):
-        printf("ID must be positive.\n");
-        continue;
-      case (PREPARE_STRING_TO_LONG):
-        printf("String is too long.\n");
-        continue;
-      case (PREPARE_SYNTAX_ERROR):
-        printf("Syntax error. Could not parse statement.\n");
-        continue;
-      case (PREPARE_UNRECOGNIZED_STATEMENT):
-        printf("Unrecognized keyword at start of '%s'.\n",
-               input_buffer->buffer);
-        continue;
-    }
-
-    switch (execute_statement(&statement, table)) {
-      case (EXECUTE_SUCCESS):
-        printf("Executed.\n");
-        break;
-      case (EXECUTE_DUPLICATE_KEY):
-        printf("Error: Duplicate key.\n");
-        break;
-      case (EXECUTE_TABLE_FULL):
-        printf("Error: Table full.\n");
-        break;
+  bool analyze = statement->explain == EXPLAIN_ANALYZE;
+  if (analyze) {
+    uint64_t* counters = metrics_local()->counters;
+    uint64_t start = now_nanoseconds();
+    uint64_t page_reads = counters[METRIC_CACHE_MISSES];
+    uint64_t cache_hits = counters[METRIC_CACHE_HITS];
+    profile = &plan;
+    result = execute_statement(statement, table);
+    profile = NULL;
+    OperatorStats total = {plan.rows_returned,
+                           counters[METRIC_CACHE_MISSES] - page_reads,
+                           counters[METRIC_CACHE_HITS] - cache_hits,
+                           now_nanoseconds() - start};
+    for (uint32_t i = PLAN_LIMIT; i <= PLAN_JOIN; i++) {
+      plan.steps[i].actual = total;
     }
   }
+
+  printf("Plan:\n");
+  print_plan(&plan, analyze);
+  return result;
 }
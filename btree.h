@@ -0,0 +1,421 @@
+/*
+ * The storage engine: pager, B+ trees, statements and queries. main and
+ * the REPL around it live in repl.c.
+ */
+#ifndef BTREE_H
+#define BTREE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+struct InputBuffer_t {
+  char* buffer;
+  size_t buffer_length;
+  ssize_t input_length;
+};
+typedef struct InputBuffer_t InputBuffer;
+
+enum ExecuteResult_t {
+  EXECUTE_SUCCESS,
+  EXECUTE_DUPLICATE_KEY,
+  EXECUTE_TABLE_FULL,
+  EXECUTE_TABLE_NOT_EMPTY,
+  EXECUTE_NO_SUCH_PARTITION,
+  EXECUTE_NO_SUCH_TABLE,
+  EXECUTE_TABLE_EXISTS,
+  EXECUTE_ROW_TOO_LARGE,
+  EXECUTE_BAD_VALUE,
+  EXECUTE_NO_SUCH_COLUMN,
+  EXECUTE_DATABASE_LOCKED,
+  EXECUTE_UNSUPPORTED
+};
+typedef enum ExecuteResult_t ExecuteResult;
+
+enum MetaCommandResult_t {
+  META_COMMAND_SUCCESS,
+  META_COMMAND_UNRECOGNIZED_COMMAND
+};
+typedef enum MetaCommandResult_t MetaCommandResult;
+
+enum PrepareResult_t {
+  PREPARE_SUCCESS,
+  PREPARE_NEGATIVE_REV,
+  PREPARE_STRING_TO_LONG,
+  PREPARE_SYNTAX_ERROR,
+  PREPARE_UNRECOGNIZED_STATEMENT,
+  PREPARE_KEY_COLUMN_UPDATE,
+  PREPARE_TOO_MANY_COLUMNS
+};
+typedef enum PrepareResult_t PrepareResult;
+
+enum StatementType_t {
+  STATEMENT_INSERT,
+  STATEMENT_SELECT,
+  STATEMENT_DELETE,
+  STATEMENT_UPDATE,
+  STATEMENT_PARTITION,
+  STATEMENT_DROP_PARTITION,
+  STATEMENT_CREATE_TABLE,
+  STATEMENT_INSERT_INTO,
+  STATEMENT_SELECT_FROM,
+  STATEMENT_SELECT_JOIN,
+  STATEMENT_ANALYZE
+};
+typedef enum StatementType_t StatementType;
+
+enum ExplainMode_t { EXPLAIN_NONE, EXPLAIN_PLAN, EXPLAIN_ANALYZE };
+typedef enum ExplainMode_t ExplainMode;
+
+/*
+ * Sizes of arrays in the types below. They are enum constants rather than
+ * const variables so that any C compiler takes them as array bounds.
+ */
+enum {
+  COLUMN_STB_SIZE = 32,
+  COLUMN_TITLE_SIZE = 255,
+  COLUMN_PROVIDER_SIZE = 255,
+  COLUMN_DATE_SIZE = 10,
+  COLUMN_TIME_SIZE = 4,
+  PARTITION_MONTH_SIZE = 7,  // "YYYY-MM", the date prefix
+  MAX_PREDICATES = 4,
+  CATALOG_NAME_SIZE = 16,
+  CATALOG_MAX_COLUMNS = 12,
+  COLUMN_MAX_TEXT_SIZE = 255,
+  TABLE_MAX_PAGES = 100,
+  PREFETCH_QUEUE_SIZE = 16,
+  PREFETCH_WORKERS = 4,
+  MAX_QUERY_TASKS = 64,
+  PLAN_DETAIL_SIZE = 128
+};
+
+struct Row_t {
+  char stb[COLUMN_STB_SIZE + 1];
+  char title[COLUMN_TITLE_SIZE + 1];
+  char provider[COLUMN_PROVIDER_SIZE + 1];
+  char date[COLUMN_DATE_SIZE + 1];
+  float rev;
+  char time[COLUMN_TIME_SIZE + 1];
+  uint32_t title_code;     // dictionary code stored in place of title
+  uint32_t provider_code;  // dictionary code stored in place of provider
+};
+typedef struct Row_t Row;
+
+enum Column_t {
+  COLUMN_STB,
+  COLUMN_TITLE,
+  COLUMN_PROVIDER,
+  COLUMN_DATE,
+  COLUMN_REV,
+  COLUMN_TIME,
+  COLUMN_KEY  // the stb_title_date string the tree is ordered by
+};
+typedef enum Column_t Column;
+
+enum CompareOp_t {
+  COMPARE_EQUAL,
+  COMPARE_NOT_EQUAL,
+  COMPARE_LESS,
+  COMPARE_LESS_EQUAL,
+  COMPARE_GREATER,
+  COMPARE_GREATER_EQUAL
+};
+typedef enum CompareOp_t CompareOp;
+
+struct Predicate_t {
+  Column column;
+  CompareOp op;
+  char value[COLUMN_TITLE_SIZE + 1];
+  uint32_t code;  // dictionary code of value for title/provider
+  float rev;
+};
+typedef struct Predicate_t Predicate;
+
+/*
+ * Tables made with create table. The first column is the table's key.
+ */
+enum ColumnType_t {
+  TYPE_INT,      // int32
+  TYPE_BIGINT,   // int64
+  TYPE_FLOAT,
+  TYPE_DOUBLE,
+  TYPE_CHAR,     // char(n), exactly n bytes, NUL padded
+  TYPE_VARCHAR,  // varchar(n), a length byte and up to n bytes
+  TYPE_DATE      // YYYY-MM-DD
+};
+typedef enum ColumnType_t ColumnType;
+
+struct ColumnDefinition_t {
+  char name[CATALOG_NAME_SIZE];
+  ColumnType type;
+  uint32_t length;  // declared n of char(n) and varchar(n)
+};
+typedef struct ColumnDefinition_t ColumnDefinition;
+
+/* One column of a row of a created table, as its type */
+union Value_t {
+  int32_t int_value;
+  int64_t bigint_value;
+  float float_value;
+  double double_value;
+  char text[COLUMN_MAX_TEXT_SIZE + 1];  // char, varchar and date
+};
+typedef union Value_t Value;
+
+struct Statement_t {
+  StatementType type;
+  ExplainMode explain;    // explain or explain analyze prefix
+  Row row_to_insert;      // only used by insert statement
+  Predicate assignment;   // only used by update statement
+  char partition[PARTITION_MONTH_SIZE + 1];  // only used by drop partition
+  char table_name[CATALOG_NAME_SIZE];  // create table, insert into, select from
+  uint32_t num_columns;                // only used by create table
+  ColumnDefinition columns[CATALOG_MAX_COLUMNS];
+  uint32_t num_values;                 // only used by insert into
+  char values[CATALOG_MAX_COLUMNS][COLUMN_MAX_TEXT_SIZE + 1];
+  Column join_on;                      // only used by select join
+  bool has_order_by;                   // only used by select
+  Column order_by;
+  bool descending;
+  bool has_limit;
+  uint32_t limit;
+  char join_column[CATALOG_NAME_SIZE];
+  uint32_t num_predicates;
+  Predicate predicates[MAX_PREDICATES];  // where clause, combined with and
+};
+typedef struct Statement_t Statement;
+
+/* Receives the rows of execute_concurrently's statements */
+typedef void (*RowCallback)(void* context, uint32_t statement_num, Row* row);
+
+enum PrefetchState_t {
+  PREFETCH_NONE,
+  PREFETCH_QUEUED,
+  PREFETCH_READING,
+  PREFETCH_READY
+};
+typedef enum PrefetchState_t PrefetchState;
+
+/*
+ * Read-ahead for leaf scans and for queries waiting on a page. A few
+ * worker threads read queued pages into frames of their own; get_page
+ * adopts a frame on a cache miss instead of reading the page itself.
+ * Everything below, and the pager's free frame stack, is guarded by lock.
+ */
+struct Prefetcher_t {
+  pthread_t threads[PREFETCH_WORKERS];
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  bool stop;
+  uint32_t queue[PREFETCH_QUEUE_SIZE];
+  uint32_t queue_head;
+  uint32_t queue_length;
+  PrefetchState states[TABLE_MAX_PAGES];
+  void* frames[TABLE_MAX_PAGES];
+};
+typedef struct Prefetcher_t Prefetcher;
+
+/*
+ * Page frames are carved out of one arena reserved when the pager opens,
+ * so caching a page never calls malloc. Free frames are kept on a stack.
+ *
+ * last_access and previous_access are the last two statements that used
+ * each page (0 for never), kept for pages that are not cached as well.
+ * They pick which pages to drop when the cache is over its capacity.
+ */
+struct Pager_t {
+  const char* filename;
+  bool direct;  // bypass the OS page cache, frames must be aligned
+  int file_descriptor;
+  uint32_t file_length;
+  uint32_t num_pages;
+  void* pages[TABLE_MAX_PAGES];
+  void* frame_arena;
+  void* free_frames[TABLE_MAX_PAGES];
+  uint32_t num_free_frames;
+  Prefetcher prefetcher;
+  uint64_t statement_clock;
+  uint64_t last_access[TABLE_MAX_PAGES];
+  uint64_t previous_access[TABLE_MAX_PAGES];
+  uint64_t scanned[TABLE_MAX_PAGES];  // statement a scan cursor entered it
+  int lock;                 // F_RDLCK, F_WRLCK or F_UNLCK on the file
+  uint32_t change_counter;  // file header's, as of the cached pages
+  void* header_buffer;      // for reading the change counter
+};
+typedef struct Pager_t Pager;
+
+/*
+ * In-memory copy of the string dictionary. Codes are assigned in insertion
+ * order, so a code is also the index into entries. buckets is an open
+ * addressing hash of code + 1 (0 marks an empty bucket).
+ */
+struct Dictionary_t {
+  uint32_t num_entries;
+  uint32_t capacity;
+  char** entries;
+  uint32_t num_buckets;
+  uint32_t* buckets;
+  uint32_t last_page_num;
+};
+typedef struct Dictionary_t Dictionary;
+
+/*
+ * Where each column of a created table lives in a cell. The key column
+ * (field 0) is the cell's key, encoded so that strncmp orders keys like
+ * the column's values; the other columns are packed back to back in the
+ * value without padding. Built from the catalog, not written by hand.
+ */
+struct Field_t {
+  ColumnType type;
+  uint32_t length;
+  uint32_t offset;  // in the value
+  uint32_t size;    // bytes stored
+};
+typedef struct Field_t Field;
+
+struct RowCodec_t {
+  uint32_t num_fields;
+  Field fields[CATALOG_MAX_COLUMNS];
+  uint32_t key_size;
+  uint32_t value_size;
+};
+typedef struct RowCodec_t RowCodec;
+
+struct Table_t {
+  Pager* pager;
+  uint32_t root_page_num;
+  Dictionary* dictionary;
+  RowCodec* codecs;  // one per catalog entry
+};
+typedef struct Table_t Table;
+
+struct Cursor_t {
+  Table* table;
+  uint32_t page_num;
+  uint32_t cell_num;
+  bool end_of_table;  // Indicates a position one past the last element
+};
+typedef struct Cursor_t Cursor;
+
+/*
+ * Query plans. A plan is a fixed set of operators, each either used by
+ * the query or not, listed from the one that returns rows down to the
+ * scans that feed it. explain analyze points profile at the plan while
+ * the query runs so the operators can record what they actually did.
+ */
+enum PlanOperator_t {
+  PLAN_LIMIT,
+  PLAN_SORT,
+  PLAN_JOIN,
+  PLAN_SCAN,        // the viewing table
+  PLAN_TABLE_SCAN,  // a created table
+  NUM_PLAN_OPERATORS
+};
+typedef enum PlanOperator_t PlanOperator;
+
+struct OperatorStats_t {
+  uint64_t rows;
+  uint64_t page_reads;
+  uint64_t cache_hits;
+  uint64_t nanoseconds;
+};
+typedef struct OperatorStats_t OperatorStats;
+
+struct PlanStep_t {
+  bool used;
+  char detail[PLAN_DETAIL_SIZE];
+  uint64_t estimated_rows;
+  OperatorStats actual;
+};
+typedef struct PlanStep_t PlanStep;
+
+struct QueryPlan_t {
+  PlanStep steps[NUM_PLAN_OPERATORS];
+  uint64_t rows_returned;
+  uint32_t sort_runs;  // runs an external sort wrote to temp files
+  bool join_spilled;
+};
+typedef struct QueryPlan_t QueryPlan;
+
+/*
+ * Page size limits and the layout values the REPL and the benchmarks
+ * need; the rest of the page layout is private to btree.c.
+ */
+extern const uint32_t MIN_PAGE_SIZE;
+extern const uint32_t MAX_PAGE_SIZE;
+extern const uint32_t DEFAULT_PAGE_SIZE;
+extern const uint32_t ROW_SIZE;
+extern const uint32_t LEAF_NODE_KEY_SIZE;
+extern uint32_t PAGE_SIZE;
+extern uint32_t LEAF_NODE_MAX_CELLS;
+
+/* Options set from the command line */
+extern uint32_t join_memory_budget;
+extern uint32_t sort_memory_budget;
+extern uint32_t hash_index_capacity;
+extern uint32_t cache_capacity;
+extern uint32_t memtable_capacity;
+extern int32_t bloom_filter_option;
+extern bool shared_access;
+extern uint32_t read_delay_microseconds;
+
+extern uint64_t num_allocations;
+void* db_malloc(size_t size);
+
+uint64_t now_nanoseconds();
+void crc32c_init();
+void key_heads_init();
+bool is_valid_page_size(uint32_t page_size);
+
+Table* db_open(const char* filename, bool direct, uint32_t page_size);
+void db_close(Table* table);
+void db_vacuum(Table* table);
+void db_backup(Table* table, const char* path);
+void print_backup_status();
+void lsm_settle(Table* table);
+void bloom_filter_open(Table* table);
+bool bloom_filter_build(Table* table, uint32_t bits_per_key);
+ExecuteResult db_begin_statement(Table* table, bool writes);
+void db_end_statement(Table* table);
+void* get_page(Pager* pager, uint32_t page_num);
+
+/* Leaf nodes */
+void initialize_leaf_node(void* node, uint32_t key_size, uint32_t value_size);
+uint32_t* leaf_node_num_cells(void* node);
+uint32_t leaf_node_max_cells(void* node);
+void* leaf_node_cell(void* node, uint32_t cell_num);
+char* leaf_node_key(void* node, uint32_t cell_num);
+void leaf_node_update_heads(void* node);
+void leaf_node_find(Table* table, uint32_t page_num, char* key,
+                    Cursor* cursor);
+void leaf_node_insert(Cursor* cursor, char* key, void* value);
+
+/* Rows of the viewing table */
+void row_key(Row* row, char* key);
+void serialize_row(Row* source, void* destination);
+void deserialize_row(void* source, Row* destination);
+
+/* Statements */
+PrepareResult prepare_query(InputBuffer* input_buffer, Statement* statement);
+bool is_query(Statement* statement);
+ExecuteResult execute_statement(Statement* statement, Table* table);
+ExecuteResult execute_explain(Statement* statement, Table* table);
+ExecuteResult execute_concurrently(Table* table, Statement* statements,
+                                   uint32_t num_statements, uint32_t max_tasks,
+                                   RowCallback callback, void* context);
+
+/* Meta commands */
+void print_constants();
+void print_tree(Pager* pager, uint32_t page_num, uint32_t indentation_level);
+void print_dbinfo(Table* table);
+void* partition_directory(Pager* pager);
+uint32_t* partition_is_partitioned(void* page);
+uint32_t* partition_num_partitions(void* page);
+char* partition_name(void* page, uint32_t index);
+uint32_t* partition_root(void* page, uint32_t index);
+void metrics_write(FILE* file);
+void metrics_record_statement(uint64_t nanoseconds);
+
+#endif
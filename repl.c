@@ -0,0 +1,306 @@
+/*
+ * The interactive shell: reads statements and meta commands from stdin
+ * and runs them against the engine in btree.c.
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "btree.h"
+
+InputBuffer* new_input_buffer() {
+  InputBuffer* input_buffer = db_malloc(sizeof(InputBuffer));
+  input_buffer->buffer = NULL;
+  input_buffer->buffer_length = 0;
+  input_buffer->input_length = 0;
+
+  return input_buffer;
+}
+
+void print_prompt() { printf("db > "); }
+
+void read_input(InputBuffer* input_buffer) {
+  ssize_t bytes_read =
+      getline(&(input_buffer->buffer), &(input_buffer->buffer_length), stdin);
+
+  if (bytes_read <= 0) {
+    printf("Error reading input\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Ignore trailing newline
+  input_buffer->input_length = bytes_read - 1;
+  input_buffer->buffer[bytes_read - 1] = 0;
+}
+
+/*
+ * With --metrics-file the metrics are written there every
+ * metrics_interval seconds by a background thread, and once more at
+ * exit. Each dump goes to a temp file renamed over the last one, so a
+ * scraper never reads half a file.
+ */
+const char* metrics_filename = NULL;
+uint32_t metrics_interval = 10;
+pthread_mutex_t metrics_dump_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void metrics_dump() {
+  pthread_mutex_lock(&metrics_dump_lock);
+  char temp_filename[strlen(metrics_filename) + sizeof(".tmp")];
+  sprintf(temp_filename, "%s.tmp", metrics_filename);
+  FILE* file = fopen(temp_filename, "w");
+  if (file != NULL) {
+    metrics_write(file);
+    fclose(file);
+    rename(temp_filename, metrics_filename);
+  }
+  pthread_mutex_unlock(&metrics_dump_lock);
+}
+
+void* metrics_worker(void* argument) {
+  while (true) {
+    sleep(metrics_interval);
+    metrics_dump();
+  }
+  return NULL;
+}
+
+void metrics_start() {
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, metrics_worker, NULL) != 0) {
+    printf("Unable to start metrics thread.\n");
+    exit(EXIT_FAILURE);
+  }
+  pthread_detach(thread);
+}
+
+/*
+Meta commands that read the database lock it like a query does
+*/
+bool begin_meta_command(Table* table) {
+  if (db_begin_statement(table, false) != EXECUTE_SUCCESS) {
+    printf("Error: Database is locked.\n");
+    return false;
+  }
+  return true;
+}
+
+MetaCommandResult do_meta_command(InputBuffer* input_buffer, Table* table) {
+  if (strcmp(input_buffer->buffer, ".exit") == 0) {
+    db_close(table);
+    if (metrics_filename != NULL) {
+      metrics_dump();
+    }
+    exit(EXIT_SUCCESS);
+  } else if (strcmp(input_buffer->buffer, ".btree") == 0) {
+    if (!begin_meta_command(table)) {
+      return META_COMMAND_SUCCESS;
+    }
+    lsm_settle(table);
+    printf("Tree:\n");
+    void* directory = partition_directory(table->pager);
+    if (!*partition_is_partitioned(directory)) {
+      print_tree(table->pager, table->root_page_num, 0);
+    } else {
+      for (uint32_t i = 0; i < *partition_num_partitions(directory); i++) {
+        printf("partition %s\n", partition_name(directory, i));
+        print_tree(table->pager, *partition_root(directory, i), 1);
+      }
+    }
+    db_end_statement(table);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".vacuum") == 0) {
+    db_vacuum(table);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".backup") == 0) {
+    print_backup_status();
+    return META_COMMAND_SUCCESS;
+  } else if (strncmp(input_buffer->buffer, ".backup ", 8) == 0) {
+    if (begin_meta_command(table)) {
+      db_backup(table, input_buffer->buffer + 8);
+      db_end_statement(table);
+    }
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".dbinfo") == 0) {
+    if (begin_meta_command(table)) {
+      print_dbinfo(table);
+      db_end_statement(table);
+    }
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".stats") == 0) {
+    metrics_write(stdout);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".allocations") == 0) {
+    printf("Allocations: %llu\n", (unsigned long long)num_allocations);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".constants") == 0) {
+    printf("Constants:\n");
+    print_constants();
+    return META_COMMAND_SUCCESS;
+  } else {
+    return META_COMMAND_UNRECOGNIZED_COMMAND;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    printf("Must supply a database filename.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  char* filename = argv[1];
+  bool direct = false;
+  uint32_t page_size = DEFAULT_PAGE_SIZE;
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--direct") == 0) {
+      direct = true;
+    } else if (strcmp(argv[i], "--page-size") == 0 && i + 1 < argc) {
+      page_size = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--join-memory") == 0 && i + 1 < argc) {
+      join_memory_budget = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--sort-memory") == 0 && i + 1 < argc) {
+      sort_memory_budget = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--hash-index") == 0 && i + 1 < argc) {
+      hash_index_capacity = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--cache-pages") == 0 && i + 1 < argc) {
+      cache_capacity = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--memtable") == 0 && i + 1 < argc) {
+      memtable_capacity = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--shared") == 0) {
+      shared_access = true;
+    } else if (strcmp(argv[i], "--bloom-filter") == 0 && i + 1 < argc) {
+      bloom_filter_option = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--metrics-file") == 0 && i + 1 < argc) {
+      metrics_filename = argv[++i];
+    } else if (strcmp(argv[i], "--metrics-interval") == 0 && i + 1 < argc) {
+      metrics_interval = atoi(argv[++i]);
+    } else {
+      printf("Unrecognized option '%s'.\n", argv[i]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (!is_valid_page_size(page_size)) {
+    printf("Page size must be a power of two from %d to %d.\n",
+           MIN_PAGE_SIZE, MAX_PAGE_SIZE);
+    exit(EXIT_FAILURE);
+  }
+  // Slots are picked by the low bits of the hash, so round down to a
+  // power of two
+  while (hash_index_capacity & (hash_index_capacity - 1)) {
+    hash_index_capacity &= hash_index_capacity - 1;
+  }
+  if (cache_capacity == 0) {
+    printf("Cache must hold at least 1 page.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (shared_access && memtable_capacity > 0) {
+    // Buffered rows would be invisible to the other processes
+    printf("--memtable cannot be used with --shared.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (bloom_filter_option < -1 || bloom_filter_option > 64) {
+    printf("Bloom filter bits per key must be from 0 to 64.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (metrics_interval == 0) {
+    printf("Metrics interval must be at least 1 second.\n");
+    exit(EXIT_FAILURE);
+  }
+  crc32c_init();
+  key_heads_init();
+  Table* table = db_open(filename, direct, page_size);
+  if (metrics_filename != NULL) {
+    metrics_start();
+  }
+
+  InputBuffer* input_buffer = new_input_buffer();
+  while (true) {
+    print_prompt();
+    read_input(input_buffer);
+
+    if (input_buffer->buffer[0] == '.') {
+      switch (do_meta_command(input_buffer, table)) {
+        case (META_COMMAND_SUCCESS):
+          continue;
+        case (META_COMMAND_UNRECOGNIZED_COMMAND):
+          printf("Unrecognized command '%s'\n", input_buffer->buffer);
+          continue;
+      }
+    }
+
+    Statement statement;
+    switch (prepare_query(input_buffer, &statement)) {
+      case (PREPARE_SUCCESS):
+        break;
+      case (PREPARE_NEGATIVE_REV):
+        printf("REV must be positive.\n");
+        continue;
+      case (PREPARE_STRING_TO_LONG):
+        printf("String is too long.\n");
+        continue;
+      case (PREPARE_SYNTAX_ERROR):
+        printf("Syntax error. Could not parse statement.\n");
+        continue;
+      case (PREPARE_KEY_COLUMN_UPDATE):
+        printf("Key columns cannot be updated.\n");
+        continue;
+      case (PREPARE_TOO_MANY_COLUMNS):
+        printf("Tables have at most %d columns.\n", CATALOG_MAX_COLUMNS);
+        continue;
+      case (PREPARE_UNRECOGNIZED_STATEMENT):
+        printf("Unrecognized keyword at start of '%s'.\n",
+               input_buffer->buffer);
+        continue;
+    }
+
+    uint64_t start = now_nanoseconds();
+    ExecuteResult result = db_begin_statement(table, !is_query(&statement));
+    if (result == EXECUTE_SUCCESS) {
+      result = statement.explain == EXPLAIN_NONE
+                   ? execute_statement(&statement, table)
+                   : execute_explain(&statement, table);
+    }
+    metrics_record_statement(now_nanoseconds() - start);
+    db_end_statement(table);
+    switch (result) {
+      case (EXECUTE_SUCCESS):
+        printf("Executed.\n");
+        break;
+      case (EXECUTE_DUPLICATE_KEY):
+        printf("Error: Duplicate key.\n");
+        break;
+      case (EXECUTE_TABLE_FULL):
+        printf("Error: Table full.\n");
+        break;
+      case (EXECUTE_TABLE_NOT_EMPTY):
+        printf("Error: Table is not empty.\n");
+        break;
+      case (EXECUTE_NO_SUCH_PARTITION):
+        printf("Error: No such partition.\n");
+        break;
+      case (EXECUTE_NO_SUCH_TABLE):
+        printf("Error: No such table.\n");
+        break;
+      case (EXECUTE_TABLE_EXISTS):
+        printf("Error: Table already exists.\n");
+        break;
+      case (EXECUTE_ROW_TOO_LARGE):
+        printf("Error: Row is too large for the page size.\n");
+        break;
+      case (EXECUTE_BAD_VALUE):
+        printf("Error: Values do not match the table's columns.\n");
+        break;
+      case (EXECUTE_NO_SUCH_COLUMN):
+        printf("Error: No such column.\n");
+        break;
+      case (EXECUTE_DATABASE_LOCKED):
+        printf("Error: Database is locked.\n");
+        break;
+      case (EXECUTE_UNSUPPORTED):
+        printf("Error: Statement is not supported here.\n");
+        break;
+    }
+  }
+}
@@ -1,7 +1,14 @@
+require "json"
+require "pty"
+
 describe 'database' do
-  def run_script(commands)
+  before do
+    File.write("mydb.db", "")
+  end
+
+  def run_script(commands, options = "")
     raw_output = nil
-    IO.popen("./bin/build/db mydb.db", "r+") do |pipe|
+    IO.popen("./bin/build/db mydb.db #{options}", "r+") do |pipe|
       commands.each do |command|
         pipe.puts command
       end
@@ -14,6 +21,28 @@ describe 'database' do
     raw_output.split("\n")
   end
 
+  # A session kept open on a pseudo terminal, so its output comes a
+  # statement at a time
+  def open_session(options)
+    master, slave = PTY.open
+    pid = spawn("./bin/build/db mydb.db #{options}", in: slave, out: slave)
+    slave.close
+    run = lambda do |command|
+      master.write(command + "\n")
+      output = +""
+      until output.include?("Executed.") || output.include?("Rows:")
+        output << master.readpartial(4096)
+      end
+      output
+    end
+    close = lambda do
+      master.write(".exit\n")
+      Process.wait(pid)
+      master.close
+    end
+    [run, close]
+  end
+
   it 'inserts and retreives a row' do
     result = run_script([
       "insert stb2 thehobbit warnerbros 2014-04-02 8.00 2:45",
@@ -108,4 +137,631 @@ describe 'database' do
           "db > ",
       ])
   end
+
+  it 'filters on dictionary encoded columns after reopening' do
+      run_script([
+        "insert stb1 thehobbit warnerbros 2014-04-02 8.00 2:45",
+        "insert stb2 up pixar 2014-04-03 4.00 1:36",
+        "insert stb3 thehobbit warnerbros 2014-04-04 8.00 2:45",
+        ".exit",
+      ])
+      result = run_script([
+        "select where provider = warnerbros",
+        "select where title = up",
+        "select where provider = universal",
+        ".exit",
+      ])
+      expect(result).to match_array([
+        "db > (stb1, thehobbit, warnerbros, 2014-04-02, 8.000000, 2:45)",
+        "(stb3, thehobbit, warnerbros, 2014-04-04, 8.000000, 2:45)",
+        "Executed.",
+        "db > (stb2, up, pixar, 2014-04-03, 4.000000, 1:36)",
+        "Executed.",
+        "db > Executed.",
+        "db > ",
+      ])
+  end
+
+  it 'keeps rows in key order across leaf splits and vacuum' do
+      script = (1..60).to_a.shuffle(random: Random.new(7)).map do |i|
+          "insert stb#{i} title#{i} provider#{i % 3} 2014-04-02 #{i} 1:00"
+      end
+      script << ".vacuum"
+      script << "select"
+      script << ".exit"
+      result = run_script(script)
+      vacuumed = result.find { |line| line.include?("Vacuumed") }
+      expect(vacuumed).to match(/Vacuumed (\d+) pages into (\d+) pages./)
+      before_pages, after_pages = vacuumed.scan(/\d+/).map(&:to_i)
+      expect(after_pages < before_pages).to eq(true)
+      rows = result.map { |line| line.sub(/^(db > )+/, "") }.select { |line| line.start_with?("(") }
+      expected = (1..60).sort_by { |i| "stb#{i}_title#{i}_2014-04-02" }.map { |i| "stb#{i}" }
+      expect(rows.map { |row| row[/^\((\w+),/, 1] }).to eq(expected)
+  end
+
+  it 'deletes a range of rows and reuses the freed pages' do
+      script = (1..200).map do |i|
+          "insert stb#{i} title#{i} provider#{i % 3} 2014-#{format('%02d', i % 12 + 1)}-01 #{i} 1:00"
+      end
+      script << "delete where date < 2014-07-01"
+      script << "select where date < 2014-07-01"
+      script << ".exit"
+      result = run_script(script)
+      expect(result[-3..-1]).to eq([
+        "db > Executed.",
+        "db > Executed.",
+        "db > ",
+      ])
+
+      size_after_delete = File.size("mydb.db")
+      script = (1..100).map do |i|
+          "insert stb#{i} title#{i} provider#{i % 3} 2014-01-01 #{i} 1:00"
+      end
+      script << "select where date = 2014-01-01"
+      script << ".exit"
+      result = run_script(script)
+      rows = result.map { |line| line.sub(/^(db > )+/, "") }.select { |line| line.start_with?("(") }
+      expect(rows.length).to eq(100)
+      expect(File.size("mydb.db")).to eq(size_after_delete)
+  end
+
+  it 'updates non-key columns in place' do
+      result = run_script([
+        "insert stb1 thehobbit warnerbros 2014-04-02 8.00 2:45",
+        "insert stb2 thehobbit warnerbros 2014-04-02 8.00 2:45",
+        "update set rev = 6.5 where stb = stb2",
+        "update set title = up",
+        "select",
+        ".exit",
+      ])
+      expect(result).to match_array([
+        "db > Executed.",
+        "db > Executed.",
+        "db > Executed.",
+        "db > Key columns cannot be updated.",
+        "db > (stb1, thehobbit, warnerbros, 2014-04-02, 8.000000, 2:45)",
+        "(stb2, thehobbit, warnerbros, 2014-04-02, 6.500000, 2:45)",
+        "Executed.",
+        "db > ",
+      ])
+  end
+
+  it 'prunes and drops monthly partitions' do
+      script = ["partition by month"]
+      script += (1..90).map do |i|
+          "insert stb#{i} title#{i} provider1 2014-#{format('%02d', i % 3 + 1)}-01 #{i} 1:00"
+      end
+      script << "drop partition 2014-01"
+      script << "drop partition 2014-01"
+      script << "select where date >= 2014-02-01"
+      script << ".exit"
+      result = run_script(script)
+      expect(result).to include("db > Error: No such partition.")
+      rows = result.map { |line| line.sub(/^(db > )+/, "") }.select { |line| line.start_with?("(") }
+      expect(rows.length).to eq(60)
+      expect(rows.map { |row| row[/(2014-\d\d)/, 1] }.uniq).to eq(["2014-02", "2014-03"])
+
+      size_after_drop = File.size("mydb.db")
+      script = (1..30).map do |i|
+          "insert stb#{i} title#{i} provider1 2014-04-01 #{i} 1:00"
+      end
+      script << "select where date > 2014-03-31"
+      script << ".exit"
+      result = run_script(script)
+      rows = result.map { |line| line.sub(/^(db > )+/, "") }.select { |line| line.start_with?("(") }
+      expect(rows.length).to eq(30)
+      expect(File.size("mydb.db")).to eq(size_after_drop)
+  end
+
+  it 'scans a reopened multi-level table in key order' do
+      script = (1..300).map do |i|
+          "insert stb#{i} title#{i} provider1 2014-04-02 #{i} 1:00"
+      end
+      script << ".vacuum"
+      script << ".exit"
+      run_script(script)
+
+      result = run_script(["select", ".exit"])
+      rows = result.map { |line| line.sub(/^(db > )+/, "") }.select { |line| line.start_with?("(") }
+      expected = (1..300).sort_by { |i| "stb#{i}_title#{i}_2014-04-02" }.map { |i| "stb#{i}" }
+      expect(rows.map { |row| row[/^\((\w+),/, 1] }).to eq(expected)
+  end
+
+  it 'keeps data written with direct I/O' do
+      script = (1..100).map do |i|
+          "insert stb#{i} title#{i} provider1 2014-04-02 #{i} 1:00"
+      end
+      script << ".exit"
+      run_script(script, "--direct")
+
+      result = run_script(["select", ".exit"], "--direct")
+      rows = result.map { |line| line.sub(/^(db > )+/, "") }.select { |line| line.start_with?("(") }
+      expect(rows.length).to eq(100)
+      expect(File.size("mydb.db") % 4096).to eq(0)
+  end
+
+  it 'inserts and selects without heap allocations' do
+      script = ["insert stb0 thehobbit warnerbros 2014-04-02 8.00 2:45", ".allocations"]
+      script += (1..200).map do |i|
+          "insert stb#{i} thehobbit warnerbros 2014-04-02 8.00 2:45"
+      end
+      script << "select where stb = stb150"
+      script << "select"
+      script << ".allocations"
+      script << ".exit"
+      result = run_script(script)
+      allocations = result.select { |line| line.include?("Allocations:") }
+      expect(allocations.length).to eq(2)
+      expect(allocations[0]).to eq(allocations[1])
+  end
+
+  it 'keeps the page size chosen at creation' do
+      script = (1..100).map do |i|
+          "insert stb#{i} title#{i} provider1 2014-04-02 #{i} 1:00"
+      end
+      script << ".exit"
+      run_script(script, "--page-size 16384")
+      expect(File.size("mydb.db") % 16384).to eq(0)
+
+      result = run_script([".constants", "select", ".exit"])
+      expect(result).to include("PAGE_SIZE: 16384")
+      rows = result.map { |line| line.sub(/^(db > )+/, "") }.select { |line| line.start_with?("(") }
+      expect(rows.length).to eq(100)
+  end
+
+  it 'keeps row counts in the header and detects corrupt pages' do
+      script = (1..30).map do |i|
+          "insert stb#{i} title#{i} provider1 2014-04-02 #{i} 1:00"
+      end
+      script << "delete where rev < 11"
+      script << ".exit"
+      run_script(script)
+
+      result = run_script([".dbinfo", ".exit"])
+      expect(result).to include("Rows: 20")
+      expect(result).to include("db > Format version: 3")
+
+      File.open("mydb.db", "r+b") do |file|
+          file.seek(4096 + 100)
+          byte = file.read(1)
+          file.seek(4096 + 100)
+          file.write((byte.ord ^ 0xff).chr)
+      end
+      result = run_script(["select", ".exit"])
+      expect(result).to include("db > Checksum mismatch on page 1. Corrupt file.")
+  end
+
+  it 'stores created tables with their own columns' do
+      script = [
+          "create table devices (id int, model varchar(16), price double, installed date)",
+          "create table rates (provider varchar(20), rate float)",
+          "insert into devices 20 settop 99.5 2014-04-02",
+          "insert into devices -3 dongle 12.25 2013-12-31",
+          "insert into devices 20 other 1 2014-01-01",
+          "insert into devices 21 settop cheap 2014-01-01",
+          "insert into rates netflix 1.5",
+          ".exit",
+      ]
+      result = run_script(script)
+      expect(result).to include("db > Error: Duplicate key.")
+      expect(result).to include("db > Error: Values do not match the table's columns.")
+
+      result = run_script(["select from devices", "select from rates", "select from missing", ".exit"])
+      expect(result).to match_array([
+          "db > (-3, dongle, 12.250000, 2013-12-31)",
+          "(20, settop, 99.500000, 2014-04-02)",
+          "Executed.",
+          "db > (netflix, 1.500000)",
+          "Executed.",
+          "db > Error: No such table.",
+          "db > ",
+      ])
+  end
+
+  it 'joins viewing records with a rate table in memory or spilled' do
+      script = [
+          "create table rates (provider varchar(20), rate float)",
+          "insert into rates netflix 1.5",
+          "insert into rates amazon 0.75",
+          "insert stb1 title1 netflix 2014-04-02 8.0 1:00",
+          "insert stb2 title2 amazon 2014-04-03 4.5 2:00",
+          "insert stb3 title3 hulu 2014-04-04 3.0 3:00",
+          ".exit",
+      ]
+      run_script(script)
+
+      expected = [
+          "(stb1, title1, netflix, 2014-04-02, 8.000000, 1:00, netflix, 1.500000)",
+          "(stb2, title2, amazon, 2014-04-03, 4.500000, 2:00, amazon, 0.750000)",
+      ]
+      ["", "--join-memory 1"].each do |options|
+          result = run_script(["select join rates on provider = provider", ".exit"], options)
+          rows = result.map { |line| line.sub(/^(db > )+/, "") }.select { |line| line.start_with?("(") }
+          expect(rows.sort).to eq(expected)
+      end
+  end
+
+  it 'orders rows by a column with or without spilling sorted runs' do
+      script = (1..40).map do |i|
+          "insert stb#{i} title#{i} provider#{i % 3} 2014-04-02 #{(i * 37) % 41} 1:00"
+      end
+      script << ".exit"
+      run_script(script)
+
+      ["", "--sort-memory 1000"].each do |options|
+          result = run_script(["select order by rev desc", ".exit"], options)
+          revs = result.map { |line| line.sub(/^(db > )+/, "") }.select { |line| line.start_with?("(") }.map { |line| line.split(", ")[4].to_f }
+          expect(revs.length).to eq(40)
+          expect(revs).to eq(revs.sort.reverse)
+      end
+
+      result = run_script(["select where provider = provider1 order by rev limit 2", ".exit"])
+      expect(result).to match_array([
+          "db > (stb10, title10, provider1, 2014-04-02, 1.000000, 1:00)",
+          "(stb40, title40, provider1, 2014-04-02, 4.000000, 1:00)",
+          "Executed.",
+          "db > ",
+      ])
+  end
+
+  it 'explains query plans and measures them with explain analyze' do
+      script = (1..30).map do |i|
+          "insert stb#{i % 3} title#{i} provider#{i % 2} 2014-04-02 #{i} 1:00"
+      end
+      script << ".exit"
+      run_script(script)
+
+      result = run_script([
+          "explain select order by rev desc limit 5",
+          "explain select where stb = stb1",
+          "explain analyze select where stb = stb1",
+          ".exit",
+      ])
+      expect(result[0..3]).to eq([
+          "db > Plan:",
+          "Limit 5 (estimated rows 5)",
+          "  Top-N heap sort on rev desc (estimated rows 30)",
+          "    Full scan of the viewing table (estimated rows 30)",
+      ])
+      expect(result[5]).to eq("db > Plan:")
+      expect(result[6]).to start_with("Range scan of the viewing table from key 'stb1_'")
+      expect(result[8]).to eq("db > Plan:")
+      expect(result[9]).to match(/^Range scan .* actual rows 10, pages read \d+, cache hits \d+, [\d.]+ ms\)$/)
+      expect(result[10]).to eq("Executed.")
+
+      result = run_script(["explain insert stb1 a b 2014-04-02 1 1:00", ".exit"])
+      expect(result[0]).to eq("db > Syntax error. Could not parse statement.")
+  end
+
+  it 'analyzes column statistics and uses them to estimate rows' do
+      script = (1..40).map do |i|
+          provider = i % 10 == 0 ? "p1" : "p0"
+          "insert stb#{i % 4} title#{i} #{provider} 2014-04-02 #{i} 1:00"
+      end
+      script << "explain select where provider = p1"
+      script << "analyze"
+      script << ".exit"
+      result = run_script(script)
+      expect(result[41]).to eq("Full scan of the viewing table (estimated rows 40)")
+
+      result = run_script([
+          ".dbinfo",
+          "explain select where provider = p1",
+          "explain select where provider = p0 and rev <= 20",
+          ".exit",
+      ])
+      expect(result).to include(
+          "Statistics: 40 of 40 rows sampled, 0 changed since",
+          "Column provider: 2 distinct, p0 to p1",
+          "Column rev: 40 distinct, 1.000000 to 40.000000",
+          "Full scan of the viewing table (estimated rows 5)",
+          "Full scan of the viewing table (estimated rows 18)",
+      )
+  end
+
+  it 'counts statements, rows and pages for .stats and the metrics file' do
+      script = (1..10).map do |i|
+          "insert stb#{i} title#{i} provider 2014-04-02 #{i} 1:00"
+      end
+      script += ["select where rev > 5", ".stats", ".exit"]
+      result = run_script(script, "--metrics-file metrics.prom")
+      expect(result).to include(
+          "simpledb_statements_total 11",
+          "simpledb_rows_scanned_total 10",
+          'simpledb_statement_seconds_bucket{le="+Inf"} 11',
+          "simpledb_statement_seconds_count 11",
+      )
+
+      metrics = File.read("metrics.prom").split("\n")
+      File.delete("metrics.prom")
+      expect(metrics).to include(
+          "# TYPE simpledb_pages_written_total counter",
+          "simpledb_statements_total 11",
+          "simpledb_fsyncs_total 1",
+      )
+  end
+
+  it 'runs the benchmark suite and reports every workload as json' do
+      output = `ruby bench/bench.rb --sizes 50 --lookups 10 --scans 5`
+      results = output.split("\n").map { |line| JSON.parse(line) }
+      expect(results.map { |result| result["workload"] }).to eq([
+          "insert_sequential", "insert_random", "point_lookup",
+          "point_lookup_missing", "range_scan_stb", "range_scan_100", "filter_scan", "top_n",
+          "point_lookup_mixed",
+      ])
+      results.each do |result|
+          expect(result["rows"]).to eq(50)
+          expect(result["p99_us"]).to be >= result["p50_us"]
+      end
+  end
+
+  it 'times the node-level primitives for every distribution and fill' do
+      output = `bin/build/micro --ops 100 --page-size 4096`
+      results = output.split("\n").map { |line| JSON.parse(line) }
+      expect(results.map { |result| result["primitive"] }.uniq).to eq([
+          "leaf_node_find", "leaf_node_insert", "serialize_row",
+          "deserialize_row", "row_key",
+      ])
+      expect(results.map { |result| result["distribution"] }.uniq).to eq([
+          "sequential", "random", "prefix",
+      ])
+      finds = results.select { |result| result["primitive"] == "leaf_node_find" }
+      expect(finds.map { |result| result["fill"] }.uniq).to eq([0.25, 0.5, 0.75, 1.0])
+      results.each do |result|
+          expect(result["ops"]).to eq(100)
+          expect(result["ns_per_op"]).to be >= 0
+      end
+  end
+
+  it 'finds keys that only differ after a long shared prefix' do
+      title = "x" * 200
+      dates = (1..28).map { |day| format("2014-04-%02d", day) }
+      script = dates.map { |date| "insert stb1 #{title} provider1 #{date} 1 1:00" }
+      script << "insert stb0 #{title} provider1 2014-04-01 1 1:00"
+      script << "insert stb2 #{title} provider1 2014-04-20 1 1:00"
+      script << "insert stb1 #{title} provider1 2014-04-15 1 1:00"
+      script << "delete where date < 2014-04-05"
+      script << ".vacuum"
+      script << ".exit"
+      result = run_script(script)
+      expect(result).to include("db > Error: Duplicate key.")
+
+      lookups = dates.map { |date| "select where key = stb1_#{title}_#{date}" }
+      lookups << "select where key = stb2_#{title}_2014-04-20"
+      lookups << "select where key = stb1_#{title}_2014-04-1"
+      lookups << ".exit"
+      rows = run_script(lookups).select { |line| line.include?("(") }
+      expect(rows.length).to eq(25)
+      expect(rows.last).to start_with("db > (stb2, ")
+  end
+
+  it 'answers repeated key lookups from the hash index' do
+      script = (1..60).map do |i|
+          "insert stb#{i} title#{i} provider 2014-04-02 #{i} 1:00"
+      end
+      3.times { script << "select where key = stb7_title7_2014-04-02" }
+      script << "delete where rev < 10"
+      script << "select where key = stb7_title7_2014-04-02"
+      script << "select where key = stb50_title50_2014-04-02"
+      script << ".stats"
+      script << ".exit"
+      result = run_script(script, "--hash-index 1024 --page-size 4096")
+      rows = result.select { |line| line.include?("(") }
+      expect(rows.length).to eq(4)
+      expect(rows.last).to start_with("db > (stb50, title50, ")
+      expect(result).to include(
+          "simpledb_hash_index_hits_total 3",
+          "simpledb_hash_index_misses_total 2",
+      )
+  end
+
+  it 'keeps hot leaves cached while a scan runs through a small cache' do
+      script = (1..200).map do |i|
+          "insert stb#{i} title#{i} provider 2014-04-02 #{i} 1:00"
+      end
+      script << ".exit"
+      run_script(script, "--page-size 4096 --cache-pages 8")
+
+      lookup = "select where key = stb7_title7_2014-04-02"
+      result = run_script([
+          lookup, lookup, "select where rev > 1000", ".stats", lookup, ".stats",
+          "select where rev >= 150", ".exit",
+      ], "--cache-pages 8")
+      misses = result.grep(/^simpledb_cache_misses_total/)
+      expect(misses.length).to eq(2)
+      expect(misses[1]).to eq(misses[0])
+      expect(result.grep(/^simpledb_cache_evictions_total/).first).not_to eq(
+          "simpledb_cache_evictions_total 0")
+      expect(result.count { |line| line.include?("(stb") }).to eq(3 + 51)
+  end
+
+  it 'backs up a consistent copy while inserts go on' do
+      File.delete("backup.db") if File.exist?("backup.db")
+      script = (1..300).map do |i|
+          "insert stb#{i} title#{i} provider 2014-04-02 #{i} 1:00"
+      end
+      script << ".backup backup.db"
+      script << "delete where rev < 100"
+      script += (301..320).map do |i|
+          "insert stb#{i} title#{i} provider 2014-04-02 #{i} 1:00"
+      end
+      script << ".backup"
+      script << ".exit"
+      result = run_script(script, "--page-size 4096")
+      expect(result.last(2).first).to match(
+          /^db > Backup to backup.db finished: \d+ pages, \d+ written, 0 unchanged\.$/)
+
+      idle = ["select where rev > 1000"] * 10
+      result = run_script([".backup backup.db"] + idle + [
+          "insert stb0 title0 provider 2014-04-02 1 1:00", ".backup backup.db",
+      ] + idle + [".backup", ".exit"])
+      written, unchanged = result.last(2).first.scan(/(\d+) written, (\d+) unchanged/)[0]
+      expect(unchanged.to_i).to be > written.to_i
+
+      File.rename("backup.db", "mydb.db")
+      rows = run_script(["select", ".exit"]).select { |line| line.include?("(stb") }
+      expect(rows.length).to eq(222)
+  end
+
+  it 'buffers inserts in a memtable and merges sorted runs into the tree' do
+      keys = (1..60).map { |i| i * 37 % 61 }
+      script = keys.map do |i|
+          "insert stb#{i} title#{i} provider 2014-04-02 #{i} 1:00"
+      end
+      script << "insert stb5 title5 provider 2014-04-02 5 1:00"
+      script << "select where key = stb#{keys.last}_title#{keys.last}_2014-04-02"
+      script << "select where key = stb#{keys[3]}_title#{keys[3]}_2014-04-02"
+      script << ".stats"
+      script << "select"
+      script << ".exit"
+      result = run_script(script, "--memtable 8 --page-size 4096")
+      expect(result).to include("db > Error: Duplicate key.")
+      expect(result).to include(
+          "db > (stb#{keys.last}, title#{keys.last}, provider, 2014-04-02, #{keys.last}.000000, 1:00)",
+          "simpledb_memtable_flushes_total 7",
+      )
+      rows = result.select { |line| line.include?("(stb") }
+      expect(rows.length).to eq(2 + 60)
+      listed = rows.last(60).map do |line|
+          stb, title, _, date = line.sub(/^(db > )?\(/, "").split(", ")
+          "#{stb}_#{title}_#{date}"
+      end
+      expect(listed).to eq(listed.sort)
+  end
+
+  it 'rules out new and missing keys with a persistent bloom filter' do
+      script = (1..100).map do |i|
+          "insert stb#{i} title#{i} provider 2014-04-02 #{i} 1:00"
+      end
+      script << "insert stb7 title7 provider 2014-04-02 7 1:00"
+      script << "select where key = stb7_title7_2014-04-02"
+      script << "select where key = stb7_title8_2014-04-02"
+      script << ".stats"
+      script << ".exit"
+      result = run_script(script, "--bloom-filter 10 --page-size 4096")
+      expect(result).to include("db > Error: Duplicate key.")
+      expect(result.select { |line| line.include?("(") }.length).to eq(1)
+      count = lambda do |name|
+          result.find { |line| line.start_with?("simpledb_#{name} ") }.split.last.to_i
+      end
+      # Every new key and the missing one are checked; few get through
+      expect(count.call("bloom_filter_negatives_total") +
+             count.call("bloom_filter_false_positives_total")).to be >= 100
+      expect(count.call("bloom_filter_negatives_total")).to be >= 95
+
+      # The filter is kept in the file and maintained without the option
+      result = run_script([
+          "insert stb7 title7 provider 2014-04-02 7 1:00",
+          "insert stb101 title101 provider 2014-04-02 1 1:00",
+          ".dbinfo",
+          ".exit",
+      ])
+      expect(result).to include("db > Error: Duplicate key.")
+      info = result.find { |line| line.start_with?("Bloom filter: ") }
+      expect(info).to start_with(
+          "Bloom filter: 10 bits per key, 7 hashes, 320 bytes for 101 keys, ")
+
+      result = run_script([".dbinfo", ".exit"], "--bloom-filter 0")
+      expect(result.any? { |line| line.include?("Bloom filter") }).to eq(false)
+  end
+
+  it 'shares the file between processes with --shared and locks it without' do
+      run, close = open_session("--shared")
+      run.call("insert stb1 title1 provider 2014-04-02 1 1:00")
+      result = run_script([
+          "select",
+          "insert stb2 title2 provider 2014-04-02 2 1:00",
+          ".exit",
+      ], "--shared")
+      expect(result).to include("db > (stb1, title1, provider, 2014-04-02, 1.000000, 1:00)")
+      # The first session sees the other one's row once it is written
+      expect(run.call("select")).to include("(stb2, title2, provider, 2014-04-02, 2.000000, 1:00)")
+      close.call
+
+      run, close = open_session("")
+      run.call(".dbinfo")
+      # The second process exits before reading any input
+      expect(`./bin/build/db mydb.db < /dev/null`).to eq("Database is locked by another process.\n")
+      close.call
+  end
+
+  it 'runs concurrent cold queries as tasks with the rows select prints' do
+      # The harness fails if any query's rows differ from execute_select's
+      # or if a statement a task cannot run is not refused
+      output = `bin/build/concurrent --rows 200 --read-delay 0`
+      expect($?.success?).to eq(true)
+      results = output.split("\n").map { |line| JSON.parse(line) }
+      expect(results.map { |result| result["workload"] }.uniq).to eq([
+          "point_lookup", "range_scan",
+      ])
+      expected_rows = {"point_lookup" => 1, "range_scan" => 50}
+      results.group_by { |result| result["workload"] }.each do |workload, runs|
+          expect(runs.map { |result| result["concurrency"] }).to eq([1, 2, 4, 8, 16])
+          runs.each do |result|
+              expect(result["rows"]).to eq(result["queries"] * expected_rows[workload])
+          end
+      end
+  end
+
+  it 'joins on a value most rows share within the join memory budget' do
+      script = ["create table plans (id int, provider varchar(20))"]
+      script += (1..30).map { |i| "insert into plans #{i} #{i % 10 == 0 ? "hulu" : "netflix"}" }
+      script += (1..12).map { |i| "insert stb#{i} title#{i} #{i % 4 == 0 ? "hulu" : "netflix"} 2014-04-02 1 1:00" }
+      script << ".exit"
+      run_script(script)
+
+      results = ["", "--join-memory 1", "--join-memory 2000"].map do |options|
+          result = run_script(["select join plans on provider = provider", ".exit"], options)
+          result.map { |line| line.sub(/^(db > )+/, "") }.select { |line| line.start_with?("(") }.sort
+      end
+      expect(results[0].length).to eq(9 * 27 + 3 * 3)
+      expect(results[1]).to eq(results[0])
+      expect(results[2]).to eq(results[0])
+  end
+
+  it 'refuses to back up the database onto itself under another path' do
+      File.symlink("mydb.db", "link.db")
+      result = run_script([
+          "insert stb1 title1 provider 2014-04-02 1 1:00",
+          ".backup ./mydb.db",
+          ".backup link.db",
+          ".exit",
+      ])
+      File.delete("link.db")
+      expect(result.count("db > Cannot back up the database onto itself.")).to eq(2)
+      expect(run_script(["select", ".exit"])).to include("db > (stb1, title1, provider, 2014-04-02, 1.000000, 1:00)")
+  end
+
+  it 'fills the file about as full with --memtable as without it' do
+      random = Random.new(1)
+      script = (1..1200).map do |i|
+          "insert stb#{format("%05d", random.rand(100000))} title#{i} provider#{i % 20} 2014-04-#{format("%02d", i % 28 + 1)} 1 1:00"
+      end
+      script << ".exit"
+      rows = ["", "--memtable 50"].map do |options|
+          File.write("mydb.db", "")
+          result = run_script(script, options)
+          expect(result).to include("db > Error: Table full.")
+          run_script(["select", ".exit"]).count { |line| line.include?("(") }
+      end
+      expect(rows[1]).to be >= rows[0] * 0.95
+  end
+
+  it 'keeps the rows of a --shared process that waited through a vacuum' do
+      run, close = open_session("")
+      run.call("insert stb1 title1 provider 2014-04-02 1 1:00")
+      # Opens the file, then waits for the lock while it is vacuumed
+      waiting = IO.popen("./bin/build/db mydb.db --shared", "r+")
+      waiting.puts "insert stb2 title2 provider 2014-04-02 2 1:00"
+      waiting.puts ".exit"
+      waiting.close_write
+      sleep 0.5
+      run.call(".vacuum\ninsert stb3 title3 provider 2014-04-02 3 1:00")
+      close.call
+      expect(waiting.gets(nil)).to eq("db > Executed.\ndb > ")
+      waiting.close
+
+      result = run_script(["select", ".exit"])
+      expect(result.count { |line| line.include?("(") }).to eq(3)
+  end
 end